@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+// Reusable barrier between the phases of the parallel engines (the quanta of
+// CacheSimulator's, the partition and simulation steps of SimpleCache's).
+// Phases are often only a little work, so waiters spin briefly before
+// yielding.
+class Spin_Barrier {
+private:
+    const int n_threads;
+    std::atomic<int> arrived{0};
+    std::atomic<int> generation{0};
+public:
+    explicit Spin_Barrier(int n_threads): n_threads(n_threads) {}
+    void wait() {
+        int current = generation.load(std::memory_order_acquire);
+        if (arrived.fetch_add(1, std::memory_order_acq_rel) == n_threads - 1) {
+            arrived.store(0, std::memory_order_relaxed);
+            generation.fetch_add(1, std::memory_order_release);
+            return;
+        }
+        for (int spins = 0; generation.load(std::memory_order_acquire) == current; spins++) {
+            if (spins > 64) {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Open-addressing map from a block (its number or address) to a record of
+// counters, grown as blocks come: the per-block bookkeeping of the sharing
+// report and the first-touch pages of miss classification, whose footprints
+// are not known ahead.
+template <typename T>
+class Block_Table {
+private:
+    static constexpr uint64_t empty = UINT64_MAX;
+    struct Slot {
+        uint64_t block = empty;
+        T value;
+    };
+    std::vector<Slot> slots; // a lookup touches one cache line
+    size_t used = 0;
+    size_t last = 0; // slot of the last block looked up, most often the next
+
+    size_t home(uint64_t block) const {
+        uint64_t hash = block * 0x9E3779B97F4A7C15ull;
+        return size_t(hash ^ hash >> 32) & (slots.size() - 1);
+    }
+    size_t find(uint64_t block) const {
+        size_t mask = slots.size() - 1;
+        size_t i = home(block);
+        while (slots[i].block != empty && slots[i].block != block) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    void grow(size_t size) {
+        std::vector<Slot> old(size);
+        old.swap(slots);
+        for (const Slot& slot : old) {
+            if (slot.block != empty) {
+                slots[find(slot.block)] = slot;
+            }
+        }
+    }
+public:
+    T& operator[](uint64_t block) {
+        if (!slots.empty() && slots[last].block == block) {
+            return slots[last].value;
+        }
+        if (4 * (used + 1) > 3 * slots.size()) {
+            grow(slots.empty() ? 1024 : 2 * slots.size());
+        }
+        size_t i = find(block);
+        if (slots[i].block == empty) {
+            slots[i].block = block;
+            used++;
+        }
+        last = i;
+        return slots[i].value;
+    }
+    // starts loading the block's slot into the host's cache
+    void prefetch(uint64_t block) const {
+        if (!slots.empty()) {
+            __builtin_prefetch(&slots[home(block)]);
+        }
+    }
+    // the record of the block, or a zero one
+    T get(uint64_t block) const {
+        if (slots.empty()) {
+            return T();
+        }
+        const Slot& slot = slots[find(block)];
+        return slot.block == empty ? T() : slot.value;
+    }
+    template <typename F>
+    void for_each(F f) const {
+        for (const Slot& slot : slots) {
+            if (slot.block != empty) {
+                f(slot.block, slot.value);
+            }
+        }
+    }
+    size_t size() const {
+        return used;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        archive.io(slots);
+        used = 0;
+        for (const Slot& slot : slots) {
+            used += slot.block != empty;
+        }
+        last = 0;
+        if ((slots.size() & (slots.size() - 1)) != 0 || 4 * used > 3 * slots.size()) {
+            archive.fail();
+        }
+    }
+};
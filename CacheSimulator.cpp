@@ -1,406 +1,353 @@
-#include<iostream> 
-#include<fstream>
-#include<string> 
-#include<unordered_map> 
-#include<list> 
-#include<vector> 
-#include<utility> 
-#include<queue>
+#include <atomic>
 #include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CacheSimulator.h"
 
+std::vector<std::string> split_list(const std::string& arg) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (true) {
+        size_t comma = arg.find(',', start);
+        items.push_back(arg.substr(start, comma - start));
+        if (comma == std::string::npos) {
+            return items;
+        }
+        start = comma + 1;
+    }
+}
 
-std::string protocol; 
-std::string input_file; 
-int cache_size; 
-int associativity; 
-int block_size = 32; // 32 bytes by default
-const int word_size = 4; // 4 bytes; 
-const int base = 19102004; 
-const int ram_access = 100; 
-const int cache_access = 1;
-
-class Bus; 
-class LRU_Cache; 
-class Core; 
-class Operating_System; 
+std::vector<int> parse_int_list(const std::string& arg) {
+    std::vector<int> values;
+    for (const std::string& item : split_list(arg)) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
 
-struct Monitor {
-    // Cache calculate 
-    int overall_cyc = 0; 
-    std::vector<int> compute_cyc; 
-    std::vector<int> ls_ins; 
-    std::vector<int> idle_cyc; 
-    std::vector<std::pair<int, int>> hit_miss_cnt; 
-    int bus_data_traffic = 0; 
-    int bus_invalidate_update_cnt = 0; 
-    int distribution = 0; 
+// Decoded traces a sweep keeps in memory, in bytes. Workloads past it are
+// streamed from their files by every simulation instead.
+const size_t sweep_trace_budget = size_t(1) << 30;
 
-    int num_cores;
-    Monitor(int num_cores): num_cores(num_cores) {
-        compute_cyc = std::vector<int>(num_cores, 0);
-        ls_ins = std::vector<int>(num_cores, 0);
-        idle_cyc = std::vector<int>(num_cores, 0); 
-        hit_miss_cnt = std::vector<std::pair<int, int>>(num_cores, {0, 0}); 
-    }
-    void print_statistics() const {
-        std::cout << "\n========================================" << std::endl;
-        std::cout << "        SIMULATION RESULTS" << std::endl;
-        std::cout << "========================================\n" << std::endl;
-        
-        // 1. Overall execution cycles
-        std::cout << "1. Overall Execution Cycles: " << overall_cyc << std::endl;
-        std::cout << std::endl;
-        
-        // 2. Compute cycles per core
-        std::cout << "2. Compute Cycles:" << std::endl;
-        for (int i = 0; i < num_cores; i++) {
-            std::cout << "   Core " << i << ": " << compute_cyc[i] << std::endl;
+// Runs every workload x cache size x associativity x block size combination
+// in this process. Each trace is decoded once, within sweep_trace_budget, and
+// shared read-only by all simulations, which run concurrently on one thread
+// per hardware thread.
+// Prints one row per configuration; per-core counters are summed over cores.
+// base supplies everything but the workload and the cache geometry
+void run_sweep(const Config& base, const std::vector<std::string>& workloads, const std::vector<int>& cache_sizes,
+               const std::vector<int>& associativities, const std::vector<int>& block_sizes, int n_cores) {
+    const std::string& format = base.format;
+    std::map<std::string, std::vector<std::vector<Trace_Record>>> traces;
+    std::vector<Config> configs;
+    size_t budget = sweep_trace_budget / sizeof(Trace_Record);
+    for (const std::string& workload : workloads) {
+        std::vector<std::vector<Trace_Record>> per_core(n_cores);
+        bool loaded = true;
+        std::string error;
+        for (int i = 0; i < n_cores && loaded; i++) {
+            loaded = load_trace(Core::trace_path(workload, i), per_core[i], error, budget);
+            budget -= per_core[i].size();
         }
-        std::cout << std::endl;
-        
-        // 3. Load/store instructions per core
-        std::cout << "3. Load/Store Instructions:" << std::endl;
-        for (int i = 0; i < num_cores; i++) {
-            std::cout << "   Core " << i << ": " << ls_ins[i] << std::endl;
+        for (int i = 0; i < n_cores && !loaded; i++) {
+            budget += per_core[i].size();
+            // over the budget: streamed, provided every file opens
+            Trace_Reader probe;
+            if (error.empty() && !probe.open(Core::trace_path(workload, i))) {
+                error = probe.error();
+            }
         }
-        std::cout << std::endl;
-        
-        // 4. Idle cycles per core
-        std::cout << "4. Idle Cycles:" << std::endl;
-        for (int i = 0; i < num_cores; i++) {
-            std::cout << "   Core " << i << ": " << idle_cyc[i] << std::endl;
+        if (!error.empty()) {
+            std::cerr << error << ", skipping " << workload << std::endl;
+            continue;
         }
-        std::cout << std::endl;
-        
-        // 5. Cache hit/miss counts per core
-        std::cout << "5. Cache Statistics:" << std::endl;
-        for (int i = 0; i < num_cores; i++) {
-            int hits = hit_miss_cnt[i].first;
-            int misses = hit_miss_cnt[i].second;
-            int total = hits + misses;
-            double hit_rate = total > 0 ? (100.0 * hits / total) : 0.0;
-            
-            std::cout << "   Core " << i << ":" << std::endl;
-            std::cout << "      Hits:   " << hits << std::endl;
-            std::cout << "      Misses: " << misses << std::endl;
-            std::cout << "      Hit Rate: " << std::fixed << std::setprecision(2) 
-                      << hit_rate << "%" << std::endl;
+        if (loaded) {
+            traces[workload] = std::move(per_core);
+        }
+        for (int cache_size : cache_sizes) {
+            for (int associativity : associativities) {
+                for (int block_size : block_sizes) {
+                    Config config = base;
+                    config.input_file = workload;
+                    config.cache_size = cache_size;
+                    config.associativity = associativity;
+                    config.block_size = block_size;
+                    configs.push_back(config);
+                }
+            }
         }
-        std::cout << std::endl;
-        
-        // 6. Bus data traffic
-        std::cout << "6. Bus Data Traffic: " << bus_data_traffic << " bytes" << std::endl;
-        std::cout << std::endl;
-        
-        // 7. Invalidations or updates
-        std::cout << "7. Invalidations/Updates on Bus: " 
-                  << bus_invalidate_update_cnt << std::endl;
-        std::cout << std::endl;
-        
-        // 8. Private vs shared data distribution
-        std::cout << "8. Data Access Distribution:" << std::endl;
-        std::cout << "   Private: " << distribution << std::endl;
-        std::cout << "   Shared:  " << 0 << " (N/A for single core)" << std::endl;
-        
-        std::cout << "\n========================================\n" << std::endl;
-    }
-}; 
-
-class Bus {
-private: 
-    std::queue<LRU_Cache*> io_dram_request;
-    int waiting_io; 
-    int* global_cycle;
-    Monitor* monitor;
-public: 
-    Bus(int* global_cycle, Monitor* monitor): global_cycle(global_cycle), monitor(monitor) {
-        waiting_io = -1;
     }
-    void update_state();
-    void request(LRU_Cache* cache, int data, int type);
-}; 
-
-class LRU_Cache {
-private: 
 
-    // LRU_Cache data member
-    class Entry {
-    public: 
-        int address;
-        std::vector<int> words;
-        bool dirty;
-        Entry() {}
-        Entry(int address, std::vector<int> words, bool dirty): address(address), words(words), dirty(dirty) {}
+    std::vector<Monitor> results(configs.size(), Monitor(n_cores));
+    std::atomic<size_t> next_config(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next_config++) < configs.size()) {
+            auto loaded = traces.find(configs[i].input_file);
+            Operating_System operating_system(configs[i], n_cores, loaded == traces.end() ? nullptr : &loaded->second);
+            operating_system.run();
+            results[i] = operating_system.statistics();
+        }
     };
-    // map from tag + index (tag + index = block memory address) -> corresponding location(iterator)
-    std::unordered_map<int, std::list<Entry>::iterator> entry_location;
-    std::vector<std::list<Entry>> cache_sets; 
-    int associativity;
-    int cache_size;
-    int number_sets;
-    int block_size;
-    // Bus;
-    Bus* bus;
-    // monitor 
-    Monitor* monitor;
-    
-    int *global_cycle; 
-
-    Core* core;
-
-    int n_waiting_io;
-
-public: 
-    LRU_Cache(Core* core, int cache_size, int associativity, int block_size, int* global_cycle, Monitor* monitor, Bus* bus): core(core), cache_size(cache_size), associativity(associativity), block_size(block_size), global_cycle(global_cycle), monitor(monitor), bus(bus)  {
-        number_sets = cache_size / (associativity * block_size);
-        cache_sets = std::vector<std::list<Entry>>(number_sets, std::list<Entry>()); 
-        n_waiting_io = 0;
+    size_t n_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), configs.size());
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < n_threads; t++) {
+        threads.emplace_back(worker);
     }
-    void reorder(int index, int block_memory) {
-        auto it = entry_location[block_memory];
-        cache_sets[index].splice(cache_sets[index].begin(), cache_sets[index], it);
-        entry_location[block_memory] = cache_sets[index].begin();
-
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
     }
-    bool evict(int index) {
-        auto& evict_entry = *(--cache_sets[index].end()); 
-        bool dirty = evict_entry.dirty;
-        int address = evict_entry.address; 
-        int block_memory = address / block_size; 
-        int tag = block_memory / number_sets; 
-        
-        entry_location.erase(block_memory);
-        cache_sets[index].erase(--cache_sets[index].end());
-        if (dirty) {
-            store_words_to_ram();
+
+    if (format == "json") {
+        std::cout << "[";
+        for (size_t i = 0; i < configs.size(); i++) {
+            std::cout << (i ? ",\n " : "\n ");
+            results[i].print_json(std::cout, &configs[i]);
         }
-        return dirty;
+        std::cout << "\n]" << std::endl;
+        return;
     }
-    void store_words_to_ram() {
-        n_waiting_io++; 
-        if (n_waiting_io == 1) {
-            bus->request(this, block_size, 0);
+    if (format == "csv") {
+        Monitor::print_csv_header(std::cout, true);
+        for (size_t i = 0; i < configs.size(); i++) {
+            results[i].print_csv(std::cout, &configs[i]);
         }
+        return;
     }
-    std::vector<int> load_words_from_ram(int address) {
-        int index = (int)(address / block_size) % number_sets; 
-        // return vector have size = block size to represent getting
-        if (cache_sets[index].size() == associativity) {
-            bool check_write_back = evict(index);
-        }
-        n_waiting_io++; 
-        if (n_waiting_io == 1) {
-            bus->request(this, block_size, 0);
+    std::cout << std::left << std::setw(14) << "Workload" << std::right
+              << std::setw(10) << "CacheSize" << std::setw(6) << "Assoc" << std::setw(6) << "Block"
+              << std::setw(14) << "Cycles" << std::setw(14) << "Compute" << std::setw(12) << "LoadStore"
+              << std::setw(14) << "Idle" << std::setw(12) << "Hits" << std::setw(12) << "Misses"
+              << std::setw(9) << "HitRate" << std::setw(14) << "BusBytes" << std::setw(10) << "InvUpd" << std::endl;
+    for (size_t i = 0; i < configs.size(); i++) {
+        const Monitor& m = results[i];
+        long long compute = 0, ls = 0, idle = 0, hits = 0, misses = 0;
+        for (int c = 0; c < n_cores; c++) {
+            compute += m.compute_cyc[c];
+            ls += m.ls_ins[c];
+            idle += m.idle_cyc[c];
+            hits += m.hit_miss_cnt[c].first;
+            misses += m.hit_miss_cnt[c].second;
         }
-        return std::vector<int>(block_size / word_size, 0);
+        double hit_rate = hits + misses > 0 ? (100.0 * hits / (hits + misses)) : 0.0;
+        std::cout << std::left << std::setw(14) << configs[i].input_file << std::right
+                  << std::setw(10) << configs[i].cache_size << std::setw(6) << configs[i].associativity
+                  << std::setw(6) << configs[i].block_size << std::setw(14) << m.overall_cyc
+                  << std::setw(14) << compute << std::setw(12) << ls << std::setw(14) << idle
+                  << std::setw(12) << hits << std::setw(12) << misses
+                  << std::setw(8) << std::fixed << std::setprecision(2) << hit_rate << "%"
+                  << std::setw(14) << m.bus_data_traffic << std::setw(10) << m.bus_invalidate_update_cnt << std::endl;
     }
-    std::pair<int, bool> get(int address);
-    void put(int address, int word);
-    void notify_finish_io();
-};
-
-
-
-class Core {
-private: 
-    LRU_Cache* cache; 
-    std::ifstream fin; 
+}
 
-    Monitor* monitor; 
-    int* global_cycle;
-    Bus* bus;
-    bool waiting_io; 
-    int waiting_cal;
-    int cnt = 0;
-    int id;
-public: 
-    Core(int id, std::string input_file, int* global_cycle, Monitor* monitor, Bus* bus): id(id), global_cycle(global_cycle), monitor(monitor), bus(bus)  {
-        cache = new LRU_Cache(this, cache_size, associativity, block_size, global_cycle, monitor, bus); 
-        std::string filename = "./" + input_file + "_four/" + input_file + "_" + std::to_string(id) + ".data";
-        //std::string filename = "./cache_accesses_1000_0.data";
-        //std::string filename = "./dram_accesses_1000_0.data";
-        //std::cout << filename <<"check" << "\n";
-        fin = std::ifstream(filename);
-        waiting_io = false; 
-        waiting_cal = -1;
-    }
-    int hex_to_dec(std::string address_string) {
-        int address = 0; 
-        for (int i = 2; i < address_string.size(); i++) {
-            if (address_string[i] >= 'a' && address_string[i] <= 'f') {
-                address = address * 16 + (address_string[i] - 'a' + 10);
-            } else {
-                address = address * 16 + (address_string[i] - '0');
+int main(int argc, char* argv[]) {
+    // --checkpoint-every N, --checkpoint-prefix P, --restore FILE, the
+    // --sample-* and --series-* options, --replacement R, --level L, --bus B,
+    // --dram D, --write-buffer N, --mshrs N, --window W, --prefetch P,
+    // --classify-misses, --sharing-report and --format F may appear anywhere;
+    // everything else is positional
+    Config config;
+    std::string restore_path;
+    std::vector<char*> positional = {argv[0]};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--checkpoint-every") {
+            config.checkpoint_every = std::stoll(argv[++i]);
+        } else if (i + 1 < argc && arg == "--checkpoint-prefix") {
+            config.checkpoint_prefix = argv[++i];
+        } else if (i + 1 < argc && arg == "--restore") {
+            restore_path = argv[++i];
+        } else if (i + 1 < argc && arg == "--sample-period") {
+            config.sample_period = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--sample-interval") {
+            config.sample_interval = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--sample-warmup") {
+            config.sample_warmup = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--replacement") {
+            if (!parse_replacement(argv[++i], config.replacement)) {
+                std::cerr << "Unknown replacement policy " << argv[i] << std::endl;
+                return 1;
             }
-        }
-        return address;
-    }
-    bool execute_next_instruction() {
-        // if (waiting_io) {
-        //     std::cout << "printout waiting io " <<"\n";
-        // }
-        if (waiting_cal > *global_cycle) {
-            return true;
-        }
-        if (waiting_io) {
-            monitor->idle_cyc[id]++;
-            return true;
-        }
-        int type; 
-        std::string address_string; 
-        if (fin.eof()) {
-            return false;
-        }
-        fin >> type >> address_string;
-        int address = hex_to_dec(address_string);
-        //cnt++; 
-        //std::cout << cnt << " " << type <<" "<<address<< "\n";
-        if (type == 0) { 
-            waiting_io = true;
-            auto result = cache->get(address); 
-            monitor->ls_ins[id]++;
-            monitor->distribution++;
-        } else if (type == 1) {
-            waiting_io = true;
-            cache->put(address, base);
-            monitor->ls_ins[id]++;
-            monitor->distribution++;
+        } else if (i + 1 < argc && arg == "--level") {
+            Level_Config level;
+            if (!parse_level(argv[++i], level)) {
+                std::cerr << "Bad level " << argv[i] << ", expected <size>:<associativity>:<latency>[:inclusive|exclusive|nine]" << std::endl;
+                return 1;
+            }
+            config.levels.push_back(level);
+        } else if (i + 1 < argc && arg == "--bus") {
+            std::string bus = argv[++i];
+            if (bus != "atomic" && bus != "split") {
+                std::cerr << "Unknown bus " << bus << ", expected atomic or split" << std::endl;
+                return 1;
+            }
+            config.split_bus = bus == "split";
+        } else if (i + 1 < argc && arg == "--dram") {
+            if (!parse_dram(argv[++i], config.dram)) {
+                std::cerr << "Bad DRAM " << argv[i] << ", expected <banks>:<row hit>:<row miss>[:<row size>[:row|block]]" << std::endl;
+                return 1;
+            }
+        } else if (i + 1 < argc && arg == "--write-buffer") {
+            config.write_buffer = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--mshrs") {
+            config.mshrs = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--window") {
+            config.ls_window = std::stoi(argv[++i]);
+        } else if (i + 1 < argc && arg == "--prefetch") {
+            if (!parse_prefetch(argv[++i], config.prefetch)) {
+                std::cerr << "Bad prefetcher " << argv[i] << ", expected none|next-line|stride|stream[:<degree 1-16>[:<distance 1-64>]]" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--classify-misses") {
+            config.classify_misses = true;
+        } else if (arg == "--sharing-report") {
+            config.sharing_report = true;
+        } else if (i + 1 < argc && arg == "--format") {
+            config.format = argv[++i];
+        } else if (i + 1 < argc && (arg == "--series-cycles" || arg == "--series-accesses")) {
+            config.series_accesses = arg == "--series-accesses";
+            config.series_every = std::stoll(argv[++i]);
+        } else if (i + 1 < argc && arg == "--series-out") {
+            config.series_out = argv[++i];
         } else {
-            int cal_cycles = address;
-            waiting_cal = *global_cycle + cal_cycles;
-            monitor->compute_cyc[id] += cal_cycles;
+            positional.push_back(argv[i]);
         }
-        return true;
     }
-    void finish_io() {
-        waiting_io = false;
+    argc = positional.size();
+    argv = positional.data();
+    // the rest of the configuration is checked with check_config below
+    if (config.sample_period > 0 && (!restore_path.empty() || config.checkpoint_every > 0 || config.series_every > 0)) {
+        std::cerr << "Checkpoints and time series are not supported with sampling" << std::endl;
+        return 1;
     }
-    int get_id() {
-        return id;
-    }
-}; 
 
-class Operating_System {
-private: 
-    int* global_cycle;
-    std::vector<Core*> cores; 
-    Bus* bus; 
-    int n_cores;
-    Monitor* monitor;
-public: 
-    Operating_System(int n_cores): n_cores(n_cores) {
-        global_cycle = new int(0);
-        monitor = new Monitor(n_cores);
-        bus = new Bus(global_cycle, monitor);
-        cores = std::vector<Core*>(n_cores); 
-        for (int i = 0; i < n_cores; i++) {
-            cores[i] = new Core(i, input_file, global_cycle, monitor, bus);
+    // one core per trace file: <input_file>_four/<input_file>_0..3.data, or
+    // per ring <name>_0..3 for ring:<name>
+    int n_cores = 4;
+    if (!restore_path.empty() && argc == 1) {
+        // the simulation is described by the checkpoint
+        int64_t cycle;
+        std::string error;
+        if (!read_checkpoint_header(restore_path, config, n_cores, cycle, error)) {
+            std::cerr << error << std::endl;
+            return 1;
         }
-    }
-    void run() {
-        while (1) {
-            bus->update_state();
-            bool check_all_finish = true; 
-            for (int i = 0; i < n_cores; i++) {
-                bool still_running = cores[i]->execute_next_instruction();
-                check_all_finish = (check_all_finish && !still_running);
+    } else {
+        if (argc < 6) {
+            std::cerr << "Usage: " << argv[0] << " <protocol> <input_file> <cache_size> <associativity> <block_size> [n_cores] [threads] [quantum]" << std::endl;
+            std::cerr << "         [--checkpoint-every N] [--checkpoint-prefix P] [--restore FILE]" << std::endl;
+            std::cerr << "Protocol is MESI or Dragon. Comma-separated lists for input_file, cache_size," << std::endl;
+            std::cerr << "associativity and block_size run an in-process sweep." << std::endl;
+            std::cerr << "threads > 1 runs the cores on that many threads, synchronised every quantum" << std::endl;
+            std::cerr << "cycles; quantum 0 (the default) is strict mode and matches the serial results." << std::endl;
+            std::cerr << "--checkpoint-every writes P-<cycle>.ckpt every N cycles; --restore resumes one," << std::endl;
+            std::cerr << "alone or with the arguments of the run that wrote it." << std::endl;
+            std::cerr << "--sample-period P [--sample-interval U] [--sample-warmup W] simulates the first P" << std::endl;
+            std::cerr << "and the last W + U of every later P records per core in detail, measures the first" << std::endl;
+            std::cerr << "P and the last U and extrapolates, with the 95% CI of the sampling error and, apart," << std::endl;
+            std::cerr << "the warm-up bias: how far the estimate exceeds one from the second halves of the U." << std::endl;
+            std::cerr << "--replacement lru|tree-plru|bit-plru|fifo|random|srrip|brrip|lfu (default lru);" << std::endl;
+            std::cerr << "tree-plru needs a power-of-two associativity up to 64." << std::endl;
+            std::cerr << "--level <size>:<associativity>:<latency>[:inclusive|exclusive|nine], repeated, adds" << std::endl;
+            std::cerr << "shared levels below the L1s (L2 first) that serve misses in <latency> cycles." << std::endl;
+            std::cerr << "--bus atomic|split: split releases the bus while memory works, so misses overlap." << std::endl;
+            std::cerr << "--dram <banks>:<row hit>:<row miss>[:<row size>[:row|block]] models banked memory" << std::endl;
+            std::cerr << "with open rows, interleaved by row (default) or block, instead of " << ram_access << " cycles." << std::endl;
+            std::cerr << "--write-buffer N lets each cache keep N dirty victims that drain while the bus is idle." << std::endl;
+            std::cerr << "--mshrs N makes the caches non-blocking with N MSHRs; --window W (default 16) bounds" << std::endl;
+            std::cerr << "the load/stores a core keeps in flight." << std::endl;
+            std::cerr << "--prefetch next-line|stride|stream[:<degree>[:<distance>]] adds a prefetcher to every" << std::endl;
+            std::cerr << "cache that fetches <degree> blocks from <distance> blocks (or strides) ahead." << std::endl;
+            std::cerr << "--classify-misses splits every core's misses into compulsory, capacity, conflict" << std::endl;
+            std::cerr << "and coherence ones, with the misses of every set." << std::endl;
+            std::cerr << "--sharing-report splits the accesses into private and shared ones and lists the" << std::endl;
+            std::cerr << "falsely shared blocks; it needs traces that TraceConverter did not reduce." << std::endl;
+            std::cerr << "--format text|json|csv selects the statistics output; --series-cycles N or" << std::endl;
+            std::cerr << "--series-accesses N adds a row of per-core counters every N cycles or loads/stores," << std::endl;
+            std::cerr << "written as CSV to --series-out FILE and embedded in json output." << std::endl;
+            std::cerr << "An input_file ring:<name> reads live traces from the shared-memory rings <name>_0," << std::endl;
+            std::cerr << "<name>_1, ... as producers write them (e.g. TraceConverter <trace> ring:<name>_0)." << std::endl;
+            return 1;
+        }
+        n_cores = argc >= 7 ? std::stoi(argv[6]) : 4; 
+        bool sweep = false;
+        for (int i = 2; i <= 5; i++) {
+            sweep = sweep || std::strchr(argv[i], ',');
+        }
+        if (sweep) {
+            if (!restore_path.empty() || config.checkpoint_every > 0 || config.sample_period > 0 || config.series_every > 0) {
+                std::cerr << "Checkpoints, sampling and time series are not supported in sweeps" << std::endl;
+                return 1;
             }
-            if (check_all_finish) {
-                monitor->overall_cyc = *global_cycle - 1;
-                break;
+            config.protocol = argv[1];
+            std::vector<int> cache_sizes = parse_int_list(argv[3]);
+            std::vector<int> associativities = parse_int_list(argv[4]);
+            std::vector<int> block_sizes = parse_int_list(argv[5]);
+            for (int cache_size : cache_sizes) {
+                for (int associativity : associativities) {
+                    for (int block_size : block_sizes) {
+                        Config point = config;
+                        point.cache_size = cache_size;
+                        point.associativity = associativity;
+                        point.block_size = block_size;
+                        std::string error;
+                        if (!check_config(point, n_cores, error)) {
+                            std::cerr << error << std::endl;
+                            return 1;
+                        }
+                    }
+                }
             }
-            (*global_cycle)++;
-            //std::cout <<*global_cycle<<"\n";
+            run_sweep(config, split_list(argv[2]), cache_sizes, associativities, block_sizes, n_cores);
+            return 0;
         }
-        monitor->print_statistics();
-    }
-}; 
 
-void Bus::update_state() {
-    if (*global_cycle == waiting_io) {
-        io_dram_request.front()->notify_finish_io(); 
-        io_dram_request.pop();
-    } 
-    if (*global_cycle >= waiting_io && io_dram_request.size()) {
-        waiting_io = *global_cycle + ram_access;
-    }
-}
-
-void Bus::request(LRU_Cache* cache, int data, int type) {
-    if (type == 0) { // load/store ram 
-        io_dram_request.push(cache);
-        monitor->bus_data_traffic += data;
-    } else {
+        if (argc >= 8) {
+            config.threads = std::stoi(argv[7]);
+        }
+        if (argc >= 9) {
+            config.quantum = std::stoi(argv[8]);
+        }
+        config.protocol = argv[1]; 
+        config.input_file = argv[2]; 
+        config.cache_size = std::stoi(std::string(argv[3])); 
+        config.associativity = std::stoi(std::string(argv[4])); 
+        config.block_size = std::stoi(std::string(argv[5]));
     }
-}
-
-std::pair<int, bool> LRU_Cache::get(int address) {
-    int block_memory = address / block_size; 
-    int tag = block_memory / number_sets; 
-    int index = block_memory % number_sets; 
-    int offset = (address % block_size) / word_size;
-    
-    if (entry_location.count(block_memory)) {
-        monitor->hit_miss_cnt[core->get_id()].first++;
-        reorder(index, block_memory);
-    } else {
-        // std::cout << "printout get" << address << " " << block_memory<<" "<<index<<"\n";
-        monitor->hit_miss_cnt[core->get_id()].second++;
-        auto words = load_words_from_ram(address);
-        cache_sets[index].insert(cache_sets[index].begin(), Entry(block_memory * block_size, words, false));
-        entry_location[block_memory] = cache_sets[index].begin();
+    std::string error;
+    if (!check_config(config, n_cores, error)) {
+        std::cerr << error << std::endl;
+        return 1;
     }
-    if (!n_waiting_io) {
-        core->finish_io();
+    Operating_System operating_system(config, n_cores); 
+    if (!restore_path.empty()) {
+        if (!operating_system.restore(restore_path, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
     }
-    // std::cout << "printout get end " << block_memory<<" "<<index<<"\n";
-    auto p = std::make_pair(cache_sets[index].begin()->words[offset], true);
-    // std::cout << "printout get end " << block_memory<<" "<<index<<" "<<n_waiting_io<<"\n";
-    return p;
-}
-void LRU_Cache::put(int address, int word) {
-    int block_memory = address / block_size; 
-    int tag = block_memory / number_sets; 
-    int index = block_memory % number_sets; 
-    int offset = (address % block_size) / word_size;
-    // check if cache hit or miss 
-    if (entry_location.count(block_memory)) {
-        // cache hit 
-        monitor->hit_miss_cnt[core->get_id()].first++;
-        reorder(index, block_memory);
-        cache_sets[index].begin()->words[offset] = word;
-        cache_sets[index].begin()->dirty = true;
+    operating_system.run();
+    const Monitor& statistics = operating_system.statistics();
+    if (config.format == "json") {
+        statistics.print_json(std::cout, &config);
+        std::cout << std::endl;
+    } else if (config.format == "csv") {
+        Monitor::print_csv_header(std::cout, false);
+        statistics.print_csv(std::cout);
     } else {
-        // cache miss
-        // check if the corresponding list is full or not 
-        monitor->hit_miss_cnt[core->get_id()].second++;
-        auto words = load_words_from_ram(address); 
-        words[offset] = word;
-        cache_sets[index].insert(cache_sets[index].begin(), Entry(block_memory * block_size, words, true));
-        entry_location[block_memory] = cache_sets[index].begin();
-        // std::cout << "printout" << address <<" "<<word << " " << block_memory<<" "<<index<<"\n";
+        statistics.print_statistics();
+        operating_system.print_sampling();
     }
-    if (!n_waiting_io) {
-        core->finish_io();
-    }
-}
-void LRU_Cache::notify_finish_io() {
-    n_waiting_io--; 
-    if (n_waiting_io) {
-        bus->request(this, block_size, 0);
-    } else {
-        core->finish_io();
+    if (!config.series_out.empty()) {
+        std::ofstream series(config.series_out);
+        statistics.print_series_csv(series);
+        if (!series) {
+            std::cerr << "cannot write " << config.series_out << std::endl;
+            return 1;
+        }
     }
 }
-
-
-int main(int argc, char* argv[]) {
-    protocol = argv[1]; 
-    input_file = argv[2]; 
-    cache_size = std::stoi(std::string(argv[3])); 
-    associativity = std::stoi(std::string(argv[4])); 
-    block_size = std::stoi(std::string(argv[5]));
-    int n_cores = 1; 
-    Operating_System operating_system(n_cores); 
-    operating_system.run();
-}
\ No newline at end of file
@@ -0,0 +1,3234 @@
+#pragma once
+
+#include<iostream> 
+#include<string> 
+#include<unordered_map> 
+#include<vector> 
+#include<utility> 
+#include<queue>
+#include<deque>
+#include<functional>
+#include<algorithm>
+#include<climits>
+#include<cmath>
+#include<fstream>
+#include<cstdlib>
+#include<cstring>
+#include<atomic>
+#include<thread>
+#include<map>
+#include <iomanip>
+#include "Barrier.h"
+#include "Checkpoint.h"
+#include "Dram.h"
+#include "Hierarchy.h"
+#include "MissClass.h"
+#include "Prefetch.h"
+#include "SetAssociative.h"
+#include "Sharing.h"
+#include "Trace.h"
+
+// The timing model of CacheSimulator: private L1s kept coherent over a
+// snooping bus, the levels and memory below them, the cores running their
+// traces and the Operating_System scheduling them. Header-only, like the
+// other models, so that other programs can include it; Timing_Model at the
+// end is the interface for those.
+
+// Everything that varies between simulations; each Operating_System owns a copy
+// so several simulations can run in one process.
+struct Config {
+    std::string protocol;
+    std::string input_file;
+    int cache_size = 4096;
+    int associativity = 2;
+    int block_size = 32; // 32 bytes by default
+    Replacement replacement = Replacement::LRU;
+    // shared levels below the L1s, L2 first; none = L1 misses go to memory
+    std::vector<Level_Config> levels;
+    // split_bus pipelines transactions: the bus is released between a
+    // request's address phase and its data phase, so misses to memory
+    // overlap. Otherwise a transaction holds the bus from grant to completion
+    bool split_bus = false;
+    // banked main memory with row buffers; banks = 0 keeps the flat latency
+    Dram_Config dram;
+    // entries per cache for dirty victims waiting to be written back, so the
+    // fill does not wait for them; 0 = the core waits for the write-back
+    int write_buffer = 0;
+    // non-blocking caches with this many MSHRs; 0 = a core waits for each
+    // load/store. ls_window bounds the load/stores a core has in flight
+    int mshrs = 0;
+    int ls_window = 16;
+    // hardware prefetcher of every L1; its fills go over the bus behind the
+    // demand transactions
+    Prefetch_Config prefetch;
+    // worker threads for the cores; 1 runs the serial event loop
+    int threads = 1;
+    // cycles between barriers of the parallel engine; 0 selects strict mode,
+    // which reproduces the serial results exactly
+    int quantum = 0;
+    // write <checkpoint_prefix>-<cycle>.ckpt every checkpoint_every cycles; 0 = never
+    int64_t checkpoint_every = 0;
+    std::string checkpoint_prefix = "checkpoint";
+    // sampled simulation, in records per core: every sample_period records end
+    // with sample_warmup + sample_interval detailed ones, of which the last
+    // sample_interval are measured; the rest are fast-forwarded. 0 = off
+    int sample_period = 0;
+    int sample_interval = 10000;
+    int sample_warmup = 2000;
+    // statistics as "text", "json" or "csv"
+    std::string format = "text";
+    // time series: a row of per-core counters every series_every cycles, or
+    // loads/stores when series_accesses is set; 0 = off. Written as CSV to
+    // series_out, and embedded in the JSON output
+    int64_t series_every = 0;
+    bool series_accesses = false;
+    std::string series_out;
+    // classes every L1 miss as compulsory, capacity, conflict or coherence,
+    // and counts misses by set
+    bool classify_misses = false;
+    // splits the accesses into private and shared ones and finds the falsely
+    // shared blocks (see Sharing.h); needs the unreduced trace
+    bool sharing_report = false;
+};
+
+enum Protocol { MESI, DRAGON };
+
+inline Protocol protocol_of(const std::string& name);
+
+inline bool parse_protocol(std::string name, Protocol& protocol) {
+    for (char& c : name) {
+        c = std::toupper(c);
+    }
+    if (name == "MESI") {
+        protocol = MESI;
+    } else if (name == "DRAGON") {
+        protocol = DRAGON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline Protocol protocol_of(const std::string& name) {
+    Protocol protocol = MESI;
+    parse_protocol(name, protocol);
+    return protocol;
+}
+
+// Whether a configuration of n_cores cores can be simulated; if not, error
+// says why. The command line and Timing_Model both check with it, the
+// former also for what only it sets (the options that exclude each other).
+inline bool check_config(const Config& config, int n_cores, std::string& error) {
+    Protocol protocol;
+    if (!parse_protocol(config.protocol, protocol)) {
+        error = "Unknown protocol " + config.protocol + ", expected MESI or Dragon";
+    } else if (n_cores < 1 || n_cores > 64) {
+        error = "n_cores must be between 1 and 64";
+    } else if (config.cache_size < 1 || config.associativity < 1 || config.block_size < 1) {
+        error = "cache_size, associativity and block_size must be positive";
+    } else if (!replacement_supports(config.replacement, config.associativity)) {
+        error = std::string(replacement_name(config.replacement)) + " does not support associativity " + std::to_string(config.associativity);
+    } else if (config.threads < 1) {
+        error = "threads must be at least 1";
+    } else if (config.write_buffer < 0) {
+        error = "--write-buffer must be at least 0";
+    } else if (config.mshrs < 0 || config.mshrs > 64 || config.ls_window < 1) {
+        error = "--mshrs must be between 0 and 64 and --window at least 1";
+    } else if (config.prefetch.kind != Prefetcher::NONE && (config.prefetch.degree < 1 || config.prefetch.degree > 16 ||
+                                                            config.prefetch.distance < 1 || config.prefetch.distance > 64)) {
+        error = "A prefetcher needs a degree of 1-16 and a distance of 1-64";
+    } else if (config.dram.banks != 0 && (config.dram.banks < 0 || config.dram.banks > 1024 || config.dram.row_hit < 1 ||
+                                          config.dram.row_miss < config.dram.row_hit || config.dram.row_size < 1)) {
+        error = "DRAM needs 1-1024 banks, a row hit of at least 1 cycle, a row miss no faster and a positive row size";
+    } else if (config.sample_period > 0 && (config.sample_interval < 1 || config.sample_warmup < 0 ||
+                                            config.sample_warmup + config.sample_interval > config.sample_period)) {
+        error = "Sampling needs interval >= 1 and warmup + interval <= period";
+    } else if (config.format != "text" && config.format != "json" && config.format != "csv") {
+        error = "Unknown format " + config.format + ", expected text, json or csv";
+    } else if (config.series_every < 0 || (config.series_every > 0 && config.format != "json" && config.series_out.empty())) {
+        error = "A time series needs --series-out FILE unless the format is json";
+    } else {
+        for (const Level_Config& level : config.levels) {
+            if (level.cache_size < 1 || level.associativity < 1 || level.latency < 1) {
+                error = "A level needs a positive size, associativity and latency";
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+const int word_size = 4; // 4 bytes; 
+const int ram_access = 100; 
+const int cache_access = 1;
+const int word_transfer = 2; // cycles to send one word between caches on the bus
+
+// Coherence state of a cache line, kept in Set_Assoc_Cache::state.
+// SHARED is MESI's S and Dragon's Sc; SHARED_MODIFIED is Dragon's Sm.
+// A line whose fill is still waiting for the bus stays INVALID until granted.
+enum Line_State : uint8_t { INVALID = 0, MODIFIED, EXCLUSIVE, SHARED, SHARED_MODIFIED };
+
+// FLUSH writes a dirty victim back to memory; the rest are the usual snooping
+// transactions (BusUpgr for MESI, BusUpd for Dragon).
+enum Bus_Transaction { FLUSH, BUS_RD, BUS_RDX, BUS_UPGR, BUS_UPD };
+
+struct Bus_Request {
+    int type;
+    uint64_t address;
+    bool write; // Dragon write miss: BusRd followed by BusUpd if shared
+};
+
+// Posted by a core running on a worker thread of the parallel engine: its
+// cache wants the bus for its current transaction (a prefetch's, which only
+// gets the bus when no demand waits), dropped a block without a bus
+// transaction, or put a dirty victim in its write buffer.
+struct Bus_Message {
+    enum Kind : uint8_t { REQUEST, PREFETCH, DROPPED, WRITE_BACK };
+    int64_t cycle;
+    int core;
+    Kind kind;
+    uint64_t block; // the MSHR requesting, the block dropped or the address written back
+};
+
+// Lock-free single-producer single-consumer ring. Each core posts its
+// Bus_Messages into its own queue and the bus drains them between quanta.
+// push() waits while the ring is full.
+template <typename T>
+class Spsc_Queue {
+private:
+    std::vector<T> ring;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0}; // advanced by the consumer
+    alignas(64) std::atomic<size_t> tail{0}; // advanced by the producer
+public:
+    explicit Spsc_Queue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        ring = std::vector<T>(size);
+        mask = size - 1;
+    }
+    void push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t - head.load(std::memory_order_acquire) == ring.size()) {
+            std::this_thread::yield();
+        }
+        ring[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+    }
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = ring[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+class Bus; 
+class LRU_Cache; 
+class Core; 
+class Operating_System; 
+class Scheduler;
+
+// Per-core counters of a non-blocking cache. Stalls are counted once each,
+// however often the core retries before the access issues.
+struct Mshr_Stats {
+    int64_t allocations = 0;       // primary misses and upgrades
+    int64_t merges = 0;            // secondary misses merged into an outstanding MSHR
+    int64_t full_stalls = 0;       // no MSHR free
+    int64_t dependency_stalls = 0; // a store waiting for a fill without ownership
+    int64_t window_stalls = 0;     // the load/store window full
+    int64_t busy_cycles = 0;       // summed MSHR lifetimes, for the mean occupancy
+    int peak = 0;                  // most MSHRs in use at once
+};
+
+struct Monitor {
+    // Cache calculate 
+    int64_t overall_cyc = 0; 
+    std::vector<int64_t> compute_cyc; 
+    std::vector<int64_t> ls_ins; 
+    std::vector<int64_t> idle_cyc; 
+    std::vector<std::pair<int64_t, int64_t>> hit_miss_cnt; 
+    int64_t bus_data_traffic = 0; 
+    int64_t bus_invalidate_update_cnt = 0; 
+    std::vector<Level_Stats> levels; // shared levels below the L1s, L2 first
+    // Bus timing: transactions granted to the cores, cycles the bus carried
+    // any transaction (occupancy) and cycles the cores' transactions waited
+    // for it. Write-buffer drains use the bus but are not counted as waiting.
+    int64_t bus_transactions = 0;
+    int64_t bus_busy_cycles = 0;
+    int64_t bus_queue_cycles = 0;
+    int64_t write_buffer_drains = 0;
+    int64_t write_buffer_stalls = 0; // dirty victims the core waited for, its buffer being full
+    Dram_Stats dram;
+    std::vector<Mshr_Stats> mshr; // by core, non-blocking caches only
+    std::vector<Prefetch_Stats> prefetch; // by core
+    // With sharing_report, every core's loads and stores by block and the
+    // coherence traffic by block, classified into private and shared data by
+    // finish(); otherwise the split is not measured and not reported
+    Sharing_Tracker sharing;
+    Sharing_Summary sharing_summary;
+    static constexpr size_t false_sharing_top = 10; // hot lines reported
+    // With classify_misses, every core's misses by class and by set (see
+    // MissClass.h)
+    std::vector<Miss_Classifier> miss_classes; // by core
+    static constexpr size_t hot_sets_top = 8;  // sets reported
+    // With sample_period, the sampled simulation's parameters and the
+    // uncertainty of its estimates (see Operating_System::run_sampled):
+    // half-widths of the 95% CIs of the sampling error, -1 if unknown, and
+    // the warm-up biases apart from them
+    struct Sample_Stats {
+        int period = 0, warmup = 0, interval = 0; // period 0: not sampled
+        int64_t detailed_ls = 0;
+        double overall_error = 0, overall_bias = 0;
+        std::vector<int> windows; // by core, measured
+        std::vector<double> idle_error, idle_bias; // by core
+    };
+    Sample_Stats sampling;
+
+    // Time series: cumulative counters at the end of every interval. Idle
+    // cycles are credited when the stalled core resumes, so a stall spanning
+    // a boundary counts in the interval where it ends.
+    struct Interval {
+        int64_t cycle;
+        long long accesses;
+        std::vector<int64_t> hits, misses, idle;
+        int64_t bus_data_traffic;
+    };
+    std::vector<Interval> series;
+
+    int num_cores;
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        archive.io(overall_cyc);
+        archive.io(compute_cyc);
+        archive.io(ls_ins);
+        archive.io(idle_cyc);
+        for (std::pair<int64_t, int64_t>& counts : hit_miss_cnt) {
+            archive.io(counts.first);
+            archive.io(counts.second);
+        }
+        archive.io(bus_data_traffic);
+        archive.io(bus_invalidate_update_cnt);
+        archive.io(levels);
+        archive.io(bus_transactions);
+        archive.io(bus_busy_cycles);
+        archive.io(bus_queue_cycles);
+        archive.io(write_buffer_drains);
+        archive.io(write_buffer_stalls);
+        archive.io(dram);
+        archive.io(mshr);
+        archive.io(prefetch);
+        sharing.checkpoint(archive);
+        for (Miss_Classifier& classifier : miss_classes) {
+            classifier.checkpoint(archive);
+        }
+        if (compute_cyc.size() != size_t(num_cores) || ls_ins.size() != size_t(num_cores) || idle_cyc.size() != size_t(num_cores) ||
+            mshr.size() != size_t(num_cores) || prefetch.size() != size_t(num_cores)) {
+            archive.fail();
+        }
+    }
+    Monitor(int num_cores): num_cores(num_cores) {
+        compute_cyc = std::vector<int64_t>(num_cores, 0);
+        ls_ins = std::vector<int64_t>(num_cores, 0);
+        idle_cyc = std::vector<int64_t>(num_cores, 0); 
+        hit_miss_cnt = std::vector<std::pair<int64_t, int64_t>>(num_cores, {0, 0}); 
+        mshr = std::vector<Mshr_Stats>(num_cores);
+        prefetch = std::vector<Prefetch_Stats>(num_cores);
+    }
+    bool non_blocking() const {
+        for (const Mshr_Stats& stats : mshr) {
+            if (stats.allocations) {
+                return true;
+            }
+        }
+        return false;
+    }
+    bool prefetching() const {
+        for (const Prefetch_Stats& stats : prefetch) {
+            if (stats.issued || stats.dropped) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Demand misses the prefetcher removed or shortened, as a share of those
+    // there would have been without it: a late prefetch is still a miss.
+    double coverage(int core) const {
+        const Prefetch_Stats& stats = prefetch[core];
+        int64_t base = hit_miss_cnt[core].second + stats.useful - stats.late;
+        return base > 0 ? double(stats.useful) / base : 0.0;
+    }
+    long long accesses() const {
+        long long total = 0;
+        for (int i = 0; i < num_cores; i++) {
+            total += ls_ins[i];
+        }
+        return total;
+    }
+    // lines, sets: of each L1
+    void classify_misses(uint32_t lines, uint32_t sets) {
+        miss_classes = std::vector<Miss_Classifier>(num_cores, Miss_Classifier(lines, sets));
+    }
+    void classify_data() {
+        if (sharing.enabled()) {
+            sharing_summary = sharing.summary(false_sharing_top);
+        }
+    }
+    void record_interval(int64_t cycle) {
+        Interval interval{cycle, accesses(), {}, {}, idle_cyc, bus_data_traffic};
+        for (const std::pair<int64_t, int64_t>& counts : hit_miss_cnt) {
+            interval.hits.push_back(counts.first);
+            interval.misses.push_back(counts.second);
+        }
+        series.push_back(interval);
+    }
+
+    // Every field as one JSON object; config, if given, labels the run.
+    void print_json(std::ostream& out, const Config* config = nullptr) const {
+        out << "{";
+        if (config) {
+            out << "\"protocol\": \"" << config->protocol << "\", \"workload\": \"" << config->input_file
+                << "\", \"cache_size\": " << config->cache_size << ", \"associativity\": " << config->associativity
+                << ", \"block_size\": " << config->block_size << ", \"replacement\": \"" << replacement_name(config->replacement) << "\", ";
+        }
+        out << "\"overall_cycles\": " << overall_cyc << ", \"bus_data_bytes\": " << bus_data_traffic
+            << ", \"bus_invalidations_updates\": " << bus_invalidate_update_cnt;
+        if (sharing.enabled()) {
+            out << ", \"private_accesses\": " << sharing_summary.private_accesses
+                << ", \"shared_accesses\": " << sharing_summary.shared_accesses
+                << ", \"read_only_shared_accesses\": " << sharing_summary.read_only_shared
+                << ", \"false_shared_lines\": " << sharing_summary.false_shared_lines << ", \"false_sharing\": [";
+            for (size_t k = 0; k < sharing_summary.hot_lines.size(); k++) {
+                const False_Sharing_Line& line = sharing_summary.hot_lines[k];
+                out << (k ? ", " : "") << "{\"address\": " << line.address << ", \"writers\": [";
+                for (int i = 0, n = 0; i < num_cores; i++) {
+                    if (line.writers >> i & 1) {
+                        out << (n++ ? ", " : "") << i;
+                    }
+                }
+                out << "], \"accesses\": " << line.accesses << ", \"invalidations_updates\": " << line.traffic.invalidations_updates
+                    << ", \"coherence_bytes\": " << line.traffic.bytes << "}";
+            }
+            out << "]";
+        }
+        out << ", \"cores\": [";
+        for (int i = 0; i < num_cores; i++) {
+            out << (i ? ", " : "") << "{\"core\": " << i << ", \"compute_cycles\": " << compute_cyc[i]
+                << ", \"load_store\": " << ls_ins[i] << ", \"idle_cycles\": " << idle_cyc[i]
+                << ", \"hits\": " << hit_miss_cnt[i].first << ", \"misses\": " << hit_miss_cnt[i].second << "}";
+        }
+        out << "], \"bus\": {\"transactions\": " << bus_transactions << ", \"busy_cycles\": " << bus_busy_cycles
+            << ", \"queue_cycles\": " << bus_queue_cycles << ", \"write_buffer_drains\": " << write_buffer_drains
+            << ", \"write_buffer_stalls\": " << write_buffer_stalls << ", \"dram_row_hits\": " << dram.row_hits
+            << ", \"dram_row_misses\": " << dram.row_misses << ", \"dram_bank_wait_cycles\": " << dram.bank_wait_cycles << "}";
+        if (non_blocking()) {
+            out << ", \"mshr\": [";
+            for (int i = 0; i < num_cores; i++) {
+                const Mshr_Stats& stats = mshr[i];
+                out << (i ? ", " : "") << "{\"core\": " << i << ", \"allocations\": " << stats.allocations
+                    << ", \"merges\": " << stats.merges << ", \"full_stalls\": " << stats.full_stalls
+                    << ", \"dependency_stalls\": " << stats.dependency_stalls << ", \"window_stalls\": " << stats.window_stalls
+                    << ", \"busy_cycles\": " << stats.busy_cycles << ", \"peak\": " << stats.peak << "}";
+            }
+            out << "]";
+        }
+        if (prefetching()) {
+            out << ", \"prefetch\": [";
+            for (int i = 0; i < num_cores; i++) {
+                const Prefetch_Stats& stats = prefetch[i];
+                out << (i ? ", " : "") << "{\"core\": " << i << ", \"issued\": " << stats.issued << ", \"useful\": " << stats.useful
+                    << ", \"late\": " << stats.late << ", \"unused\": " << stats.unused << ", \"dropped\": " << stats.dropped
+                    << ", \"accuracy\": " << (stats.issued ? double(stats.useful) / stats.issued : 0.0)
+                    << ", \"coverage\": " << coverage(i) << ", \"bus_data_bytes\": " << stats.bus_bytes << "}";
+            }
+            out << "]";
+        }
+        if (!miss_classes.empty()) {
+            out << ", \"miss_classes\": [";
+            for (int i = 0; i < num_cores; i++) {
+                const Miss_Counts& counts = miss_classes[i].counts();
+                out << (i ? ", " : "") << "{\"core\": " << i << ", \"compulsory\": " << counts.compulsory
+                    << ", \"capacity\": " << counts.capacity << ", \"conflict\": " << counts.conflict
+                    << ", \"coherence\": " << counts.coherence << ", \"sets\": [";
+                const std::vector<Set_Misses>& sets = miss_classes[i].set_misses();
+                for (size_t k = 0; k < sets.size(); k++) {
+                    out << (k ? ", " : "") << "[" << sets[k].misses << ", " << sets[k].conflicts << "]";
+                }
+                out << "]}";
+            }
+            out << "]";
+        }
+        if (!levels.empty()) {
+            out << ", \"levels\": [";
+            for (size_t k = 0; k < levels.size(); k++) {
+                out << (k ? ", " : "") << "{\"level\": " << k + 2 << ", \"hits\": " << levels[k].hits
+                    << ", \"misses\": " << levels[k].misses << ", \"writebacks\": " << levels[k].writebacks
+                    << ", \"back_invalidations\": " << levels[k].back_invalidations << "}";
+            }
+            out << "]";
+        }
+        if (sampling.period) {
+            auto error = [](double half_width) {
+                return half_width < 0 ? std::string("null") : std::to_string(std::llround(half_width));
+            };
+            out << ", \"sampling\": {\"period\": " << sampling.period << ", \"warmup\": " << sampling.warmup
+                << ", \"interval\": " << sampling.interval << ", \"detailed_load_store\": " << sampling.detailed_ls
+                << ", \"overall_cycles_error\": " << error(sampling.overall_error)
+                << ", \"overall_cycles_bias\": " << std::llround(sampling.overall_bias) << ", \"cores\": [";
+            for (int i = 0; i < num_cores; i++) {
+                out << (i ? ", " : "") << "{\"core\": " << i << ", \"windows\": " << sampling.windows[i]
+                    << ", \"idle_cycles_error\": " << error(sampling.idle_error[i])
+                    << ", \"idle_cycles_bias\": " << std::llround(sampling.idle_bias[i]) << "}";
+            }
+            out << "]}";
+        }
+        if (!series.empty()) {
+            out << ", \"series\": [";
+            for (size_t k = 0; k < series.size(); k++) {
+                const Interval* previous = k ? &series[k - 1] : nullptr;
+                const Interval& interval = series[k];
+                out << (k ? ", " : "") << "{\"end_cycle\": " << interval.cycle
+                    << ", \"accesses\": " << interval.accesses - (previous ? previous->accesses : 0)
+                    << ", \"bus_data_bytes\": " << interval.bus_data_traffic - (previous ? previous->bus_data_traffic : 0)
+                    << ", \"cores\": [";
+                for (int i = 0; i < num_cores; i++) {
+                    out << (i ? ", " : "") << "{\"hits\": " << interval.hits[i] - (previous ? previous->hits[i] : 0)
+                        << ", \"misses\": " << interval.misses[i] - (previous ? previous->misses[i] : 0)
+                        << ", \"idle_cycles\": " << interval.idle[i] - (previous ? previous->idle[i] : 0) << "}";
+                }
+                out << "]}";
+            }
+            out << "]";
+        }
+        out << "}";
+    }
+
+    // Every field as "metric,core,value" rows (core is empty for the whole
+    // system); config, if given, prefixes each row with the run's parameters.
+    static void print_csv_header(std::ostream& out, bool labelled) {
+        out << (labelled ? "protocol,workload,cache_size,associativity,block_size,replacement," : "") << "metric,core,value" << std::endl;
+    }
+    void print_csv(std::ostream& out, const Config* config = nullptr) const {
+        std::string label;
+        if (config) {
+            label = config->protocol + "," + config->input_file + "," + std::to_string(config->cache_size) + "," +
+                    std::to_string(config->associativity) + "," + std::to_string(config->block_size) + "," +
+                    replacement_name(config->replacement) + ",";
+        }
+        auto row = [&](const char* metric, int core, long long value) {
+            out << label << metric << "," << (core < 0 ? "" : std::to_string(core)) << "," << value << "\n";
+        };
+        row("overall_cycles", -1, overall_cyc);
+        for (int i = 0; i < num_cores; i++) {
+            row("compute_cycles", i, compute_cyc[i]);
+            row("load_store", i, ls_ins[i]);
+            row("idle_cycles", i, idle_cyc[i]);
+            row("hits", i, hit_miss_cnt[i].first);
+            row("misses", i, hit_miss_cnt[i].second);
+        }
+        row("bus_data_bytes", -1, bus_data_traffic);
+        row("bus_invalidations_updates", -1, bus_invalidate_update_cnt);
+        if (sharing.enabled()) {
+            row("private_accesses", -1, sharing_summary.private_accesses);
+            row("shared_accesses", -1, sharing_summary.shared_accesses);
+            row("read_only_shared_accesses", -1, sharing_summary.read_only_shared);
+            row("false_shared_lines", -1, sharing_summary.false_shared_lines);
+        }
+        row("bus_transactions", -1, bus_transactions);
+        row("bus_busy_cycles", -1, bus_busy_cycles);
+        row("bus_queue_cycles", -1, bus_queue_cycles);
+        row("write_buffer_drains", -1, write_buffer_drains);
+        row("write_buffer_stalls", -1, write_buffer_stalls);
+        row("dram_row_hits", -1, dram.row_hits);
+        row("dram_row_misses", -1, dram.row_misses);
+        row("dram_bank_wait_cycles", -1, dram.bank_wait_cycles);
+        for (int i = 0; i < num_cores && non_blocking(); i++) {
+            row("mshr_allocations", i, mshr[i].allocations);
+            row("mshr_merges", i, mshr[i].merges);
+            row("mshr_full_stalls", i, mshr[i].full_stalls);
+            row("mshr_dependency_stalls", i, mshr[i].dependency_stalls);
+            row("mshr_window_stalls", i, mshr[i].window_stalls);
+            row("mshr_busy_cycles", i, mshr[i].busy_cycles);
+            row("mshr_peak", i, mshr[i].peak);
+        }
+        for (int i = 0; i < num_cores && prefetching(); i++) {
+            row("prefetch_issued", i, prefetch[i].issued);
+            row("prefetch_useful", i, prefetch[i].useful);
+            row("prefetch_late", i, prefetch[i].late);
+            row("prefetch_unused", i, prefetch[i].unused);
+            row("prefetch_dropped", i, prefetch[i].dropped);
+            row("prefetch_bus_data_bytes", i, prefetch[i].bus_bytes);
+        }
+        for (int i = 0; i < int(miss_classes.size()); i++) {
+            const Miss_Counts& counts = miss_classes[i].counts();
+            row("compulsory_misses", i, counts.compulsory);
+            row("capacity_misses", i, counts.capacity);
+            row("conflict_misses", i, counts.conflict);
+            row("coherence_misses", i, counts.coherence);
+        }
+        for (size_t k = 0; k < levels.size(); k++) {
+            std::string level = "L" + std::to_string(k + 2) + "_";
+            row((level + "hits").c_str(), -1, levels[k].hits);
+            row((level + "misses").c_str(), -1, levels[k].misses);
+            row((level + "writebacks").c_str(), -1, levels[k].writebacks);
+            row((level + "back_invalidations").c_str(), -1, levels[k].back_invalidations);
+        }
+        if (sampling.period) {
+            row("sample_period", -1, sampling.period);
+            row("sample_warmup", -1, sampling.warmup);
+            row("sample_interval", -1, sampling.interval);
+            row("detailed_load_store", -1, sampling.detailed_ls);
+            row("overall_cycles_error", -1, std::llround(sampling.overall_error)); // -1: unknown
+            row("overall_cycles_bias", -1, std::llround(sampling.overall_bias));
+            for (int i = 0; i < num_cores; i++) {
+                row("sample_windows", i, sampling.windows[i]);
+                row("idle_cycles_error", i, std::llround(sampling.idle_error[i]));
+                row("idle_cycles_bias", i, std::llround(sampling.idle_bias[i]));
+            }
+        }
+        out.flush();
+    }
+
+    // The time series, one row per interval with the counts within it.
+    void print_series_csv(std::ostream& out) const {
+        out << "interval,end_cycle,accesses,bus_data_bytes";
+        for (int i = 0; i < num_cores; i++) {
+            out << ",hits_" << i << ",misses_" << i << ",idle_cycles_" << i;
+        }
+        out << "\n";
+        for (size_t k = 0; k < series.size(); k++) {
+            const Interval* previous = k ? &series[k - 1] : nullptr;
+            const Interval& interval = series[k];
+            out << k << "," << interval.cycle << "," << interval.accesses - (previous ? previous->accesses : 0) << ","
+                << interval.bus_data_traffic - (previous ? previous->bus_data_traffic : 0);
+            for (int i = 0; i < num_cores; i++) {
+                out << "," << interval.hits[i] - (previous ? previous->hits[i] : 0)
+                    << "," << interval.misses[i] - (previous ? previous->misses[i] : 0)
+                    << "," << interval.idle[i] - (previous ? previous->idle[i] : 0);
+            }
+            out << "\n";
+        }
+        out.flush();
+    }
+
+    void print_statistics() const {
+        std::cout << "\n========================================" << std::endl;
+        std::cout << "        SIMULATION RESULTS" << std::endl;
+        std::cout << "========================================\n" << std::endl;
+        
+        // 1. Overall execution cycles
+        std::cout << "1. Overall Execution Cycles: " << overall_cyc << std::endl;
+        std::cout << std::endl;
+        
+        // 2. Compute cycles per core
+        std::cout << "2. Compute Cycles:" << std::endl;
+        for (int i = 0; i < num_cores; i++) {
+            std::cout << "   Core " << i << ": " << compute_cyc[i] << std::endl;
+        }
+        std::cout << std::endl;
+        
+        // 3. Load/store instructions per core
+        std::cout << "3. Load/Store Instructions:" << std::endl;
+        for (int i = 0; i < num_cores; i++) {
+            std::cout << "   Core " << i << ": " << ls_ins[i] << std::endl;
+        }
+        std::cout << std::endl;
+        
+        // 4. Idle cycles per core
+        std::cout << "4. Idle Cycles:" << std::endl;
+        for (int i = 0; i < num_cores; i++) {
+            std::cout << "   Core " << i << ": " << idle_cyc[i] << std::endl;
+        }
+        std::cout << std::endl;
+        
+        // 5. Cache hit/miss counts per core
+        std::cout << "5. Cache Statistics:" << std::endl;
+        for (int i = 0; i < num_cores; i++) {
+            int64_t hits = hit_miss_cnt[i].first;
+            int64_t misses = hit_miss_cnt[i].second;
+            int64_t total = hits + misses;
+            double hit_rate = total > 0 ? (100.0 * hits / total) : 0.0;
+            
+            std::cout << "   Core " << i << ":" << std::endl;
+            std::cout << "      Hits:   " << hits << std::endl;
+            std::cout << "      Misses: " << misses << std::endl;
+            std::cout << "      Hit Rate: " << std::fixed << std::setprecision(2) 
+                      << hit_rate << "%" << std::endl;
+        }
+        std::cout << std::endl;
+        
+        // 6. Bus data traffic
+        std::cout << "6. Bus Data Traffic: " << bus_data_traffic << " bytes" << std::endl;
+        std::cout << std::endl;
+        
+        // 7. Invalidations or updates
+        std::cout << "7. Invalidations/Updates on Bus: " 
+                  << bus_invalidate_update_cnt << std::endl;
+        std::cout << std::endl;
+        
+        // 8. Private vs shared data distribution
+        std::cout << "8. Data Access Distribution:" << std::endl;
+        if (!sharing.enabled()) {
+            std::cout << "   Not measured (--sharing-report measures it)" << std::endl;
+        } else {
+            std::cout << "   Private: " << sharing_summary.private_accesses << std::endl;
+            std::cout << "   Shared:  " << sharing_summary.shared_accesses << " (" << sharing_summary.read_only_shared
+                      << " to read-only blocks)" << std::endl;
+            std::cout << "   Falsely Shared Blocks: " << sharing_summary.false_shared_lines << std::endl;
+            for (const False_Sharing_Line& line : sharing_summary.hot_lines) {
+                std::cout << "      Block 0x" << std::hex << line.address << std::dec << ": written by cores";
+                for (int i = 0; i < num_cores; i++) {
+                    if (line.writers >> i & 1) {
+                        std::cout << " " << i;
+                    }
+                }
+                std::cout << ", " << line.accesses << " accesses, " << line.traffic.invalidations_updates
+                          << " invalidations/updates, " << line.traffic.bytes << " bytes moved between caches" << std::endl;
+            }
+        }
+        std::cout << std::endl;
+
+        // 9. Bus occupancy and queueing, write buffers and DRAM
+        std::cout << "9. Bus and Memory:" << std::endl;
+        std::cout << "   Transactions: " << bus_transactions << std::endl;
+        std::cout << "   Busy Cycles: " << bus_busy_cycles << " (" << std::fixed << std::setprecision(2)
+                  << (overall_cyc > 0 ? 100.0 * bus_busy_cycles / overall_cyc : 0.0) << "% occupancy)" << std::endl;
+        std::cout << "   Queueing Delay: " << bus_queue_cycles << " cycles (" << std::fixed << std::setprecision(2)
+                  << (bus_transactions > 0 ? double(bus_queue_cycles) / bus_transactions : 0.0) << " per transaction)" << std::endl;
+        if (write_buffer_drains || write_buffer_stalls) {
+            std::cout << "   Write Buffer Drains: " << write_buffer_drains << std::endl;
+            std::cout << "   Write Buffer Full Stalls: " << write_buffer_stalls << std::endl;
+        }
+        if (dram.row_hits || dram.row_misses) {
+            int64_t total = dram.row_hits + dram.row_misses;
+            std::cout << "   DRAM Row Hits: " << dram.row_hits << " (" << std::fixed << std::setprecision(2)
+                      << 100.0 * dram.row_hits / total << "%)" << std::endl;
+            std::cout << "   DRAM Row Misses: " << dram.row_misses << std::endl;
+            std::cout << "   DRAM Bank Wait Cycles: " << dram.bank_wait_cycles << std::endl;
+        }
+
+        // 10. Shared levels, when configured
+        if (!levels.empty()) {
+            std::cout << std::endl << "10. Lower Cache Levels:" << std::endl;
+            for (size_t k = 0; k < levels.size(); k++) {
+                int64_t total = levels[k].hits + levels[k].misses;
+                double hit_rate = total > 0 ? (100.0 * levels[k].hits / total) : 0.0;
+                std::cout << "   L" << k + 2 << ":" << std::endl;
+                std::cout << "      Hits:   " << levels[k].hits << std::endl;
+                std::cout << "      Misses: " << levels[k].misses << std::endl;
+                std::cout << "      Hit Rate: " << std::fixed << std::setprecision(2) << hit_rate << "%" << std::endl;
+                std::cout << "      Write-backs: " << levels[k].writebacks << std::endl;
+                std::cout << "      Back-invalidations: " << levels[k].back_invalidations << std::endl;
+            }
+        }
+
+        // 11. MSHRs, for non-blocking caches
+        if (non_blocking()) {
+            std::cout << std::endl << "11. Non-blocking Caches:" << std::endl;
+            for (int i = 0; i < num_cores; i++) {
+                const Mshr_Stats& stats = mshr[i];
+                std::cout << "   Core " << i << ":" << std::endl;
+                std::cout << "      MSHR Allocations: " << stats.allocations << std::endl;
+                std::cout << "      Merged Misses: " << stats.merges << std::endl;
+                std::cout << "      Mean Occupancy: " << std::fixed << std::setprecision(2)
+                          << (overall_cyc > 0 ? double(stats.busy_cycles) / overall_cyc : 0.0) << " (peak " << stats.peak << ")" << std::endl;
+                std::cout << "      Stalls: " << stats.full_stalls << " MSHRs full, " << stats.dependency_stalls << " dependency, "
+                          << stats.window_stalls << " window full" << std::endl;
+            }
+        }
+
+        // 12. Prefetchers: accuracy, coverage, timeliness and their traffic
+        if (prefetching()) {
+            std::cout << std::endl << "12. Prefetching:" << std::endl;
+            for (int i = 0; i < num_cores; i++) {
+                const Prefetch_Stats& stats = prefetch[i];
+                std::cout << "   Core " << i << ":" << std::endl;
+                std::cout << "      Issued: " << stats.issued << " (" << stats.bus_bytes << " bytes on the bus)" << std::endl;
+                std::cout << "      Useful: " << stats.useful << " (" << std::fixed << std::setprecision(2)
+                          << (stats.issued ? 100.0 * stats.useful / stats.issued : 0.0) << "% accuracy)" << std::endl;
+                std::cout << "      Late: " << stats.late << " (" << std::fixed << std::setprecision(2)
+                          << (stats.useful ? 100.0 * (stats.useful - stats.late) / stats.useful : 0.0) << "% of useful ones on time)" << std::endl;
+                std::cout << "      Coverage: " << std::fixed << std::setprecision(2) << 100.0 * coverage(i) << "% of misses" << std::endl;
+                std::cout << "      Evicted Unused: " << stats.unused << std::endl;
+                std::cout << "      Dropped: " << stats.dropped << " (no prefetch MSHR free)" << std::endl;
+            }
+        }
+
+        // 13. Misses by cause, and the sets with the most of them
+        if (!miss_classes.empty()) {
+            std::cout << std::endl << "13. Miss Classes:" << std::endl;
+            for (int i = 0; i < num_cores; i++) {
+                const Miss_Counts& counts = miss_classes[i].counts();
+                const std::vector<Set_Misses>& sets = miss_classes[i].set_misses();
+                int64_t misses = hit_miss_cnt[i].second;
+                auto share = [&](int64_t n) {
+                    return misses > 0 ? 100.0 * n / misses : 0.0;
+                };
+                std::cout << "   Core " << i << ":" << std::endl;
+                std::cout << std::fixed << std::setprecision(2);
+                std::cout << "      Compulsory: " << counts.compulsory << " (" << share(counts.compulsory) << "%)" << std::endl;
+                std::cout << "      Capacity: " << counts.capacity << " (" << share(counts.capacity) << "%)" << std::endl;
+                std::cout << "      Conflict: " << counts.conflict << " (" << share(counts.conflict) << "%)" << std::endl;
+                std::cout << "      Coherence: " << counts.coherence << " (" << share(counts.coherence) << "%)" << std::endl;
+                if (misses > counts.total()) {
+                    std::cout << "      Secondary (merged, not classed): " << misses - counts.total() << std::endl;
+                }
+                std::cout << "      Hot Sets (misses/conflict):";
+                for (uint32_t set : hot_sets(sets.data(), uint32_t(sets.size()), hot_sets_top)) {
+                    std::cout << " " << set << " (" << sets[set].misses << "/" << sets[set].conflicts << ")";
+                }
+                std::cout << std::endl;
+            }
+        }
+        
+        std::cout << "\n========================================\n" << std::endl;
+    }
+}; 
+
+// Event queue of next-wake cycles. Slot 0 is the bus, slot i + 1 is core i.
+// Within one cycle slots are processed in increasing order, which is the same
+// order the per-cycle loop used (bus first, then cores by id), so skipping the
+// cycles in which nothing is scheduled does not change any statistic.
+class Scheduler {
+private: 
+    std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int>>, std::greater<std::pair<int64_t, int>>> events;
+    std::vector<int64_t> next_wake; 
+    int64_t* global_cycle;
+    int current_slot;
+public: 
+    Scheduler(int n_slots, int64_t* global_cycle): global_cycle(global_cycle) {
+        next_wake = std::vector<int64_t>(n_slots, INT64_MAX);
+        current_slot = -1;
+    }
+    void wake_at(int slot, int64_t cycle) {
+        if (cycle < next_wake[slot]) {
+            next_wake[slot] = cycle;
+            events.push({cycle, slot});
+        }
+    }
+    // wake a slot as early as the per-cycle loop would have seen the change:
+    // this cycle if the slot has not been processed yet, otherwise the next one
+    void wake(int slot) {
+        wake_at(slot, slot <= current_slot ? *global_cycle + 1 : *global_cycle);
+    }
+    // cycle the slot is scheduled for, INT64_MAX if none
+    int64_t wake_cycle(int slot) const {
+        return next_wake[slot];
+    }
+    // first cycle any slot but `slot` is scheduled for, INT64_MAX if none:
+    // until then nothing else can touch the state `slot` sees
+    int64_t quiet_until(int slot) const {
+        int64_t quiet = INT64_MAX;
+        for (int s = 0; s < int(next_wake.size()); s++) {
+            if (s != slot) {
+                quiet = std::min(quiet, next_wake[s]);
+            }
+        }
+        return quiet;
+    }
+    // places the scheduler as if `slot` were being processed at `cycle`, for
+    // wakes coming from outside its own loop (the parallel engine's bus)
+    void set_position(int64_t cycle, int slot) {
+        *global_cycle = cycle;
+        current_slot = slot;
+    }
+    // cycle of the next event, INT64_MAX if none
+    int64_t peek() {
+        while (!events.empty() && next_wake[events.top().second] != events.top().first) {
+            events.pop(); // superseded by an earlier wake
+        }
+        return events.empty() ? INT64_MAX : events.top().first;
+    }
+    // pops the next event if it is before `limit`
+    bool next(int& slot, int64_t limit = INT64_MAX) {
+        while (!events.empty()) {
+            auto [cycle, s] = events.top();
+            if (next_wake[s] != cycle) {
+                events.pop();
+                continue; // superseded by an earlier wake
+            }
+            if (cycle >= limit) {
+                return false;
+            }
+            events.pop();
+            next_wake[s] = INT64_MAX;
+            *global_cycle = cycle;
+            current_slot = s;
+            slot = s;
+            return true;
+        }
+        return false;
+    }
+};
+
+// Open-addressing hash table from block number to a bitmap of the cores whose
+// cache holds it, so a coherence transaction only snoops those caches. Sized
+// once for every line of every cache, so it never grows.
+class Sharer_Directory {
+private: 
+    static constexpr uint64_t empty = UINT64_MAX;
+    std::vector<uint64_t> blocks;
+    std::vector<uint64_t> sharers;
+    size_t mask;
+
+    size_t home(uint64_t block) const {
+        uint64_t hash = block * 0x9E3779B97F4A7C15ull;
+        return size_t(hash ^ hash >> 32) & mask;
+    }
+    size_t find(uint64_t block) const {
+        size_t i = home(block);
+        while (blocks[i] != empty && blocks[i] != block) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+public: 
+    Sharer_Directory(size_t capacity) {
+        size_t size = 16;
+        while (size < 2 * capacity) {
+            size *= 2;
+        }
+        blocks = std::vector<uint64_t>(size, empty);
+        sharers = std::vector<uint64_t>(size, 0);
+        mask = size - 1;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        size_t size = blocks.size();
+        archive.io(blocks);
+        archive.io(sharers);
+        if (blocks.size() != size || sharers.size() != size) {
+            archive.fail();
+        }
+    }
+    uint64_t get(uint64_t block) const {
+        size_t i = find(block);
+        return blocks[i] == empty ? 0 : sharers[i];
+    }
+    void add(uint64_t block, int core) {
+        size_t i = find(block);
+        blocks[i] = block;
+        sharers[i] |= uint64_t(1) << core;
+    }
+    void remove(uint64_t block, int core) {
+        size_t i = find(block);
+        if (blocks[i] == empty) {
+            return;
+        }
+        sharers[i] &= ~(uint64_t(1) << core);
+        if (sharers[i]) {
+            return;
+        }
+        // backward-shift deletion keeps every probe chain unbroken
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (blocks[j] == empty) {
+                break;
+            }
+            size_t h = home(blocks[j]);
+            if ((j > i && (h <= i || h > j)) || (j < i && (h <= i && h > j))) {
+                blocks[i] = blocks[j];
+                sharers[i] = sharers[j];
+                i = j;
+            }
+        }
+        blocks[i] = empty;
+        sharers[i] = 0;
+    }
+};
+
+// What a transaction needs once granted: `latency` cycles until memory or a
+// lower level has the data (0 when a cache supplies it or none moves), then
+// `transfer` cycles of data on the bus. For a write-back the latency is that
+// of the write, which follows the transfer.
+struct Bus_Timing {
+    int latency;
+    int transfer;
+};
+
+class Bus {
+private: 
+    // Transactions in progress, in grant order. The atomic bus has at most
+    // one; the split bus has one per cache and write-buffer entry at most.
+    struct Flight {
+        int64_t done;     // cycle it completes
+        int core;
+        int mshr;         // whose transaction it is
+        bool drain;       // a write-buffer entry rather than an MSHR's transaction
+        uint64_t address; // of the drained block
+    };
+    struct Waiting {
+        int core;
+        int mshr;
+        int64_t since; // cycle it was queued
+    };
+    struct Drain {
+        int core;
+        uint64_t address;
+    };
+    struct Reservation {
+        int64_t start, end;
+    };
+    std::deque<Waiting> waiting;     // caches' transactions, in arrival order
+    std::deque<Waiting> prefetches;  // prefetchers' transactions, granted when no core waits
+    std::deque<Drain> drains;        // write-buffer entries, granted when neither waits
+    std::vector<Flight> in_flight;
+    std::vector<Reservation> reserved; // split bus: phases booked, sorted, non-overlapping
+    bool updating = false;             // inside update_state, which grants what it can itself
+    bool split;
+    bool timed_access = true; // whether the transaction being performed is timed
+    int64_t* global_cycle;
+    Monitor* monitor;
+    Scheduler* scheduler;
+    Protocol protocol;
+    int block_size;
+    std::vector<LRU_Cache*> caches; // by core id
+    Sharer_Directory directory;
+    Dram dram;
+    Lower_Levels lower; // serves L1 misses no other L1 can
+    void grant(LRU_Cache* cache, int mshr, const Bus_Request& request, bool drain);
+    Bus_Timing perform(LRU_Cache* cache, int mshr, Bus_Request request, bool timed);
+    bool back_invalidate(uint64_t block, bool& dirty);
+    int read_below(LRU_Cache* cache, uint64_t block);
+    int memory(uint64_t block);
+    int64_t free_from(int64_t cycle) const;
+    int64_t reserve(int64_t earliest, int length);
+    void wake_for(int64_t cycle);
+public: 
+    Bus(int64_t* global_cycle, Monitor* monitor, Scheduler* scheduler, Protocol protocol, int block_size, int n_cores, int lines_per_cache,
+        const std::vector<Level_Config>& levels, bool split, const Dram_Config& dram_config): split(split), global_cycle(global_cycle), monitor(monitor), scheduler(scheduler), protocol(protocol), block_size(block_size), directory(size_t(n_cores) * lines_per_cache),
+        dram(dram_config, block_size, &monitor->dram),
+        lower(levels, block_size, [this](uint64_t block) { return memory(block); }, &monitor->levels, [this](uint64_t block, bool& dirty) { return back_invalidate(block, dirty); }) {
+        caches = std::vector<LRU_Cache*>(n_cores, nullptr);
+    }
+    void attach(int core_id, LRU_Cache* cache) {
+        caches[core_id] = cache;
+    }
+    void update_state();
+    // prefetch: a prefetcher's transaction, which yields to the demand ones
+    void request(LRU_Cache* cache, int mshr, bool prefetch = false);
+    // a dirty victim entered the cache's write buffer
+    void buffer_write(LRU_Cache* cache, uint64_t address);
+    // functional warming: applies a transaction's coherence effects at once,
+    // without occupying the bus or counting traffic
+    void warm(LRU_Cache* cache, int type, uint64_t address, bool write) {
+        perform(cache, 0, {type, address, write}, false);
+    }
+    // a cache dropped a block without going through the bus; an exclusive
+    // L2 takes it once no L1 holds it
+    void evicted(int core_id, uint64_t block) {
+        directory.remove(block, core_id);
+        if (!lower.empty() && !directory.get(block)) {
+            lower.write_back(block, false);
+        }
+    }
+    void deliver(const Bus_Message& message) {
+        if (message.kind == Bus_Message::REQUEST || message.kind == Bus_Message::PREFETCH) {
+            request(caches[message.core], int(message.block), message.kind == Bus_Message::PREFETCH);
+        } else if (message.kind == Bus_Message::WRITE_BACK) {
+            buffer_write(caches[message.core], message.block);
+        } else {
+            evicted(message.core, message.block);
+        }
+    }
+    bool busy() const {
+        return !waiting.empty() || !prefetches.empty() || !drains.empty() || !in_flight.empty();
+    }
+    int64_t next_event() const;
+    // earliest cycle a request issued before `cycle` could be granted without
+    // an event the bus already has scheduled, INT64_MAX if there is none
+    int64_t idle_from(int64_t cycle) const {
+        return split ? free_from(cycle) : in_flight.empty() ? cycle : INT64_MAX;
+    }
+    // queues are stored by core id
+    template <class Archive>
+    void checkpoint(Archive& archive);
+}; 
+
+class LRU_Cache {
+private: 
+
+    // tags, LRU ages, dirty bits and coherence states of every set, stored flat
+    Set_Assoc_Cache sets;
+    int associativity;
+    int cache_size;
+    int block_size;
+    Protocol protocol;
+    // Bus;
+    Bus* bus;
+    // monitor 
+    Monitor* monitor;
+    
+    int64_t *global_cycle; 
+
+    Core* core;
+    int id;
+
+    // Miss status holding registers. A blocking cache has one, for the
+    // current access; a non-blocking cache one per outstanding block, with
+    // the load/stores merged into it. The prefetcher's follow, from
+    // n_demand on: a load/store to a block being prefetched merges into its
+    // MSHR like a secondary miss (a late prefetch).
+    static constexpr uint64_t no_block = UINT64_MAX;
+    struct Mshr {
+        uint64_t block = no_block; // no_block = free (non-blocking caches and prefetches only track it)
+        // bus transactions still to do, in order; only the first one is
+        // queued on the bus at a time
+        Bus_Request pending[4];
+        int n_pending = 0;
+        int ops = 0;            // load/stores completing with it
+        bool exclusive = false; // ends with ownership, so stores can merge
+        int64_t allocated = 0;  // cycle
+        // blocking cache: a store merged into a prefetch, performed once
+        // the fill is in
+        bool deferred_write = false;
+        uint64_t deferred_address = 0;
+    };
+    std::vector<Mshr> mshrs;
+    bool non_blocking;
+    int mshrs_busy = 0;
+    int n_demand; // MSHRs for load/stores, the rest are for prefetches
+
+    Prefetch_Engine prefetcher;
+    std::vector<uint8_t> prefetched; // by slot: filled by a prefetch and not used yet
+    std::vector<uint64_t> candidates;
+
+    int write_buffer; // entries for dirty victims, 0 = none
+    int buffered = 0; // entries in use, freed as the bus drains them
+
+    // set when the core runs on a worker thread: the core's own accesses post
+    // to the bus through it instead of calling the bus directly
+    Spsc_Queue<Bus_Message>* outbox;
+
+    void dropped(uint64_t block) {
+        if (outbox) {
+            outbox->push({*global_cycle, id, Bus_Message::DROPPED, block});
+        } else {
+            bus->evicted(id, block);
+        }
+    }
+
+    // A dirty victim goes to the write buffer if it has room, else the
+    // current access waits for its write-back. on_bus: evicted by the bus
+    // itself (refetch), which reaches the bus directly even in the parallel
+    // engine.
+    void write_back(int mshr, uint64_t address, bool on_bus) {
+        if (buffered == write_buffer) {
+            enqueue(mshr, FLUSH, address);
+            return;
+        }
+        buffered++;
+        if (outbox && !on_bus) {
+            outbox->push({*global_cycle, id, Bus_Message::WRITE_BACK, address});
+        } else {
+            bus->buffer_write(this, address);
+        }
+    }
+
+    // with classify_misses: a load/store to the address, for the core's
+    // classifier. Secondary misses, merged into a fetch of the block already
+    // under way, are not classed; the classifier sees them as hits.
+    void classify(uint64_t address, bool miss) {
+        if (!monitor->miss_classes.empty()) {
+            uint64_t block = address / block_size;
+            monitor->miss_classes[id].access(block, sets.set_of(block), miss);
+        }
+    }
+
+    // a line filled by a prefetch gives its slot up without having been used
+    void forget(uint32_t slot) {
+        if (!prefetched.empty() && prefetched[slot]) {
+            prefetched[slot] = 0;
+            monitor->prefetch[id].unused++;
+        }
+    }
+    // the MSHR fetching a block, -1 if none is
+    int pending_mshr(uint64_t block) const {
+        for (int m = 0; m < int(mshrs.size()); m++) {
+            if (mshrs[m].block == block) {
+                return m;
+            }
+        }
+        return -1;
+    }
+    // whether the MSHR's transactions go behind the demand ones: a prefetch
+    // no load/store has merged into yet
+    bool speculative(int mshr) const {
+        return mshr >= n_demand && !mshrs[mshr].ops;
+    }
+
+    bool start(int mshr, uint64_t address, bool write, bool& used);
+    void train(uint64_t block, bool trigger, bool miss);
+    bool prefetch(uint64_t block);
+    void finish_prefetch(int mshr);
+    bool deferred_store(int mshr);
+
+public: 
+    // n_mshrs: 0 for a blocking cache, else the outstanding blocks allowed
+    LRU_Cache(Core* core, int id, int cache_size, int associativity, int block_size, Replacement replacement, int write_buffer, int n_mshrs, const Prefetch_Config& prefetch, Protocol protocol, int64_t* global_cycle, Monitor* monitor, Bus* bus, Spsc_Queue<Bus_Message>* outbox = nullptr): sets(cache_size / (associativity * block_size), associativity, block_size, replacement), associativity(associativity), cache_size(cache_size), block_size(block_size), protocol(protocol), bus(bus), monitor(monitor), global_cycle(global_cycle), core(core), id(id), prefetcher(prefetch, block_size), write_buffer(write_buffer), outbox(outbox)  {
+        n_demand = std::max(n_mshrs, 1);
+        mshrs = std::vector<Mshr>(n_demand + prefetch_mshrs(prefetch));
+        non_blocking = n_mshrs > 0;
+        if (prefetcher.enabled()) {
+            prefetched = std::vector<uint8_t>(lines(cache_size, associativity, block_size), 0);
+        }
+        bus->attach(id, this);
+    }
+    static int lines(int cache_size, int associativity, int block_size) {
+        return std::max(1, cache_size / (associativity * block_size)) * associativity;
+    }
+    // The first transaction of an access is always enqueued by the core; the
+    // bus only appends behind a transaction that is already queued.
+    void enqueue(int mshr, int type, uint64_t address, bool write = false) {
+        Mshr& entry = mshrs[mshr];
+        entry.pending[entry.n_pending++] = {type, address, write};
+        if (entry.n_pending == 1) {
+            bool prefetch = speculative(mshr);
+            if (outbox) {
+                outbox->push({*global_cycle, id, prefetch ? Bus_Message::PREFETCH : Bus_Message::REQUEST, uint64_t(mshr)});
+            } else {
+                bus->request(this, mshr, prefetch);
+            }
+        }
+    }
+    const Bus_Request& current_request(int mshr) const {
+        return mshrs[mshr].pending[0];
+    }
+    bool holds(uint64_t block) const {
+        return sets.find(block) >= 0;
+    }
+    void set_dirty(uint64_t block) {
+        int slot = sets.find(block);
+        if (slot >= 0) {
+            sets.set_dirty(slot, true);
+        }
+    }
+    void set_state(uint64_t block, Line_State state) {
+        int slot = sets.find(block);
+        sets.state(slot) = state;
+        if (state == MODIFIED || state == SHARED_MODIFIED) {
+            sets.set_dirty(slot, true); // may have lost ownership while queued
+        }
+    }
+    bool access(uint64_t address, bool write);
+    int64_t repeat(uint64_t address, bool write, int64_t count);
+    bool warm_repeat(uint64_t address, bool write, int64_t count);
+    enum Issue { ISSUE_HIT, ISSUE_MISS, ISSUE_NO_MSHR, ISSUE_DEPENDENCY };
+    Issue issue(uint64_t address, bool write);
+    bool warm(uint64_t address, bool write);
+    // removes a block for an inclusive lower level; returns whether it was dirty
+    bool back_invalidate(uint64_t block) {
+        int slot = sets.find(block);
+        if (slot < 0) {
+            return false;
+        }
+        bool dirty = sets.is_dirty(slot);
+        sets.invalidate(slot);
+        return dirty;
+    }
+    void refetch(int mshr, uint64_t address, bool write);
+    void snoop(uint64_t block, int type);
+    bool get(uint64_t address) {
+        return access(address, false);
+    }
+    bool put(uint64_t address) {
+        return access(address, true);
+    }
+    void notify_finish_io(int mshr);
+    // the bus wrote back one of the write buffer's entries
+    void drained() {
+        buffered--;
+    }
+    bool has_write_buffer() const {
+        return write_buffer > 0;
+    }
+    int mshr_count() const {
+        return int(mshrs.size());
+    }
+    int get_core_id() const {
+        return id;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        sets.checkpoint(archive);
+        size_t n = mshrs.size();
+        size_t lines = prefetched.size();
+        archive.io(mshrs);
+        archive.io(mshrs_busy);
+        archive.io(buffered);
+        archive.io(prefetched);
+        prefetcher.checkpoint(archive);
+        if (mshrs.size() != n || prefetched.size() != lines || buffered < 0 || buffered > write_buffer) {
+            archive.fail();
+            return;
+        }
+        for (const Mshr& entry : mshrs) {
+            if (entry.n_pending < 0 || entry.n_pending > 4) {
+                archive.fail();
+            }
+        }
+    }
+};
+
+
+
+// One core's view of a detailed window in sampled simulation: the record
+// positions that bound it and snapshots at the start and end of the measured
+// part, and optionally at a mark within it.
+struct Window_Sample {
+    uint64_t measure_from = UINT64_MAX;
+    uint64_t mark_at = UINT64_MAX;
+    uint64_t stop_at = UINT64_MAX;
+    int64_t start_cycle = -1, start_idle = 0, start_ls = 0, start_misses = 0;
+    int64_t mark_cycle = -1, mark_idle = 0, mark_ls = 0, mark_misses = 0;
+    int64_t end_cycle = -1, end_idle = 0, end_ls = 0, end_misses = 0;
+};
+
+class Core {
+private: 
+    LRU_Cache* cache; 
+    Trace_Reader trace; 
+
+    Monitor* monitor; 
+    int64_t* global_cycle;
+    Bus* bus;
+    Scheduler* scheduler;
+    bool waiting_io; 
+    int64_t waiting_cal;
+    int64_t io_start; // cycle the outstanding load/store was issued, -1 if none
+    int cnt = 0;
+    int id;
+    bool exhausted = false;
+    Window_Sample window;
+    uint64_t window_check = UINT64_MAX; // next position at which window matters
+    int* open_windows = nullptr;        // cores still short of their stop_at
+
+    // Non-blocking caches: up to ls_window load/stores in flight (0 = the
+    // core waits for each one). A record that cannot issue is held and
+    // retried whenever one completes.
+    int ls_window = 0;
+    int in_flight = 0;
+    int64_t stall_start = -1; // cycle the core first failed to issue, -1 if it is not stalled
+    bool holding = false;
+    Trace_Record held;
+
+    // Reduced traces: the load/store a repeat record repeats, the record
+    // being expanded (0 once done), its compute by gap, its repeats done and
+    // whether the gap before the next one is, and whether runs of repeats
+    // that hit may be done at once. That needs the scheduler to know every other event, so
+    // not on a worker thread, and is off with a time series, which counts
+    // accesses as they are issued.
+    Trace_Record last = {0, 0};
+    uint64_t run = 0;
+    Repeat_Gaps gaps;
+    uint64_t run_done = 0;
+    bool run_gap = false;
+    bool batch_repeats = false;
+    int block_size;
+
+    // Next load/store or compute record, expanding repeat records with their
+    // compute spread over the gaps; false at the end of the trace.
+    bool next_record(Trace_Record& record) {
+        while (true) {
+            if (run) {
+                uint64_t count = repeat_count(run);
+                if (!run_gap) {
+                    run_gap = true;
+                    uint64_t gap = gaps.at(run_done);
+                    if (run_done == count) {
+                        run = 0;
+                    }
+                    if (gap) {
+                        record = {2, gap};
+                        return true;
+                    }
+                    continue;
+                }
+                run_done++;
+                run_gap = false;
+                record = last;
+                if (run_done == count && !gaps.at(count)) {
+                    run = 0;
+                }
+                return true;
+            }
+            if (!trace.next(record)) {
+                return false;
+            }
+            if ((record.type == repeat_record || record.type == reduced_record) && monitor->sharing.enabled()) {
+                // a repeat keeps the type and block of the accesses it folds, not their words
+                std::cerr << "the sharing report needs an unreduced trace" << std::endl;
+                std::exit(1);
+            }
+            if (record.type == repeat_record) {
+                run = record.value;
+                gaps = Repeat_Gaps(run);
+                run_done = 0;
+                run_gap = false;
+                continue;
+            }
+            if (record.type == reduced_record) {
+                std::string error = reduction_error(record.value, block_size);
+                if (!error.empty()) {
+                    std::cerr << error << std::endl;
+                    std::exit(1);
+                }
+                continue;
+            }
+            if (record.type < 2) {
+                last = record;
+            }
+            return true;
+        }
+    }
+
+    // Performs the repeats left in `run` at once, with the compute in their
+    // gaps, as far as they are hits needing no transaction and fall before
+    // any other slot's next event, and the compute after the last if they
+    // all do; the core resumes when the last would have completed. Compute
+    // takes its cycles, an access a cycle. Returns false if nothing could be
+    // done this way.
+    bool repeat_hits() {
+        int64_t now = *global_cycle;
+        int64_t quiet = scheduler->quiet_until(id + 1);
+        int64_t cycle = now;
+        int64_t compute = 0;
+        uint64_t n = repeat_count(run);
+        uint64_t done = 0;
+        for (; run_done + done < n; done++) {
+            int64_t gap = done == 0 && run_gap ? 0 : int64_t(gaps.at(run_done + done));
+            int64_t at = cycle + gap;
+            if (at >= quiet && at > now) {
+                break;
+            }
+            compute += gap;
+            cycle = at + 1;
+        }
+        if (!done || cache->repeat(last.value, last.type == 1, done) == 0) {
+            return false;
+        }
+        run_done += done;
+        run_gap = false;
+        if (run_done == n) {
+            int64_t gap = gaps.at(n);
+            compute += gap;
+            cycle += gap;
+            run = 0;
+        }
+        monitor->ls_ins[id] += done;
+        monitor->sharing.touch(id, last.value, last.type == 1, done);
+        monitor->compute_cyc[id] += compute;
+        waiting_cal = cycle;
+        return true;
+    }
+
+    void snapshot(int64_t& cycle, int64_t& idle, int64_t& ls, int64_t& misses) const {
+        cycle = *global_cycle;
+        idle = monitor->idle_cyc[id];
+        ls = monitor->ls_ins[id];
+        misses = monitor->hit_miss_cnt[id].second;
+    }
+    void close_window() {
+        snapshot(window.end_cycle, window.end_idle, window.end_ls, window.end_misses);
+        --*open_windows;
+    }
+    // Returns true if the core has to pause here. A core past its stop_at
+    // keeps running, unmeasured, until every core is, so the others still
+    // see its bus traffic.
+    bool at_window_mark() {
+        uint64_t position = trace.position();
+        if (position == window.measure_from) {
+            snapshot(window.start_cycle, window.start_idle, window.start_ls, window.start_misses);
+        }
+        if (position == window.mark_at) {
+            snapshot(window.mark_cycle, window.mark_idle, window.mark_ls, window.mark_misses);
+        }
+        if (position == window.stop_at) {
+            close_window();
+        }
+        if (position >= window.stop_at) {
+            window_check = *open_windows > 0 ? position + 1 : UINT64_MAX;
+            return *open_windows == 0;
+        }
+        window_check = position < window.measure_from ? window.measure_from
+                     : position < window.mark_at && window.mark_at < window.stop_at ? window.mark_at : window.stop_at;
+        return false;
+    }
+
+    // Holds a record that cannot issue yet until a load/store completes;
+    // counter counts the stall unless the record was already held.
+    bool stall(const Trace_Record& record, bool retry, int64_t& counter) {
+        if (!retry) {
+            counter++;
+        }
+        held = record;
+        holding = true;
+        stall_start = *global_cycle;
+        waiting_io = true;
+        return true;
+    }
+
+    // execute_next_instruction for a non-blocking cache: compute records and
+    // load/stores issue without waiting for earlier misses. The core stalls
+    // only on a full window or MSHR file, or a store that depends on a fill,
+    // and at the end of its trace until everything has completed. The traces
+    // carry no register dependences, so those through memory are the only
+    // ones modelled.
+    bool execute_non_blocking() {
+        if (stall_start >= 0) {
+            monitor->idle_cyc[id] += *global_cycle - stall_start;
+            stall_start = -1;
+        }
+        Mshr_Stats& stats = monitor->mshr[id];
+        Trace_Record record;
+        bool retry = holding;
+        if (holding) {
+            record = held;
+            holding = false;
+        } else if (exhausted) {
+            if (in_flight == 0) {
+                return false;
+            }
+            stall_start = *global_cycle;
+            waiting_io = true;
+            return true;
+        } else {
+            if (!run && trace.position() >= window_check && at_window_mark()) {
+                return false;
+            }
+            if (run && batch_repeats && in_flight < ls_window && repeat_hits()) {
+                return true;
+            }
+            if (!next_record(record)) {
+                if (!trace.error().empty()) {
+                    std::cerr << trace.error() << std::endl;
+                    std::exit(1);
+                }
+                if (window_check != UINT64_MAX && trace.position() < window.stop_at) {
+                    close_window();
+                }
+                window_check = UINT64_MAX;
+                exhausted = true;
+                if (in_flight == 0) {
+                    return false;
+                }
+                stall_start = *global_cycle;
+                waiting_io = true;
+                return true;
+            }
+        }
+        if (record.type == 2) {
+            waiting_cal = *global_cycle + record.value;
+            monitor->compute_cyc[id] += record.value;
+            return true;
+        }
+        if (in_flight == ls_window) {
+            return stall(record, retry, stats.window_stalls);
+        }
+        LRU_Cache::Issue issued = cache->issue(record.value, record.type == 1);
+        if (issued == LRU_Cache::ISSUE_NO_MSHR) {
+            return stall(record, retry, stats.full_stalls);
+        }
+        if (issued == LRU_Cache::ISSUE_DEPENDENCY) {
+            return stall(record, retry, stats.dependency_stalls);
+        }
+        monitor->ls_ins[id]++;
+        monitor->sharing.touch(id, record.value, record.type == 1);
+        in_flight += issued == LRU_Cache::ISSUE_MISS;
+        return true;
+    }
+public: 
+    // records: the core's trace decoded in memory, or nullptr to read the file,
+    // or with no config.input_file to take the records given to feed()
+    // outbox: where a core on a worker thread posts to the bus, else nullptr
+    Core(int id, const Config& config, const std::vector<Trace_Record>* records, int64_t* global_cycle, Monitor* monitor, Bus* bus, Scheduler* scheduler, Spsc_Queue<Bus_Message>* outbox = nullptr): monitor(monitor), global_cycle(global_cycle), bus(bus), scheduler(scheduler), id(id)  {
+        cache = new LRU_Cache(this, id, config.cache_size, config.associativity, config.block_size, config.replacement, config.write_buffer, config.mshrs, config.prefetch, protocol_of(config.protocol), global_cycle, monitor, bus, outbox); 
+        ls_window = config.mshrs > 0 ? config.ls_window : 0;
+        batch_repeats = !outbox && config.series_every == 0;
+        block_size = config.block_size;
+        if (records) {
+            trace.open(records->data(), records->size());
+        } else if (config.input_file.empty()) {
+            trace.open_feed();
+        } else {
+            std::string filename = trace_path(config.input_file, id);
+            //std::string filename = "./cache_accesses_1000_0.data";
+            //std::string filename = "./dram_accesses_1000_0.data";
+            //std::cout << filename <<"check" << "\n";
+            if (!trace.open(filename)) {
+                std::cerr << trace.error() << std::endl;
+                std::exit(1);
+            }
+        }
+        waiting_io = false; 
+        waiting_cal = -1;
+        io_start = -1;
+    }
+    // only called by the scheduler once the core is ready, i.e. its compute
+    // burst is over and its last load/store has completed
+    ~Core() {
+        delete cache;
+    }
+    // falls back to the traces as shipped, inside X_four.zip, when neither the
+    // extracted file nor a .gz/.zst copy of it exists. A live workload
+    // ring:<name> is read from the rings <name>_0, <name>_1, ...
+    static std::string trace_path(const std::string& input_file, int id) {
+        if (is_ring_path(input_file)) {
+            return input_file + "_" + std::to_string(id);
+        }
+        std::string member = input_file + "_" + std::to_string(id) + ".data";
+        std::string path = "./" + input_file + "_four/" + member;
+        std::string archive = "./" + input_file + "_four.zip";
+        if (!file_exists(path) && !file_exists(path + ".gz") && !file_exists(path + ".zst") && file_exists(archive)) {
+            return archive + ":" + member;
+        }
+        return path;
+    }
+    bool execute_next_instruction() {
+        if (ls_window) {
+            return execute_non_blocking();
+        }
+        if (io_start >= 0) {
+            // every cycle strictly between issue and the cycle we run again was idle
+            monitor->idle_cyc[id] += *global_cycle - io_start - 1;
+            io_start = -1;
+        }
+        if (!run && trace.position() >= window_check && at_window_mark()) {
+            return false;
+        }
+        if (run && batch_repeats && repeat_hits()) {
+            return true;
+        }
+        Trace_Record record;
+        if (!next_record(record)) {
+            if (!trace.error().empty()) {
+                std::cerr << trace.error() << std::endl;
+                std::exit(1);
+            }
+            if (window_check != UINT64_MAX && trace.position() < window.stop_at) {
+                close_window();
+            }
+            window_check = UINT64_MAX;
+            exhausted = true;
+            return false;
+        }
+        int type = record.type;
+        uint64_t address = record.value;
+        //cnt++; 
+        //std::cout << cnt << " " << type <<" "<<address<< "\n";
+        if (type == 0) { 
+            waiting_io = true;
+            io_start = *global_cycle;
+            cache->get(address); 
+            monitor->ls_ins[id]++;
+            monitor->sharing.touch(id, address, false);
+        } else if (type == 1) {
+            waiting_io = true;
+            io_start = *global_cycle;
+            cache->put(address);
+            monitor->ls_ins[id]++;
+            monitor->sharing.touch(id, address, true);
+        } else {
+            int64_t cal_cycles = int64_t(address);
+            waiting_cal = *global_cycle + cal_cycles;
+            monitor->compute_cyc[id] += cal_cycles;
+        }
+        return true;
+    }
+    // Functional fast-forward by one record for sampled simulation: warms the
+    // cache and counts the record without taking simulated time. Returns a
+    // rough cost in cycles, used to interleave the cores, or -1 at the end.
+    // A repeat record is warmed whole: its first repeat as an access, the
+    // rest as a count of hits where the cache allows.
+    int64_t warm_next_instruction() {
+        Trace_Record record;
+        int64_t cost = 0;
+        do {
+            if (!next_record(record)) {
+                if (!trace.error().empty()) {
+                    std::cerr << trace.error() << std::endl;
+                    std::exit(1);
+                }
+                exhausted = true;
+                return -1;
+            }
+            if (record.type == 2) {
+                monitor->compute_cyc[id] += record.value;
+                cost += record.value;
+            } else {
+                monitor->ls_ins[id]++;
+                monitor->sharing.touch(id, record.value, record.type == 1);
+                cost += cache->warm(record.value, record.type == 1) ? cache_access : ram_access;
+                uint64_t rest = run ? repeat_count(run) - run_done : 0;
+                if (rest && cache->warm_repeat(record.value, record.type == 1, rest)) {
+                    int64_t compute = gaps.before(repeat_count(run)) - gaps.before(run_done);
+                    monitor->ls_ins[id] += rest;
+                    monitor->sharing.touch(id, record.value, record.type == 1, rest);
+                    monitor->compute_cyc[id] += compute;
+                    cost += rest * cache_access + compute;
+                    run_done += rest;
+                    if (!gaps.at(run_done)) {
+                        run = 0;
+                    }
+                }
+            }
+        } while (run);
+        return cost;
+    }
+    // Starts a detailed window: measure from `warmup` records on, with a
+    // snapshot `mark` records into the measured part unless mark is 0, and
+    // pause after warmup + interval once *open reaches 0. The caller counts
+    // the window in *open.
+    void open_window(uint64_t warmup, uint64_t interval, int* open, uint64_t mark = 0) {
+        window = Window_Sample();
+        window.measure_from = trace.position() + warmup;
+        window.mark_at = mark ? window.measure_from + mark : UINT64_MAX;
+        window.stop_at = window.measure_from + interval;
+        window_check = window.measure_from;
+        open_windows = open;
+    }
+    const Window_Sample& sample_window() const {
+        return window;
+    }
+    bool is_exhausted() const {
+        return exhausted;
+    }
+    // A core fed its records stops short of one it has not been given yet
+    // (starved), without any effect, and is resumed once it has.
+    void feed(const Trace_Record* records, size_t n) {
+        trace.feed(records, n);
+    }
+    void end_feed() {
+        trace.end_feed();
+    }
+    bool starved() const {
+        return !exhausted && !run && !holding && trace.starved();
+    }
+    // ops: load/stores completed, for a non-blocking cache; the core only
+    // wakes if it is waiting
+    void finish_io(int ops = 1) {
+        if (ls_window) {
+            in_flight -= ops;
+        }
+        if (!waiting_io) {
+            return;
+        }
+        waiting_io = false;
+        scheduler->wake(id + 1);
+    }
+    bool is_waiting_io() const {
+        return waiting_io;
+    }
+    int64_t ready_cycle() const {
+        return std::max(waiting_cal, *global_cycle + 1);
+    }
+    int get_id() {
+        return id;
+    }
+    // Restoring reopens nothing: the trace opened by the constructor is
+    // skipped forward to the saved position.
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        uint64_t position = trace.position();
+        archive.io(position);
+        archive.io(waiting_io);
+        archive.io(waiting_cal);
+        archive.io(io_start);
+        archive.io(in_flight);
+        archive.io(stall_start);
+        archive.io(holding);
+        archive.io(held);
+        archive.io(last);
+        archive.io(run);
+        archive.io(gaps);
+        archive.io(run_done);
+        archive.io(run_gap);
+        archive.io(exhausted);
+        cache->checkpoint(archive);
+        if (!Archive::saving && !trace.skip(position)) {
+            archive.fail();
+        }
+    }
+}; 
+
+// Leading part of a checkpoint: which simulation it belongs to and the cycle
+// it was taken at (every event before that cycle has been processed).
+template <class Archive>
+void checkpoint_header(Archive& archive, Config& config, int& n_cores, int64_t& cycle) {
+    char magic[8];
+    uint32_t version = checkpoint_version;
+    std::memcpy(magic, checkpoint_magic, sizeof(magic));
+    archive.io(magic);
+    archive.io(version);
+    if (std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 || version != checkpoint_version) {
+        archive.fail();
+        return;
+    }
+    archive.io(config.protocol);
+    archive.io(config.input_file);
+    archive.io(config.cache_size);
+    archive.io(config.associativity);
+    archive.io(config.block_size);
+    archive.io(config.replacement);
+    archive.io(config.levels);
+    archive.io(config.split_bus);
+    archive.io(config.dram);
+    archive.io(config.write_buffer);
+    archive.io(config.mshrs);
+    archive.io(config.ls_window);
+    archive.io(config.prefetch);
+    archive.io(config.classify_misses);
+    archive.io(config.sharing_report);
+    archive.io(n_cores);
+    archive.io(cycle);
+}
+
+inline bool read_checkpoint_header(const std::string& path, Config& config, int& n_cores, int64_t& cycle, std::string& error) {
+    FILE* in = std::fopen(path.c_str(), "rb");
+    if (!in) {
+        error = "cannot open checkpoint " + path;
+        return false;
+    }
+    Checkpoint_Reader reader(in);
+    checkpoint_header(reader, config, n_cores, cycle);
+    std::fclose(in);
+    if (!reader.good() || n_cores < 1 || n_cores > 64) {
+        error = path + " is not a checkpoint of this simulator version";
+        return false;
+    }
+    return true;
+}
+
+class Operating_System {
+private: 
+    int64_t* global_cycle;
+    std::vector<Core*> cores; 
+    Bus* bus; 
+    int n_cores;
+    Monitor* monitor;
+    Scheduler* scheduler;
+    Config config;
+
+    // Parallel engine (config.threads > 1): cores are dealt round-robin to
+    // workers, each with its own clock and scheduler. The bus keeps
+    // global_cycle and scheduler and runs on the calling thread between quanta.
+    struct Worker {
+        int64_t clock = 0;
+        Scheduler* scheduler = nullptr;
+        int64_t last_cycle = 0;
+    };
+    std::vector<Worker> workers;
+    std::vector<Spsc_Queue<Bus_Message>*> outboxes; // by core id
+
+    int64_t last_cycle = 0;   // latest cycle a core ran out of trace, serial engine
+    bool restored = false;
+    bool started = false; // fed simulation: the cores have been woken
+    int64_t next_checkpoint = INT64_MAX;
+
+    // Sampled simulation results, per core: the idle cycles, misses and
+    // load/stores of the first period and of each measured window after it,
+    // and the extrapolated idle and total cycles with the half-widths of
+    // the 95% confidence intervals of their sampling error, -1 with fewer
+    // than 2 windows to spread.
+    struct Sample_Estimate {
+        struct Window {
+            double idle, misses, ls;
+        };
+        Window first = {0, 0, 0};
+        std::vector<Window> windows; // measured
+        std::vector<Window> late_halves; // the second halves of the measured windows
+        double idle = 0, idle_error = 0, idle_bias = 0;
+        double cycles = 0;
+    };
+    std::vector<Sample_Estimate> estimates;
+    int64_t detailed_ls = 0;
+
+    long long next_series = LLONG_MAX; // cycle or load/store count closing the current interval
+
+    Scheduler* scheduler_of(int slot) {
+        return slot == 0 || workers.empty() ? scheduler : workers[(slot - 1) % workers.size()].scheduler;
+    }
+
+    // The state after the header. Wake cycles are stored per slot, so a
+    // checkpoint from either engine resumes in either engine.
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        std::vector<int64_t> wakes(n_cores + 1);
+        for (int slot = 0; slot <= n_cores; slot++) {
+            wakes[slot] = scheduler_of(slot)->wake_cycle(slot);
+        }
+        int64_t finished = last_cycle;
+        for (Worker& worker : workers) {
+            finished = std::max(finished, worker.last_cycle);
+        }
+        archive.io(wakes);
+        archive.io(finished);
+        archive.io(*global_cycle);
+        monitor->checkpoint(archive);
+        bus->checkpoint(archive);
+        for (Core* core : cores) {
+            core->checkpoint(archive);
+        }
+        if (!Archive::saving && archive.good()) {
+            if (wakes.size() != size_t(n_cores + 1)) {
+                archive.fail();
+                return;
+            }
+            for (int slot = 0; slot <= n_cores; slot++) {
+                if (wakes[slot] != INT64_MAX) {
+                    scheduler_of(slot)->wake_at(slot, wakes[slot]);
+                }
+            }
+            last_cycle = finished;
+            restored = true;
+        }
+    }
+
+    // Writes <prefix>-<cycle>.ckpt through a temporary file, so an interrupted
+    // write never leaves a truncated checkpoint behind.
+    void save_checkpoint(int64_t cycle) {
+        std::string path = config.checkpoint_prefix + "-" + std::to_string(cycle) + ".ckpt";
+        std::string temporary = path + ".tmp";
+        FILE* out = std::fopen(temporary.c_str(), "wb");
+        bool ok = out != nullptr;
+        if (ok) {
+            Checkpoint_Writer writer(out);
+            Config saved = config;
+            int n = n_cores;
+            checkpoint_header(writer, saved, n, cycle);
+            checkpoint(writer);
+            ok = writer.good();
+            ok = std::fclose(out) == 0 && ok;
+            ok = ok && std::rename(temporary.c_str(), path.c_str()) == 0;
+        }
+        if (!ok) {
+            std::cerr << "cannot write checkpoint " << path << std::endl;
+        }
+    }
+
+    // Called between events with the cycle of the next one: saves a
+    // checkpoint once that reaches the next multiple of checkpoint_every.
+    void checkpoint_due(int64_t next_event) {
+        if (next_event == INT64_MAX || next_event < next_checkpoint) {
+            return;
+        }
+        save_checkpoint(next_checkpoint);
+        while (next_checkpoint <= next_event) {
+            next_checkpoint = next_checkpoint > INT64_MAX - config.checkpoint_every ? INT64_MAX : next_checkpoint + config.checkpoint_every;
+        }
+    }
+
+    // Called between events like checkpoint_due: closes every interval of
+    // the time series that ends before the next event.
+    void series_due(int64_t next_event) {
+        long long every = config.series_every;
+        if (config.series_accesses) {
+            // one load/store is issued per event, so the count hits each mark
+            if (monitor->accesses() >= next_series) {
+                monitor->record_interval(*global_cycle);
+                next_series += every;
+            }
+            return;
+        }
+        while (next_event != INT64_MAX && next_event >= next_series) {
+            monitor->record_interval(next_series);
+            next_series += every;
+        }
+    }
+
+    void finish() {
+        // the per-cycle loop stopped at the first cycle where every core was done
+        monitor->overall_cyc = last_cycle - 1;
+        monitor->classify_data();
+        // the last, partial interval
+        if (next_series != LLONG_MAX && (monitor->series.empty() || monitor->series.back().accesses < monitor->accesses() ||
+                                         monitor->series.back().cycle < monitor->overall_cyc)) {
+            monitor->record_interval(monitor->overall_cyc);
+        }
+    }
+
+    // Processes events until the queue is empty. Cores that pause at the end
+    // of a sampling window or run out of trace are simply not rescheduled.
+    // Returns true if it stopped early instead, at a fed core that is starved:
+    // its event is put back, so feeding it and draining again goes on exactly
+    // as if the records had been there all along.
+    bool drain_events() {
+        int slot;
+        while (true) {
+            if (next_checkpoint != INT64_MAX) {
+                checkpoint_due(scheduler->peek());
+            }
+            if (next_series != LLONG_MAX) {
+                series_due(scheduler->peek());
+            }
+            if (!scheduler->next(slot)) {
+                return false;
+            }
+            if (slot == 0) {
+                bus->update_state();
+                if (bus->busy()) {
+                    scheduler->wake_at(0, bus->next_event());
+                }
+                continue;
+            }
+            Core* core = cores[slot - 1];
+            if (core->starved()) {
+                scheduler->wake_at(slot, *global_cycle);
+                return true;
+            }
+            if (core->execute_next_instruction()) {
+                if (!core->is_waiting_io()) {
+                    scheduler->wake_at(slot, core->ready_cycle());
+                }
+            } else if (core->is_exhausted()) {
+                last_cycle = std::max(last_cycle, *global_cycle);
+            }
+        }
+    }
+
+    // Two-sided 95% quantile of Student's t distribution.
+    static double t_quantile(int degrees) {
+        static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                       2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                       2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        return degrees < 1 ? 0 : degrees <= 30 ? table[degrees - 1] : 1.96;
+    }
+
+    // Fast-forwards every unfinished core by up to `records` records, always
+    // advancing the core that is furthest behind in estimated time so the
+    // shared state sees the cores' accesses roughly interleaved.
+    void fast_forward(int records) {
+        std::vector<int> left(n_cores, records);
+        std::vector<long long> clock(n_cores, 0);
+        while (true) {
+            int next = -1;
+            for (int i = 0; i < n_cores; i++) {
+                if (left[i] > 0 && !cores[i]->is_exhausted() && (next < 0 || clock[i] < clock[next])) {
+                    next = i;
+                }
+            }
+            if (next < 0) {
+                return;
+            }
+            int64_t cost = cores[next]->warm_next_instruction();
+            clock[next] += std::max<int64_t>(cost, 1);
+            left[next]--;
+        }
+    }
+
+    // Runs a detailed window on every core with records left and collects
+    // the measures of those that reached its measured part: as the core's
+    // first period if `first`, else as one more window. Returns false if no
+    // core had records left.
+    bool detail_windows(int warmup, int interval, bool first, int mark = 0) {
+        int open = 0;
+        for (int i = 0; i < n_cores; i++) {
+            if (!cores[i]->is_exhausted()) {
+                cores[i]->open_window(warmup, interval, &open, mark);
+                scheduler->wake_at(i + 1, *global_cycle + 1);
+                open++;
+            }
+        }
+        if (open == 0) {
+            return false;
+        }
+        std::vector<int64_t> ls_before(monitor->ls_ins);
+        drain_events();
+        for (int i = 0; i < n_cores; i++) {
+            detailed_ls += monitor->ls_ins[i] - ls_before[i];
+            const Window_Sample& window = cores[i]->sample_window();
+            if (window.start_cycle >= 0 && window.end_ls > window.start_ls) {
+                Sample_Estimate::Window measured = {double(window.end_idle - window.start_idle),
+                                                    double(window.end_misses - window.start_misses),
+                                                    double(window.end_ls - window.start_ls)};
+                if (first) {
+                    estimates[i].first = measured;
+                } else {
+                    estimates[i].windows.push_back(measured);
+                    if (window.mark_cycle >= 0) {
+                        estimates[i].late_halves.push_back({double(window.end_idle - window.mark_idle),
+                                                            double(window.end_misses - window.mark_misses), double(window.end_ls - window.mark_ls)});
+                    }
+                }
+            }
+        }
+        return true;
+    }
+    // the counters scaled from the detailed part of a sampled simulation
+    std::vector<int64_t*> sampled_counters() {
+        std::vector<int64_t*> counters = {&monitor->bus_data_traffic, &monitor->bus_invalidate_update_cnt, &monitor->bus_transactions,
+                                          &monitor->bus_busy_cycles, &monitor->bus_queue_cycles, &monitor->write_buffer_drains,
+                                          &monitor->write_buffer_stalls, &monitor->dram.row_hits, &monitor->dram.row_misses,
+                                          &monitor->dram.bank_wait_cycles};
+        for (Prefetch_Stats& stats : monitor->prefetch) {
+            counters.insert(counters.end(), {&stats.issued, &stats.useful, &stats.late, &stats.unused, &stats.dropped, &stats.bus_bytes});
+        }
+        return counters;
+    }
+
+    // Sampled simulation: the first config.sample_period records per core run
+    // in detail and are measured whole, since a cold start's misses cost more
+    // than later ones and windows after it would never see them. In every
+    // later period, the records before the last sample_warmup +
+    // sample_interval are only warmed through the caches, the next
+    // sample_warmup run in detail to settle the timing state and the last
+    // sample_interval are measured.
+    // Compute cycles and load/store counts are exact. Hits and misses are
+    // counted for every record, but warming interleaves the cores by a rough
+    // cost rather than by timing, so coherence can make them differ slightly
+    // from a detailed run. A core's idle cycles are those of its first period
+    // plus its later misses times the idle cycles per miss of its measured
+    // windows (a ratio estimate), or per load/store if no measured window
+    // missed. The interval covers the sampling error alone, the windows'
+    // spread around that ratio. The warm-up bias is reported apart: how far
+    // the estimate exceeds the one from the second halves of the windows,
+    // whose timing state has settled longer. Bus counters past the first
+    // period are scaled by the detailed share of the later accesses, the
+    // false-sharing report's traffic by that of all of them.
+    void run_sampled() {
+        int skip = config.sample_period - config.sample_warmup - config.sample_interval;
+        estimates = std::vector<Sample_Estimate>(n_cores);
+        detail_windows(0, config.sample_period, true);
+        int64_t first_ls = detailed_ls;
+        std::vector<int64_t> first_counts;
+        for (int64_t* counter : sampled_counters()) {
+            first_counts.push_back(*counter);
+        }
+        while (true) {
+            fast_forward(skip);
+            if (!detail_windows(config.sample_warmup, config.sample_interval, false, config.sample_interval / 2)) {
+                break;
+            }
+        }
+
+        // the cores stall independently, so the critical path is the core
+        // with the most estimated cycles; its interval bounds the total
+        Monitor::Sample_Stats& stats = monitor->sampling;
+        stats = {config.sample_period, config.sample_warmup, config.sample_interval, detailed_ls, 0, 0, {}, {}, {}};
+        double longest = 0;
+        long long total_ls = 0;
+        for (int i = 0; i < n_cores; i++) {
+            Sample_Estimate& estimate = estimates[i];
+            size_t n = estimate.windows.size();
+            double idle = 0, misses = 0, ls = 0;
+            for (const Sample_Estimate::Window& window : estimate.windows) {
+                idle += window.idle;
+                misses += window.misses;
+                ls += window.ls;
+            }
+            // idle past the first period = ratio * rest of the measure:
+            // misses, else load/stores
+            bool by_misses = misses > 0;
+            double measured = by_misses ? misses : ls;
+            double rest = by_misses ? monitor->hit_miss_cnt[i].second - estimate.first.misses : monitor->ls_ins[i] - estimate.first.ls;
+            double ratio = measured > 0 ? idle / measured : 0;
+            double variance = 0;
+            for (const Sample_Estimate::Window& window : estimate.windows) {
+                double residual = window.idle - ratio * (by_misses ? window.misses : window.ls);
+                variance += residual * residual;
+            }
+            variance = n > 1 ? variance / (n - 1) : 0;
+            estimate.idle = estimate.first.idle + ratio * rest;
+            if (rest > 0 && n < 2) {
+                estimate.idle_error = -1;
+            } else {
+                estimate.idle_error = measured > 0 ? t_quantile(int(n) - 1) * std::sqrt(variance * n) / measured * rest : 0;
+            }
+            // the warm-up bias: how much higher the estimate is than one
+            // from the windows' second halves, whose timing has settled longer
+            double late_idle = 0, late_measured = 0;
+            for (const Sample_Estimate::Window& half : estimate.late_halves) {
+                late_idle += half.idle;
+                late_measured += by_misses ? half.misses : half.ls;
+            }
+            estimate.idle_bias = late_measured > 0 ? (ratio - late_idle / late_measured) * rest : 0;
+            estimate.cycles = double(monitor->compute_cyc[i]) + monitor->ls_ins[i] + estimate.idle;
+            monitor->idle_cyc[i] = std::llround(estimate.idle);
+            total_ls += monitor->ls_ins[i];
+            stats.windows.push_back(n);
+            stats.idle_error.push_back(estimate.idle_error);
+            stats.idle_bias.push_back(estimate.idle_bias);
+            if (i == 0 || estimate.cycles > longest) {
+                longest = estimate.cycles;
+                stats.overall_error = estimate.idle_error;
+                stats.overall_bias = estimate.idle_bias;
+            }
+        }
+        monitor->overall_cyc = std::llround(longest) - 1;
+        monitor->classify_data();
+        if (detailed_ls > first_ls) {
+            double scale = double(total_ls - first_ls) / (detailed_ls - first_ls);
+            std::vector<int64_t*> counters = sampled_counters();
+            for (size_t k = 0; k < counters.size(); k++) {
+                *counters[k] = first_counts[k] + std::llround((*counters[k] - first_counts[k]) * scale);
+            }
+            scale = double(total_ls) / detailed_ls;
+            for (False_Sharing_Line& line : monitor->sharing_summary.hot_lines) {
+                line.traffic.bytes = std::llround(line.traffic.bytes * scale);
+                line.traffic.invalidations_updates = std::llround(line.traffic.invalidations_updates * scale);
+            }
+        }
+    }
+
+    // Runs the worker's cores through their events before `horizon`.
+    void run_worker(Worker& worker, int64_t horizon) {
+        int slot;
+        while (worker.scheduler->next(slot, horizon)) {
+            Core* core = cores[slot - 1];
+            if (core->execute_next_instruction()) {
+                if (!core->is_waiting_io()) {
+                    worker.scheduler->wake_at(slot, core->ready_cycle());
+                }
+            } else {
+                worker.last_cycle = std::max(worker.last_cycle, worker.clock);
+            }
+        }
+    }
+
+    // Runs the bus's events up to and including `cycle`.
+    void advance_bus(int64_t cycle) {
+        int slot;
+        while (scheduler->next(slot, cycle + 1)) {
+            // the bus is slot 0, so cores it wakes still run in this cycle
+            for (Worker& worker : workers) {
+                worker.scheduler->set_position(*global_cycle, 0);
+            }
+            bus->update_state();
+            if (bus->busy()) {
+                scheduler->wake_at(0, bus->next_event());
+            }
+        }
+    }
+
+    // Alternates quanta in which the workers run their cores concurrently with
+    // bus phases on this thread. In a bus phase the messages the cores posted
+    // are merged in (cycle, core) order, the order the serial loop issues
+    // them in, and interleaved with the bus's own events.
+    // Strict mode ends a quantum at the bus's next event, or at the earliest
+    // cycle a transaction started by a core event could be granted, so no
+    // core runs past a snoop that could touch its cache and the results equal
+    // the serial loop's.
+    // Relaxed mode uses fixed quanta: cores only meet at the barriers and a
+    // request reaches the bus at most one quantum late, which bounds the
+    // timing error.
+    void run_parallel() {
+        const bool strict = config.quantum <= 0;
+        for (int i = 0; i < n_cores && !restored; i++) {
+            workers[i % workers.size()].scheduler->wake_at(i + 1, 0);
+        }
+        Spin_Barrier barrier(workers.size());
+        int64_t horizon = 0;
+        bool stop = false;
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < workers.size(); t++) {
+            threads.emplace_back([&, t]() {
+                while (true) {
+                    barrier.wait();
+                    if (stop) {
+                        return;
+                    }
+                    run_worker(workers[t], horizon);
+                    barrier.wait();
+                }
+            });
+        }
+
+        std::vector<Bus_Message> messages;
+        std::vector<int64_t> worker_next(workers.size());
+        while (true) {
+            int64_t cores_next = INT64_MAX;
+            for (size_t t = 0; t < workers.size(); t++) {
+                worker_next[t] = workers[t].scheduler->peek();
+                cores_next = std::min(cores_next, worker_next[t]);
+            }
+            int64_t bus_next = scheduler->peek();
+            if (cores_next == INT64_MAX && bus_next == INT64_MAX) {
+                break;
+            }
+            checkpoint_due(std::min(cores_next, bus_next));
+            if (strict) {
+                // while the bus is free any core event may start a transaction
+                horizon = cores_next == INT64_MAX ? bus_next : std::min(bus_next, bus->idle_from(cores_next + 1));
+            } else {
+                horizon = std::max(horizon, std::min(cores_next, bus_next)) + config.quantum;
+            }
+            int active = 0;
+            size_t only = 0;
+            for (size_t t = 0; t < workers.size(); t++) {
+                if (worker_next[t] < horizon) {
+                    active++;
+                    only = t;
+                }
+            }
+            if (active == 1) {
+                // short strict quanta often involve one worker; the others stay
+                // parked in the barrier, so run it here without a round trip
+                run_worker(workers[only], horizon);
+            } else if (active > 1) {
+                barrier.wait();
+                run_worker(workers[0], horizon);
+                barrier.wait();
+            }
+
+            messages.clear();
+            Bus_Message message;
+            for (Spsc_Queue<Bus_Message>* outbox : outboxes) {
+                while (outbox->pop(message)) {
+                    messages.push_back(message);
+                }
+            }
+            std::stable_sort(messages.begin(), messages.end(), [](const Bus_Message& a, const Bus_Message& b) {
+                return a.cycle != b.cycle ? a.cycle < b.cycle : a.core < b.core;
+            });
+            for (const Bus_Message& m : messages) {
+                advance_bus(m.cycle);
+                // in relaxed mode a message may be older than the bus
+                scheduler->set_position(std::max(m.cycle, *global_cycle), m.core + 1);
+                bus->deliver(m);
+            }
+            advance_bus(strict ? horizon : horizon - 1);
+        }
+        stop = true;
+        barrier.wait();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        for (Worker& worker : workers) {
+            last_cycle = std::max(last_cycle, worker.last_cycle);
+        }
+        finish();
+    }
+
+public: 
+    // traces: per-core decoded traces shared between simulations, or nullptr
+    // to let every core stream its own file
+    Operating_System(const Config& config, int n_cores, const std::vector<std::vector<Trace_Record>>* traces = nullptr): n_cores(n_cores), config(config) {
+        global_cycle = new int64_t(0);
+        monitor = new Monitor(n_cores);
+        if (config.sharing_report) {
+            monitor->sharing.enable(n_cores, config.block_size, word_size);
+        }
+        if (config.classify_misses) {
+            int lines = LRU_Cache::lines(config.cache_size, config.associativity, config.block_size);
+            monitor->classify_misses(lines, lines / config.associativity);
+        }
+        scheduler = new Scheduler(n_cores + 1, global_cycle);
+        bus = new Bus(global_cycle, monitor, scheduler, protocol_of(config.protocol), config.block_size, n_cores, LRU_Cache::lines(config.cache_size, config.associativity, config.block_size), config.levels, config.split_bus, config.dram);
+        if (config.checkpoint_every > 0) {
+            next_checkpoint = config.checkpoint_every;
+        }
+        // sampled simulation alternates functional and detailed phases, and
+        // the time series is taken between events, on the serial engine
+        int n_workers = config.sample_period > 0 || config.series_every > 0 ? 1 : std::min(config.threads, n_cores);
+        if (n_workers > 1) {
+            workers = std::vector<Worker>(n_workers);
+            for (Worker& worker : workers) {
+                worker.scheduler = new Scheduler(n_cores + 1, &worker.clock);
+            }
+        }
+        cores = std::vector<Core*>(n_cores); 
+        for (int i = 0; i < n_cores; i++) {
+            const std::vector<Trace_Record>* records = traces ? &(*traces)[i] : nullptr;
+            if (workers.empty()) {
+                cores[i] = new Core(i, this->config, records, global_cycle, monitor, bus, scheduler);
+            } else {
+                // a core posts at most an eviction, a write-back and a request
+                // per MSHR, prefetches' included, per quantum
+                Worker& worker = workers[i % n_workers];
+                outboxes.push_back(new Spsc_Queue<Bus_Message>(16 * (std::max(1, config.mshrs) + prefetch_mshrs(config.prefetch))));
+                cores[i] = new Core(i, this->config, records, &worker.clock, monitor, bus, worker.scheduler, outboxes.back());
+            }
+        }
+    }
+    ~Operating_System() {
+        for (Core* core : cores) {
+            delete core;
+        }
+        for (Spsc_Queue<Bus_Message>* outbox : outboxes) {
+            delete outbox;
+        }
+        for (Worker& worker : workers) {
+            delete worker.scheduler;
+        }
+        delete bus;
+        delete scheduler;
+        delete monitor;
+        delete global_cycle;
+    }
+    const Monitor& statistics() const {
+        return *monitor;
+    }
+    // Resumes from a checkpoint of the same simulation (protocol, trace, cache
+    // geometry and core count); threads, quantum and checkpointing may differ.
+    bool restore(const std::string& path, std::string& error) {
+        FILE* in = std::fopen(path.c_str(), "rb");
+        if (!in) {
+            error = "cannot open checkpoint " + path;
+            return false;
+        }
+        Checkpoint_Reader reader(in);
+        Config saved;
+        int saved_cores = 0;
+        int64_t cycle = 0;
+        checkpoint_header(reader, saved, saved_cores, cycle);
+        if (reader.good() && (protocol_of(saved.protocol) != protocol_of(config.protocol) || saved.input_file != config.input_file ||
+                              saved.cache_size != config.cache_size || saved.associativity != config.associativity ||
+                              saved.block_size != config.block_size || saved.replacement != config.replacement || saved.levels != config.levels ||
+                              saved.split_bus != config.split_bus || saved.dram != config.dram || saved.write_buffer != config.write_buffer ||
+                              saved.mshrs != config.mshrs || (config.mshrs > 0 && saved.ls_window != config.ls_window) || saved.prefetch != config.prefetch ||
+                              saved_cores != n_cores)) {
+            std::fclose(in);
+            error = path + " was taken from a different simulation";
+            return false;
+        }
+        if (reader.good()) {
+            checkpoint(reader);
+        }
+        std::fclose(in);
+        if (!reader.good()) {
+            error = path + " is damaged or not a checkpoint of this simulator version";
+            return false;
+        }
+        if (config.checkpoint_every > 0) {
+            next_checkpoint = cycle + config.checkpoint_every;
+        }
+        return true;
+    }
+    // Jumps from one scheduled event to the next instead of ticking every cycle.
+    // Cores blocked on the bus are not polled; their idle cycles are added when
+    // they resume.
+    void run() {
+        if (!workers.empty()) {
+            run_parallel();
+            return;
+        }
+        if (config.sample_period > 0) {
+            run_sampled();
+            return;
+        }
+        for (int i = 0; i < n_cores && !restored; i++) {
+            scheduler->wake_at(i + 1, 0);
+        }
+        if (config.series_every > 0) {
+            long long start = config.series_accesses ? monitor->accesses() : *global_cycle;
+            next_series = (start / config.series_every + 1) * config.series_every;
+        }
+        drain_events();
+        finish();
+    }
+    // A simulation fed its records instead (no config.input_file), on the
+    // serial engine: feed() gives a core more of them, end_feeds() ends every
+    // core's, and advance() runs as far as they go. It returns false at a core
+    // that needs more, true once the simulation has finished.
+    void feed(int core, const Trace_Record* records, size_t n) {
+        cores[core]->feed(records, n);
+    }
+    void end_feeds() {
+        for (Core* core : cores) {
+            core->end_feed();
+        }
+    }
+    bool advance() {
+        if (!started) {
+            for (int i = 0; i < n_cores; i++) {
+                scheduler->wake_at(i + 1, 0);
+            }
+            started = true;
+        }
+        if (drain_events()) {
+            return false;
+        }
+        finish();
+        return true;
+    }
+    void print_sampling() const {
+        const Monitor::Sample_Stats& stats = monitor->sampling;
+        if (!stats.period) {
+            return;
+        }
+        long long total_ls = 0;
+        for (int i = 0; i < n_cores; i++) {
+            total_ls += monitor->ls_ins[i];
+        }
+        std::cout << "Sampled simulation: period " << stats.period << ", warmup " << stats.warmup
+                  << ", interval " << stats.interval << " records per core" << std::endl;
+        std::cout << "   Measured windows (core 0): " << stats.windows[0] << std::endl;
+        std::cout << "   Detailed load/stores: " << stats.detailed_ls << " of " << total_ls << std::endl;
+        auto error = [](double half_width) {
+            return half_width < 0 ? std::string("?") : std::to_string(std::llround(half_width));
+        };
+        std::cout << "   Overall Execution Cycles: " << monitor->overall_cyc << " +/- " << error(stats.overall_error)
+                  << " (95% CI of the sampling error), warm-up bias " << std::showpos << std::llround(stats.overall_bias)
+                  << std::noshowpos << std::endl;
+        for (int i = 0; i < n_cores; i++) {
+            std::cout << "   Core " << i << " Idle Cycles: " << monitor->idle_cyc[i] << " +/- " << error(stats.idle_error[i])
+                      << ", warm-up bias " << std::showpos << std::llround(stats.idle_bias[i]) << std::noshowpos << " ("
+                      << stats.windows[i] << " windows)" << std::endl;
+        }
+        std::cout << std::endl;
+    }
+}; 
+
+// Completes the transactions that end now, then grants the bus if it is
+// free: to the oldest waiting core, else to the oldest prefetch, else to a
+// write-buffer entry.
+inline void Bus::update_state() {
+    int64_t now = *global_cycle;
+    updating = true;
+    for (size_t i = 0; i < in_flight.size();) {
+        if (in_flight[i].done != now) {
+            i++;
+            continue;
+        }
+        Flight flight = in_flight[i];
+        in_flight.erase(in_flight.begin() + i);
+        if (flight.drain) {
+            monitor->write_buffer_drains++;
+            caches[flight.core]->drained();
+        } else {
+            caches[flight.core]->notify_finish_io(flight.mshr);
+        }
+    }
+    updating = false;
+    while (!reserved.empty() && reserved.front().end <= now) {
+        reserved.erase(reserved.begin());
+    }
+    if (split ? free_from(now) != now : !in_flight.empty()) {
+        return;
+    }
+    if (!waiting.empty()) {
+        Waiting next = waiting.front();
+        waiting.pop_front();
+        monitor->bus_transactions++;
+        monitor->bus_queue_cycles += now - next.since;
+        LRU_Cache* cache = caches[next.core];
+        grant(cache, next.mshr, cache->current_request(next.mshr), false);
+    } else if (!prefetches.empty()) {
+        Waiting next = prefetches.front();
+        prefetches.pop_front();
+        LRU_Cache* cache = caches[next.core];
+        grant(cache, next.mshr, cache->current_request(next.mshr), false);
+    } else if (!drains.empty()) {
+        Drain drain = drains.front();
+        drains.pop_front();
+        grant(caches[drain.core], 0, {FLUSH, drain.address, false}, true);
+    }
+}
+
+// Performs the snoops of a transaction now that it owns the bus and
+// schedules its completion. The atomic bus is held until then; the split bus
+// only for the address phase, one word, and for the data phase once the data
+// is ready, in the first gap long enough.
+inline void Bus::grant(LRU_Cache* cache, int mshr, const Bus_Request& request, bool drain) {
+    int64_t now = *global_cycle;
+    if (request.type == FLUSH && !drain && cache->has_write_buffer()) {
+        monitor->write_buffer_stalls++;
+    }
+    Bus_Timing timing = perform(cache, mshr, request, true);
+    int64_t done;
+    if (split) {
+        reserve(now, word_transfer);
+        int64_t ready = now + word_transfer + (request.type == FLUSH ? 0 : timing.latency);
+        done = timing.transfer ? reserve(ready, timing.transfer) + timing.transfer : ready;
+        monitor->bus_busy_cycles += word_transfer + timing.transfer;
+    } else {
+        // memory and the lower levels quote the whole access; otherwise the
+        // transfer, at least the word carrying the request
+        done = now + (timing.latency ? timing.latency : std::max(timing.transfer, word_transfer));
+        monitor->bus_busy_cycles += done - now;
+    }
+    in_flight.push_back({done, cache->get_core_id(), mshr, drain, request.address});
+}
+
+inline void Bus::request(LRU_Cache* cache, int mshr, bool prefetch) {
+    (prefetch ? prefetches : waiting).push_back({cache->get_core_id(), mshr, *global_cycle});
+    wake_for(*global_cycle);
+}
+
+inline void Bus::buffer_write(LRU_Cache* cache, uint64_t address) {
+    drains.push_back({cache->get_core_id(), address});
+    wake_for(*global_cycle);
+}
+
+// Makes sure the bus looks at its queues once it is free, which a busy bus
+// does anyway when its transaction completes.
+inline void Bus::wake_for(int64_t cycle) {
+    if (updating) {
+        return; // the update in progress grants after its completions
+    }
+    if (!split) {
+        if (in_flight.empty()) {
+            scheduler->wake(0);
+        }
+        return;
+    }
+    int64_t free = free_from(cycle);
+    if (free == cycle) {
+        scheduler->wake(0);
+    } else {
+        scheduler->wake_at(0, free);
+    }
+}
+
+inline int64_t Bus::next_event() const {
+    int64_t next = INT64_MAX;
+    for (const Flight& flight : in_flight) {
+        next = std::min(next, flight.done);
+    }
+    if (split && (!waiting.empty() || !prefetches.empty() || !drains.empty())) {
+        next = std::min(next, free_from(*global_cycle + 1));
+    }
+    return next;
+}
+
+// First cycle from `cycle` on that no reserved phase covers.
+inline int64_t Bus::free_from(int64_t cycle) const {
+    for (const Reservation& r : reserved) {
+        if (r.start <= cycle && cycle < r.end) {
+            cycle = r.end;
+        }
+    }
+    return cycle;
+}
+
+// Books the first gap of `length` cycles from `earliest` on; returns its start.
+inline int64_t Bus::reserve(int64_t earliest, int length) {
+    int64_t start = earliest;
+    size_t i = 0;
+    for (; i < reserved.size(); i++) {
+        if (reserved[i].end <= start) {
+            continue;
+        }
+        if (reserved[i].start >= start + length) {
+            break;
+        }
+        start = reserved[i].end;
+    }
+    reserved.insert(reserved.begin() + i, {start, start + length});
+    return start;
+}
+
+template <class Archive>
+void Bus::checkpoint(Archive& archive) {
+    std::vector<Waiting> queued(waiting.begin(), waiting.end());
+    std::vector<Waiting> speculative(prefetches.begin(), prefetches.end());
+    std::vector<Drain> buffered(drains.begin(), drains.end());
+    archive.io(queued);
+    archive.io(speculative);
+    archive.io(buffered);
+    archive.io(in_flight);
+    archive.io(reserved);
+    if (!Archive::saving) {
+        waiting.assign(queued.begin(), queued.end());
+        prefetches.assign(speculative.begin(), speculative.end());
+        queued.insert(queued.end(), speculative.begin(), speculative.end());
+        for (const Waiting& entry : queued) {
+            if (entry.core < 0 || entry.core >= int(caches.size()) || entry.mshr < 0 || entry.mshr >= caches[entry.core]->mshr_count()) {
+                archive.fail();
+            }
+        }
+        drains.assign(buffered.begin(), buffered.end());
+        for (const Drain& drain : drains) {
+            if (drain.core < 0 || drain.core >= int(caches.size())) {
+                archive.fail();
+            }
+        }
+        for (const Flight& flight : in_flight) {
+            if (flight.core < 0 || flight.core >= int(caches.size()) || flight.mshr < 0 || flight.mshr >= caches[flight.core]->mshr_count()) {
+                archive.fail();
+            }
+        }
+    }
+    directory.checkpoint(archive);
+    dram.checkpoint(archive);
+    lower.checkpoint(archive);
+}
+
+// Applies a transaction's coherence effects and returns what it needs from
+// the bus. Untimed transactions (functional warming) count no traffic, and a
+// Dragon write miss's BusUpd follows immediately instead of being queued, as
+// it does for a write miss that refetches a lost line.
+inline Bus_Timing Bus::perform(LRU_Cache* cache, int mshr, Bus_Request request, bool timed) {
+    int id = cache->get_core_id();
+    uint64_t block = request.address / block_size;
+    int block_transfer = word_transfer * block_size / word_size;
+    bool refetched = false;
+    timed_access = timed;
+
+    if (request.type == FLUSH) {
+        if (timed) {
+            monitor->bus_data_traffic += block_size;
+        }
+        return {lower.write_back(block, true), block_transfer};
+    }
+    if (request.type == BUS_UPGR && !cache->holds(block)) {
+        // lost the shared copy to another writer while waiting for the bus
+        cache->refetch(mshr, request.address, true);
+        request.type = BUS_RDX;
+    } else if (request.type == BUS_UPD && !cache->holds(block)) {
+        // lost to a back-invalidation from an inclusive level, or to another
+        // fill of a non-blocking cache: a write miss whose update goes with
+        // the fill, so two fills to one set cannot keep evicting each other
+        // between their BusRd and BusUpd
+        cache->refetch(mshr, request.address, true);
+        request = {BUS_RD, request.address, true};
+        refetched = true;
+    } else if (!cache->holds(block)) {
+        // a non-blocking cache evicted the line its own fill was waiting for
+        cache->refetch(mshr, request.address, request.type == BUS_RDX || request.write);
+    }
+
+    uint64_t others = directory.get(block) & ~(uint64_t(1) << id);
+    for (int core = 0; others >> core; core++) {
+        if (others >> core & 1) {
+            caches[core]->snoop(block, request.type);
+        }
+    }
+    switch (request.type) {
+        case BUS_RD:
+            directory.add(block, id);
+            if (timed) {
+                monitor->bus_data_traffic += block_size;
+                if (others) {
+                    monitor->sharing.transfer(block * block_size, block_size, 0);
+                }
+            }
+            if (protocol == DRAGON && request.write) {
+                cache->set_state(block, others ? SHARED : MODIFIED);
+                if (others && timed && !refetched) {
+                    cache->enqueue(mshr, BUS_UPD, request.address);
+                } else if (others) {
+                    perform(cache, mshr, {BUS_UPD, request.address, false}, timed);
+                }
+            } else {
+                cache->set_state(block, others ? SHARED : EXCLUSIVE);
+            }
+            return {others ? 0 : read_below(cache, block), block_transfer};
+        case BUS_RDX:
+            for (int core = 0; others >> core; core++) {
+                if (others >> core & 1) {
+                    directory.remove(block, core);
+                }
+            }
+            directory.add(block, id);
+            if (timed) {
+                monitor->bus_data_traffic += block_size;
+                monitor->bus_invalidate_update_cnt += others != 0;
+                if (others) {
+                    monitor->sharing.transfer(block * block_size, block_size, 1);
+                }
+            }
+            cache->set_state(block, MODIFIED);
+            return {others ? 0 : read_below(cache, block), block_transfer};
+        case BUS_UPGR:
+            for (int core = 0; others >> core; core++) {
+                if (others >> core & 1) {
+                    directory.remove(block, core);
+                }
+            }
+            if (timed) {
+                monitor->bus_invalidate_update_cnt++;
+                monitor->sharing.transfer(block * block_size, 0, 1);
+            }
+            cache->set_state(block, MODIFIED);
+            return {0, 0};
+        default: // BUS_UPD
+            if (timed) {
+                monitor->bus_invalidate_update_cnt++;
+                monitor->bus_data_traffic += word_size;
+                monitor->sharing.transfer(block * block_size, word_size, 1);
+            }
+            cache->set_state(block, others ? SHARED_MODIFIED : MODIFIED);
+            return {0, word_transfer};
+    }
+}
+
+// Fetches a block from the lower levels (or memory) for the cache.
+inline int Bus::read_below(LRU_Cache* cache, uint64_t block) {
+    bool dirty = false;
+    int cycles = lower.read(block, dirty);
+    if (dirty) {
+        cache->set_dirty(block);
+    }
+    return cycles;
+}
+
+// Main memory's part of the transaction being performed; the split bus
+// starts it after the address phase.
+inline int Bus::memory(uint64_t block) {
+    if (!dram.enabled()) {
+        return ram_access;
+    }
+    int64_t start = *global_cycle + (split ? word_transfer : 0);
+    return int(dram.access(block, start, timed_access) - start);
+}
+
+// Drops a block from every L1 for an inclusive level's eviction.
+inline bool Bus::back_invalidate(uint64_t block, bool& dirty) {
+    uint64_t holders = directory.get(block);
+    for (int core = 0; holders >> core; core++) {
+        if (holders >> core & 1) {
+            dirty = caches[core]->back_invalidate(block) || dirty;
+            directory.remove(block, core);
+        }
+    }
+    return holders != 0;
+}
+
+// Looks an access up and queues the bus transactions it needs in the MSHR.
+// used is set when it hits a block a prefetch brought in and nothing used yet.
+inline bool LRU_Cache::start(int mshr, uint64_t address, bool write, bool& used) {
+    auto result = sets.access(address, write);
+    if (result.hit && !prefetched.empty() && prefetched[result.slot]) {
+        prefetched[result.slot] = 0;
+        monitor->prefetch[id].useful++;
+        used = true;
+    } else if (!result.hit) {
+        forget(result.slot);
+    }
+    if (result.evicted) {
+        dropped(result.victim);
+        // without room in the write buffer, a dirty victim is written back
+        // before the new block is fetched
+        if (result.evicted_dirty) {
+            write_back(mshr, result.victim * block_size, false);
+        }
+    }
+    classify(address, !result.hit);
+    if (result.hit) {
+        monitor->hit_miss_cnt[id].first++;
+        uint8_t& state = sets.state(result.slot);
+        if (write && state == EXCLUSIVE) {
+            state = MODIFIED;
+        } else if (write && (state == SHARED || state == SHARED_MODIFIED)) {
+            enqueue(mshr, protocol == MESI ? BUS_UPGR : BUS_UPD, address);
+        }
+    } else {
+        monitor->hit_miss_cnt[id].second++;
+        enqueue(mshr, protocol == MESI && write ? BUS_RDX : BUS_RD, address, write);
+    }
+    return result.hit;
+}
+
+// Blocking access: the core waits until it completes. An access to a block
+// still being prefetched waits for that fill; a store then finishes from
+// finish_prefetch.
+inline bool LRU_Cache::access(uint64_t address, bool write) {
+    uint64_t block = address / block_size;
+    bool used = false;
+    if (prefetcher.enabled()) {
+        int m = pending_mshr(block);
+        if (m >= 0) {
+            Mshr& entry = mshrs[m];
+            entry.ops = 1;
+            entry.deferred_write = write;
+            entry.deferred_address = address;
+            monitor->prefetch[id].useful++;
+            monitor->prefetch[id].late++;
+            monitor->hit_miss_cnt[id].second++;
+            classify(address, false);
+            train(block, true, false);
+            return false;
+        }
+    }
+    bool hit = start(0, address, write, used);
+    if (prefetcher.enabled()) {
+        train(block, !hit || used, !hit);
+    }
+    if (!mshrs[0].n_pending) {
+        core->finish_io();
+    }
+    return hit;
+}
+
+// Up to `count` repeats of the load/store just performed on the block of
+// `address`, done at once while they are hits that need no transaction: the
+// block is held, with ownership for a store, and is neither being fetched
+// nor an unused prefetch. Returns how many were done, 0 if the next one has
+// to go through access() or issue().
+inline int64_t LRU_Cache::repeat(uint64_t address, bool write, int64_t count) {
+    uint64_t block = address / block_size;
+    int slot = sets.find(block);
+    if (slot < 0 || pending_mshr(block) >= 0 || (!prefetched.empty() && prefetched[slot])) {
+        return 0;
+    }
+    uint8_t& state = sets.state(slot);
+    if (write && state != EXCLUSIVE && state != MODIFIED) {
+        return 0;
+    }
+    if (write) {
+        state = MODIFIED;
+    }
+    sets.repeat_hits(slot, count, write);
+    monitor->hit_miss_cnt[id].first += count;
+    if (prefetcher.enabled()) {
+        train(block, false, false); // the same block again teaches it nothing more
+    }
+    return count;
+}
+
+// Non-blocking access. A load/store to a block with an outstanding miss
+// merges into its MSHR, except a store to a block fetched without ownership,
+// which depends on the fill and waits for it. Any other access that needs
+// the bus takes a free MSHR, or waits for one.
+inline LRU_Cache::Issue LRU_Cache::issue(uint64_t address, bool write) {
+    uint64_t block = address / block_size;
+    Mshr_Stats& stats = monitor->mshr[id];
+    int free = -1;
+    bool used = false;
+    for (int m = 0; m < int(mshrs.size()); m++) {
+        if (mshrs[m].block == block) {
+            if (write && !mshrs[m].exclusive) {
+                return ISSUE_DEPENDENCY;
+            }
+            mshrs[m].ops++;
+            monitor->hit_miss_cnt[id].second++;
+            classify(address, false);
+            if (m < n_demand) {
+                stats.merges++;
+            } else if (mshrs[m].ops == 1) {
+                monitor->prefetch[id].useful++;
+                monitor->prefetch[id].late++;
+                train(block, true, false);
+            }
+            return ISSUE_MISS;
+        }
+        if (mshrs[m].block == no_block && free < 0 && m < n_demand) {
+            free = m;
+        }
+    }
+    int slot = sets.find(block);
+    if (slot >= 0 && !(write && (sets.state(slot) == SHARED || sets.state(slot) == SHARED_MODIFIED))) {
+        start(0, address, write, used); // a hit that needs no transaction
+        if (prefetcher.enabled()) {
+            train(block, used, false);
+        }
+        return ISSUE_HIT;
+    }
+    if (free < 0) {
+        return ISSUE_NO_MSHR;
+    }
+    Mshr& entry = mshrs[free];
+    entry.block = block;
+    entry.ops = 1;
+    entry.exclusive = write;
+    entry.allocated = *global_cycle;
+    stats.allocations++;
+    stats.peak = std::max(stats.peak, ++mshrs_busy);
+    start(free, address, write, used);
+    if (prefetcher.enabled()) {
+        train(block, slot < 0 || used, slot < 0);
+    }
+    return ISSUE_MISS;
+}
+
+// Shows a demand access to the prefetcher and prefetches the blocks it names
+// that are neither held nor being fetched. trigger: the access missed or
+// used a prefetched block for the first time.
+inline void LRU_Cache::train(uint64_t block, bool trigger, bool miss) {
+    candidates.clear();
+    prefetcher.observe(block, trigger, miss, candidates);
+    for (uint64_t candidate : candidates) {
+        if (candidate <= UINT64_MAX / block_size && sets.find(candidate) < 0 && pending_mshr(candidate) < 0) {
+            prefetch(candidate);
+        }
+    }
+}
+
+// Allocates a line for the block and queues its fill in a free prefetch
+// MSHR; without one the prefetch is dropped.
+inline bool LRU_Cache::prefetch(uint64_t block) {
+    int m = n_demand;
+    while (m < int(mshrs.size()) && mshrs[m].block != no_block) {
+        m++;
+    }
+    Prefetch_Stats& stats = monitor->prefetch[id];
+    if (m == int(mshrs.size())) {
+        stats.dropped++;
+        return false;
+    }
+    Mshr& entry = mshrs[m];
+    entry.block = block;
+    entry.allocated = *global_cycle;
+    uint64_t address = block * block_size;
+    auto result = sets.access(address, false);
+    forget(result.slot);
+    if (result.evicted) {
+        dropped(result.victim);
+        if (result.evicted_dirty) {
+            write_back(m, result.victim * block_size, false);
+        }
+    }
+    enqueue(m, BUS_RD, address);
+    stats.issued++;
+    stats.bus_bytes += block_size;
+    return true;
+}
+
+// A prefetch's transactions are done. Its block counts as unused until a
+// load/store hits it, unless one merged already; a store merged into it in
+// a blocking cache is performed first. A non-blocking core is woken either
+// way, as a store of it may be waiting for the fill.
+inline void LRU_Cache::finish_prefetch(int mshr) {
+    Mshr& entry = mshrs[mshr];
+    if (entry.deferred_write) {
+        entry.deferred_write = false;
+        if (deferred_store(mshr)) {
+            return;
+        }
+    }
+    int slot = sets.find(entry.block);
+    if (!entry.ops && slot >= 0) {
+        prefetched[slot] = 1;
+    }
+    int ops = entry.ops;
+    entry = Mshr();
+    if (ops || non_blocking) {
+        core->finish_io(ops);
+    }
+}
+
+// The store that waited for a prefetch, on the bus's side: done at once
+// with ownership, else queued behind nothing in the same MSHR as an upgrade
+// or, if the block was lost again, a write miss. Returns whether it needs
+// the bus.
+inline bool LRU_Cache::deferred_store(int mshr) {
+    Mshr& entry = mshrs[mshr];
+    uint64_t address = entry.deferred_address;
+    int slot = sets.find(address / block_size);
+    if (slot >= 0) {
+        sets.access(address, true);
+        uint8_t& state = sets.state(slot);
+        if (state == EXCLUSIVE || state == MODIFIED) {
+            state = MODIFIED;
+            return false;
+        }
+        entry.pending[0] = {protocol == MESI ? BUS_UPGR : BUS_UPD, address, false};
+    } else {
+        entry.pending[0] = {protocol == MESI ? BUS_RDX : BUS_RD, address, true};
+    }
+    entry.n_pending = 1;
+    bus->request(this, mshr);
+    return true;
+}
+
+// Functional counterpart of access() for sampled simulation: same contents,
+// states and hit/miss counts, with coherence applied through Bus::warm.
+inline bool LRU_Cache::warm(uint64_t address, bool write) {
+    auto result = sets.access(address, write);
+    if (result.evicted) {
+        bus->evicted(id, result.victim);
+        if (result.evicted_dirty) {
+            bus->warm(this, FLUSH, result.victim * block_size, false);
+        }
+    }
+    classify(address, !result.hit);
+    if (result.hit) {
+        monitor->hit_miss_cnt[id].first++;
+        uint8_t& state = sets.state(result.slot);
+        if (write && state == EXCLUSIVE) {
+            state = MODIFIED;
+        } else if (write && (state == SHARED || state == SHARED_MODIFIED)) {
+            bus->warm(this, protocol == MESI ? BUS_UPGR : BUS_UPD, address, false);
+        }
+    } else {
+        monitor->hit_miss_cnt[id].second++;
+        bus->warm(this, protocol == MESI && write ? BUS_RDX : BUS_RD, address, write);
+    }
+    return result.hit;
+}
+
+// count more warm() hits of the block warmed last; false, doing nothing, if
+// they are not all hits needing no transaction
+inline bool LRU_Cache::warm_repeat(uint64_t address, bool write, int64_t count) {
+    int slot = sets.find(address / block_size);
+    if (slot < 0) {
+        return false;
+    }
+    uint8_t state = sets.state(slot);
+    if (write && state != EXCLUSIVE && state != MODIFIED) {
+        return false;
+    }
+    sets.repeat_hits(slot, count, write);
+    monitor->hit_miss_cnt[id].first += count;
+    return true;
+}
+
+// Puts back a block this cache lost while its transaction was queued: to an
+// invalidation, so an upgrade proceeds as a BusRdX, or to its own later miss
+// in the same set (non-blocking caches).
+inline void LRU_Cache::refetch(int mshr, uint64_t address, bool write) {
+    auto result = sets.access(address, write);
+    forget(result.slot);
+    if (result.evicted) {
+        bus->evicted(id, result.victim);
+        if (result.evicted_dirty) {
+            write_back(mshr, result.victim * block_size, true);
+        }
+    }
+}
+
+// Reacts to another cache's transaction on a block this cache holds.
+inline void LRU_Cache::snoop(uint64_t block, int type) {
+    int slot = sets.find(block);
+    if (slot < 0) {
+        return; // relaxed parallel mode: already dropped, the eviction is in flight
+    }
+    uint8_t& state = sets.state(slot);
+    if (type == BUS_RDX || type == BUS_UPGR) {
+        sets.invalidate(slot);
+        if (!monitor->miss_classes.empty()) {
+            monitor->miss_classes[id].invalidated(block);
+        }
+    } else if (type == BUS_RD) {
+        if (state == EXCLUSIVE) {
+            state = SHARED;
+        } else if (state == MODIFIED) {
+            // MESI flushes to memory along with the transfer; a Dragon owner keeps the dirty copy
+            if (protocol == MESI) {
+                state = SHARED;
+                sets.set_dirty(slot, false);
+            } else {
+                state = SHARED_MODIFIED;
+            }
+        }
+    } else if (type == BUS_UPD && state == SHARED_MODIFIED) {
+        // ownership moves to the writer
+        state = SHARED;
+        sets.set_dirty(slot, false);
+    }
+}
+
+inline void LRU_Cache::notify_finish_io(int mshr) {
+    Mshr& entry = mshrs[mshr];
+    entry.n_pending--; 
+    for (int i = 0; i < entry.n_pending; i++) {
+        entry.pending[i] = entry.pending[i + 1];
+    }
+    if (entry.n_pending) {
+        bus->request(this, mshr, speculative(mshr));
+    } else if (mshr >= n_demand) {
+        finish_prefetch(mshr);
+    } else if (!non_blocking) {
+        core->finish_io();
+    } else {
+        int ops = entry.ops;
+        monitor->mshr[id].busy_cycles += *global_cycle - entry.allocated;
+        entry = Mshr();
+        mshrs_busy--;
+        core->finish_io(ops);
+    }
+}
+
+// The record a program hands the models (this one, and L1Cache in
+// SimpleCache.h): a load, store, compute or reduced-trace record, as in
+// trace files.
+using Access = Trace_Record;
+
+// Timing model for programs that produce their accesses themselves rather
+// than trace files. Records are given per core, in batches of any size; they
+// are copied, so the caller may reuse its buffer. Each call runs the
+// simulation as far as the records given so far decide it, i.e. until some
+// core needs one it has not been given; feeding the cores in turn keeps
+// about a batch per core held. The results are those of CacheSimulator on
+// the same records as trace files.
+// It runs the serial engine: threads, sampling, checkpoints and the time
+// series are the command line's and are switched off. A configuration that
+// fails check_config leaves the model unusable: valid() is false, error()
+// says why and access() refuses every record.
+class Timing_Model {
+private:
+    std::string error_message;
+    bool usable;
+    Operating_System system;
+    int n_cores;
+    int block_size;
+    bool sharing_report;
+    bool finished = false;
+
+    static Config fed(Config config) {
+        config.input_file.clear();
+        config.threads = 1;
+        config.checkpoint_every = 0;
+        config.sample_period = 0;
+        config.series_every = 0;
+        return config;
+    }
+public:
+    // an invalid configuration builds a default one-core system instead
+    Timing_Model(const Config& config, int n_cores)
+        : usable(check_config(fed(config), n_cores, error_message)),
+          system(fed(usable ? config : Config()), usable ? n_cores : 1), n_cores(usable ? n_cores : 0),
+          block_size(config.block_size), sharing_report(config.sharing_report) {}
+
+    bool valid() const {
+        return usable;
+    }
+
+    // Adds n records to the end of core's and runs. Returns false, adding
+    // nothing, with an invalid configuration, for a core out of range,
+    // after finish(), or at a record of an unknown type, reduced for a block
+    // size this one is not a multiple of, or reduced at all with the sharing
+    // report.
+    bool access(int core, const Access* records, size_t n) {
+        if (!usable) {
+            return false;
+        }
+        if (core < 0 || core >= n_cores || finished) {
+            error_message = finished ? "access after finish" : "no core " + std::to_string(core);
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (records[i].type > reduced_record) {
+                error_message = "unknown record type " + std::to_string(records[i].type);
+                return false;
+            }
+            if ((records[i].type == repeat_record || records[i].type == reduced_record) && sharing_report) {
+                error_message = "the sharing report needs unreduced records";
+                return false;
+            }
+            if (records[i].type == reduced_record) {
+                std::string error = reduction_error(records[i].value, block_size);
+                if (!error.empty()) {
+                    error_message = error;
+                    return false;
+                }
+            }
+        }
+        // markers are checked here, so the cores only see the records between them
+        size_t from = 0;
+        for (size_t i = 0; i <= n; i++) {
+            if (i == n || records[i].type == reduced_record) {
+                system.feed(core, records + from, i - from);
+                from = i + 1;
+            }
+        }
+        system.advance();
+        return true;
+    }
+
+    // Ends every core's records and runs the simulation to the end.
+    const Monitor& finish() {
+        if (!finished) {
+            system.end_feeds();
+            system.advance();
+            finished = true;
+        }
+        return system.statistics();
+    }
+
+    // Statistics so far; overall_cyc and the sharing summary are set by finish().
+    const Monitor& stats() const {
+        return system.statistics();
+    }
+    const std::string& error() const {
+        return error_message;
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Binary checkpoint streams. A class with state to save has one
+//     template <class Archive> void checkpoint(Archive& archive)
+// that hands every member to archive.io(), so the same function writes the
+// state (Checkpoint_Writer) and reads it back (Checkpoint_Reader).
+// Values are stored raw in host byte order: a checkpoint is resumed by the
+// build that wrote it.
+const char checkpoint_magic[8] = {'C', 'S', 'C', 'K', 'P', 'T', '\0', '\0'};
+const uint32_t checkpoint_version = 15;
+
+class Checkpoint_Writer {
+private:
+    FILE* out;
+    bool ok = true;
+public:
+    static constexpr bool saving = true;
+
+    explicit Checkpoint_Writer(FILE* out): out(out) {}
+    template <typename T>
+    void io(T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw values only");
+        ok = ok && std::fwrite(&value, sizeof(T), 1, out) == 1;
+    }
+    template <typename T>
+    void io(std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw values only");
+        uint64_t n = values.size();
+        io(n);
+        ok = ok && (n == 0 || std::fwrite(values.data(), sizeof(T), n, out) == n);
+    }
+    void io(std::string& text) {
+        uint64_t n = text.size();
+        io(n);
+        ok = ok && std::fwrite(text.data(), 1, n, out) == n;
+    }
+    void fail() {
+        ok = false;
+    }
+    bool good() const {
+        return ok;
+    }
+};
+
+class Checkpoint_Reader {
+private:
+    FILE* in;
+    bool ok = true;
+
+    // guards against resizing to a garbage length from a damaged file
+    bool length(uint64_t& n, size_t item_size) {
+        io(n);
+        ok = ok && n <= (uint64_t(1) << 34) / item_size;
+        return ok;
+    }
+public:
+    static constexpr bool saving = false;
+
+    explicit Checkpoint_Reader(FILE* in): in(in) {}
+    template <typename T>
+    void io(T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw values only");
+        ok = ok && std::fread(&value, sizeof(T), 1, in) == 1;
+    }
+    template <typename T>
+    void io(std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable<T>::value, "raw values only");
+        uint64_t n = 0;
+        if (!length(n, sizeof(T))) {
+            return;
+        }
+        values.resize(n);
+        ok = n == 0 || std::fread(values.data(), sizeof(T), n, in) == n;
+    }
+    void io(std::string& text) {
+        uint64_t n = 0;
+        if (!length(n, 1)) {
+            return;
+        }
+        text.resize(n);
+        ok = std::fread(&text[0], 1, n, in) == n;
+    }
+    void fail() {
+        ok = false;
+    }
+    bool good() const {
+        return ok;
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Main memory as independent banks with one open row each. An access to the
+// open row of its bank takes row_hit cycles, any other row_miss (precharge,
+// activate, read); the row stays open afterwards. A bank serves one access
+// at a time, so an access to a busy bank starts when the previous one ends.
+// Consecutive row-sized chunks of the address space go to consecutive banks,
+// or consecutive blocks with block interleaving, which spreads a stream over
+// the banks at the cost of row-buffer locality.
+struct Dram_Config {
+    int banks = 0; // 0 = every access takes the flat memory latency
+    int row_hit = 40;
+    int row_miss = 100;
+    int row_size = 2048; // bytes per row of one bank
+    bool block_interleave = false;
+};
+
+inline bool operator==(const Dram_Config& a, const Dram_Config& b) {
+    return a.banks == b.banks && a.row_hit == b.row_hit && a.row_miss == b.row_miss && a.row_size == b.row_size &&
+           a.block_interleave == b.block_interleave;
+}
+inline bool operator!=(const Dram_Config& a, const Dram_Config& b) {
+    return !(a == b);
+}
+
+// "<banks>:<row hit>:<row miss>[:<row size>[:row|block]]"
+inline bool parse_dram(const std::string& spec, Dram_Config& dram) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t colon = spec.find(':', start);
+        fields.push_back(spec.substr(start, colon - start));
+        if (colon == std::string::npos) {
+            break;
+        }
+        start = colon + 1;
+    }
+    if (fields.size() < 3 || fields.size() > 5) {
+        return false;
+    }
+    try {
+        dram.banks = std::stoi(fields[0]);
+        dram.row_hit = std::stoi(fields[1]);
+        dram.row_miss = std::stoi(fields[2]);
+        if (fields.size() >= 4) {
+            dram.row_size = std::stoi(fields[3]);
+        }
+    } catch (...) {
+        return false;
+    }
+    if (fields.size() == 5) {
+        if (fields[4] != "row" && fields[4] != "block") {
+            return false;
+        }
+        dram.block_interleave = fields[4] == "block";
+    }
+    return dram.banks > 0 && dram.banks <= 1024 && dram.row_hit > 0 && dram.row_miss >= dram.row_hit && dram.row_size > 0;
+}
+
+struct Dram_Stats {
+    int64_t row_hits = 0;
+    int64_t row_misses = 0;
+    int64_t bank_wait_cycles = 0; // cycles accesses waited for a busy bank
+};
+
+class Dram {
+public:
+    Dram(const Dram_Config& config, uint32_t block_size, Dram_Stats* stats)
+        : config(config), block_size(block_size), stats(stats) {
+        open_row = std::vector<uint64_t>(std::max(config.banks, 0), no_row);
+        ready = std::vector<int64_t>(std::max(config.banks, 0), 0);
+    }
+
+    bool enabled() const {
+        return config.banks > 0;
+    }
+
+    // Reads or writes a block starting at `cycle`; returns the cycle the
+    // access ends. An untimed access (functional warming) only opens the row
+    // and counts nothing.
+    int64_t access(uint64_t block, int64_t cycle, bool timed) {
+        uint64_t address = block * block_size;
+        uint64_t unit = config.block_interleave ? block_size : uint64_t(config.row_size);
+        size_t bank = size_t(address / unit % config.banks);
+        uint64_t row = address / (uint64_t(config.row_size) * config.banks);
+        bool hit = open_row[bank] == row;
+        open_row[bank] = row;
+        if (!timed) {
+            return cycle;
+        }
+        int64_t start = std::max(cycle, ready[bank]);
+        stats->bank_wait_cycles += start - cycle;
+        if (hit) {
+            stats->row_hits++;
+        } else {
+            stats->row_misses++;
+        }
+        ready[bank] = start + (hit ? config.row_hit : config.row_miss);
+        return ready[bank];
+    }
+
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        size_t banks = open_row.size();
+        archive.io(open_row);
+        archive.io(ready);
+        if (open_row.size() != banks || ready.size() != banks) {
+            archive.fail();
+        }
+    }
+
+private:
+    static constexpr uint64_t no_row = UINT64_MAX;
+    Dram_Config config;
+    uint32_t block_size;
+    Dram_Stats* stats;
+    std::vector<uint64_t> open_row; // by bank
+    std::vector<int64_t> ready;     // cycle each bank is free again
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "SetAssociative.h"
+
+// Shared cache levels below the private L1s (L2, then LLC, ...). They are
+// only consulted when an L1 miss is not served by another L1, and for
+// write-backs, so an L1 hit never reaches this code.
+//
+// Each level's inclusion policy is relative to the levels above it:
+//   INCLUSIVE  holds everything above it; its victims are back-invalidated
+//              from the upper levels and the L1s
+//   EXCLUSIVE  a victim cache: filled only by blocks evicted from above,
+//              and a hit moves the block up
+//   NINE       neither: filled on misses, victims are just dropped
+// Dirty victims are written to the next level, or to memory past the last.
+// A level's latency is the whole cost of an access served by it, in place
+// of the memory access; write-backs take the first level's latency, and
+// evictions below the first level are absorbed by a write buffer.
+enum class Inclusion { INCLUSIVE, EXCLUSIVE, NINE };
+
+inline const char* inclusion_name(Inclusion inclusion) {
+    static const char* const names[] = {"inclusive", "exclusive", "nine"};
+    return names[int(inclusion)];
+}
+
+struct Level_Config {
+    int cache_size;
+    int associativity;
+    int latency;
+    Inclusion inclusion;
+};
+
+inline bool operator==(const Level_Config& a, const Level_Config& b) {
+    return a.cache_size == b.cache_size && a.associativity == b.associativity && a.latency == b.latency && a.inclusion == b.inclusion;
+}
+inline bool operator!=(const Level_Config& a, const Level_Config& b) {
+    return !(a == b);
+}
+
+// "<size>:<associativity>:<latency>[:inclusive|exclusive|nine]", NINE by default
+inline bool parse_level(const std::string& spec, Level_Config& level) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t colon = spec.find(':', start);
+        fields.push_back(spec.substr(start, colon - start));
+        if (colon == std::string::npos) {
+            break;
+        }
+        start = colon + 1;
+    }
+    if (fields.size() < 3 || fields.size() > 4) {
+        return false;
+    }
+    try {
+        level.cache_size = std::stoi(fields[0]);
+        level.associativity = std::stoi(fields[1]);
+        level.latency = std::stoi(fields[2]);
+    } catch (...) {
+        return false;
+    }
+    level.inclusion = Inclusion::NINE;
+    if (fields.size() == 4) {
+        int i = 0;
+        while (i < 3 && fields[3] != inclusion_name(Inclusion(i))) {
+            i++;
+        }
+        if (i == 3) {
+            return false;
+        }
+        level.inclusion = Inclusion(i);
+    }
+    return level.cache_size > 0 && level.associativity > 0 && level.latency > 0;
+}
+
+struct Level_Stats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t writebacks = 0;         // dirty victims sent to the next level or memory
+    int64_t back_invalidations = 0; // blocks removed above to keep inclusion
+};
+
+class Lower_Levels {
+public:
+    // memory accesses a block in main memory and returns the cycles it takes;
+    // invalidate_l1s drops a block from every L1, returns whether any held
+    // it and sets its second argument if one held it dirty
+    Lower_Levels(const std::vector<Level_Config>& configs, uint32_t block_size, std::function<int(uint64_t)> memory,
+                 std::vector<Level_Stats>* stats, std::function<bool(uint64_t, bool&)> invalidate_l1s)
+        : configs(configs), block_size(block_size), memory(memory), stats(stats), invalidate_l1s(invalidate_l1s) {
+        for (const Level_Config& config : configs) {
+            uint32_t sets = std::max(1, config.cache_size / (config.associativity * int(block_size)));
+            levels.emplace_back(sets, config.associativity, block_size);
+        }
+        stats->assign(configs.size(), Level_Stats());
+    }
+
+    bool empty() const {
+        return levels.empty();
+    }
+
+    // Fetches a block none of the L1s holds; returns the cycles it takes.
+    // dirty is set when the block leaves an exclusive level dirty with no
+    // level above to keep it, so the requesting L1 must take it dirty.
+    int read(uint64_t block, bool& dirty) {
+        int latency = 0;
+        size_t found = levels.size();
+        bool promoted_dirty = false;
+        for (size_t k = 0; k < levels.size(); k++) {
+            int slot = levels[k].find(block);
+            if (slot >= 0) {
+                (*stats)[k].hits++;
+                found = k;
+                latency = configs[k].latency;
+                if (configs[k].inclusion == Inclusion::EXCLUSIVE) {
+                    promoted_dirty = levels[k].is_dirty(slot);
+                    levels[k].invalidate(slot);
+                } else {
+                    levels[k].access(block * block_size, false);
+                }
+                break;
+            }
+            (*stats)[k].misses++;
+        }
+        if (found == levels.size()) {
+            latency = memory(block);
+        }
+        // fill the non-exclusive levels the block missed in, bottom up
+        for (size_t k = found; k-- > 0;) {
+            if (configs[k].inclusion != Inclusion::EXCLUSIVE) {
+                fill(k, block, false);
+            }
+        }
+        // dirty data leaving an exclusive level stays dirty in the nearest
+        // level above that now holds it, else in the L1
+        dirty = promoted_dirty && !mark_dirty_above(block, found);
+        return latency;
+    }
+
+    // An L1 evicted a block: dirty ones are written back, clean ones are
+    // offered to an exclusive first level. Returns the cycles a dirty
+    // write-back occupies the bus.
+    int write_back(uint64_t block, bool dirty) {
+        if (levels.empty()) {
+            return memory(block);
+        }
+        if (dirty || configs[0].inclusion == Inclusion::EXCLUSIVE) {
+            fill(0, block, dirty);
+        }
+        return configs[0].latency;
+    }
+
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        for (Set_Assoc_Cache& level : levels) {
+            level.checkpoint(archive);
+        }
+    }
+
+private:
+    std::vector<Level_Config> configs;
+    std::vector<Set_Assoc_Cache> levels;
+    uint32_t block_size;
+    std::function<int(uint64_t)> memory;
+    std::vector<Level_Stats>* stats;
+    std::function<bool(uint64_t, bool&)> invalidate_l1s;
+
+    bool mark_dirty_above(uint64_t block, size_t k) {
+        for (size_t j = k; j-- > 0;) {
+            int slot = levels[j].find(block);
+            if (slot >= 0) {
+                levels[j].set_dirty(slot, true);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Puts a block into level k (or updates it there) and deals with the victim.
+    void fill(size_t k, uint64_t block, bool dirty) {
+        Set_Assoc_Cache::Result result = levels[k].access(block * block_size, dirty);
+        if (!result.evicted) {
+            return;
+        }
+        uint64_t victim = result.victim;
+        bool victim_dirty = result.evicted_dirty;
+        if (configs[k].inclusion == Inclusion::INCLUSIVE) {
+            bool held = false;
+            for (size_t j = 0; j < k; j++) {
+                int slot = levels[j].find(victim);
+                if (slot >= 0) {
+                    held = true;
+                    victim_dirty = victim_dirty || levels[j].is_dirty(slot);
+                    levels[j].invalidate(slot);
+                }
+            }
+            bool l1_dirty = false;
+            held = invalidate_l1s(victim, l1_dirty) || held;
+            victim_dirty = victim_dirty || l1_dirty;
+            (*stats)[k].back_invalidations += held;
+        }
+        if (k + 1 < levels.size() && (victim_dirty || configs[k + 1].inclusion == Inclusion::EXCLUSIVE)) {
+            if (victim_dirty) {
+                (*stats)[k].writebacks++;
+            }
+            fill(k + 1, victim, victim_dirty);
+        } else if (victim_dirty) {
+            (*stats)[k].writebacks++;
+        }
+    }
+};
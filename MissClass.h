@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "BlockTable.h"
+
+// Three-C classification of a cache's misses. Next to the cache run a
+// first-touch set of every block it was asked for and a shadow: a fully
+// associative LRU cache of as many blocks. A miss is
+//   compulsory  on the block's first access
+//   capacity    if the shadow missed too, so no placement would have kept it
+//   conflict    if the shadow hit, so only the set mapping lost the block
+//   coherence   (timing model) if the shadow hit but another core's write
+//               invalidated the block since this cache last used it
+// Misses per set, and conflict misses among them, point at the hot sets.
+enum class Miss_Class { HIT, COMPULSORY, CAPACITY, CONFLICT, COHERENCE };
+
+struct Miss_Counts {
+    int64_t compulsory = 0;
+    int64_t capacity = 0;
+    int64_t conflict = 0;
+    int64_t coherence = 0;
+
+    void count(Miss_Class kind) {
+        switch (kind) {
+            case Miss_Class::COMPULSORY: compulsory++; break;
+            case Miss_Class::CAPACITY: capacity++; break;
+            case Miss_Class::CONFLICT: conflict++; break;
+            case Miss_Class::COHERENCE: coherence++; break;
+            default: break;
+        }
+    }
+    void add(const Miss_Counts& other) {
+        compulsory += other.compulsory;
+        capacity += other.capacity;
+        conflict += other.conflict;
+        coherence += other.coherence;
+    }
+    int64_t total() const {
+        return compulsory + capacity + conflict + coherence;
+    }
+};
+
+struct Set_Misses {
+    int64_t misses = 0;
+    int64_t conflicts = 0;
+};
+
+// The sets with the most misses, most first, ties to the lower set; sets
+// without misses are left out.
+inline std::vector<uint32_t> hot_sets(const Set_Misses* sets, uint32_t n_sets, size_t top) {
+    std::vector<uint32_t> order;
+    for (uint32_t set = 0; set < n_sets; set++) {
+        if (sets[set].misses) {
+            order.push_back(set);
+        }
+    }
+    size_t keep = std::min(top, order.size());
+    std::partial_sort(order.begin(), order.begin() + keep, order.end(), [&](uint32_t a, uint32_t b) {
+        return sets[a].misses != sets[b].misses ? sets[a].misses > sets[b].misses : a < b;
+    });
+    order.resize(keep);
+    return order;
+}
+
+// One bit per block ever accessed, in pages of 32768 blocks: a footprint of
+// n blocks takes about n / 8 bytes, rounded up to 4KB per page touched. The
+// pages are found through a small direct-mapped table of the recent ones in
+// front of a Block_Table of all of them.
+class First_Touch {
+private:
+    static constexpr unsigned page_shift = 15;
+    static constexpr size_t page_words = (size_t(1) << page_shift) / 64;
+    static constexpr size_t recent_pages = 64;
+    struct Recent {
+        uint64_t page = UINT64_MAX;
+        size_t offset = 0; // of its first word in bits
+    };
+    Block_Table<uint32_t> pages; // page + 1 in bits, 0 before the first touch
+    std::vector<uint64_t> bits;
+    Recent recent[recent_pages];
+
+    size_t offset_of(uint64_t page) {
+        Recent& entry = recent[page & (recent_pages - 1)];
+        if (entry.page != page) {
+            uint32_t& slot = pages[page];
+            if (slot == 0) {
+                bits.resize(bits.size() + page_words);
+                slot = uint32_t(bits.size() / page_words);
+            }
+            entry.page = page;
+            entry.offset = (slot - 1) * page_words;
+        }
+        return entry.offset;
+    }
+public:
+    // whether this is the block's first access
+    bool insert(uint64_t block) {
+        uint64_t& word = bits[offset_of(block >> page_shift) + (block >> 6 & (page_words - 1))];
+        uint64_t bit = uint64_t(1) << (block & 63);
+        bool first = !(word & bit);
+        word |= bit;
+        return first;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        pages.checkpoint(archive);
+        archive.io(bits);
+        std::fill(recent, recent + recent_pages, Recent());
+        if (bits.size() != pages.size() * page_words) {
+            archive.fail();
+        }
+    }
+};
+
+// Fully associative LRU caches of several capacities over one access stream,
+// in one structure: the stack of blocks by last use, where a block is in a
+// cache of c lines while fewer than c others were used since. Every access
+// takes the next time slot and frees the block's previous one; a capacity's
+// tail is its oldest slot still held, so the level an access is found at
+// (the smallest capacity holding the block) is a walk down the tails, and
+// what a capacity drops moves its tail past the freed slots. Slots run in a
+// ring of four times the largest capacity, compacted when it fills. The
+// index from block to its last slot keeps only the slot, the block being
+// that slot's owner; it is rebuilt from the held slots at each compaction,
+// so nothing is ever deleted from it, and memory follows the capacities, not
+// the footprint. Every step is amortized constant per capacity.
+class Shadow_Stack {
+private:
+    static constexpr uint8_t held = 1, invalidated_mark = 2;
+    struct Capacity {
+        uint32_t lines;
+        uint32_t tail;  // oldest slot it may hold
+        uint32_t count; // slots held from the tail on
+    };
+    struct Slot {
+        uint64_t owner = 0; // block
+        uint64_t state = 0; // held, and invalidated since its last use; a word, so no padding
+    };
+    std::vector<Capacity> capacities; // ascending
+    std::vector<Slot> slots;
+    uint32_t now = 0;                 // next slot
+    std::vector<uint32_t> index;      // slot + 1, 0 if empty; four times the slots
+
+    size_t home(uint64_t block) const {
+        uint64_t hash = block * 0x9E3779B97F4A7C15ull;
+        return size_t(hash ^ hash >> 32) & (index.size() - 1);
+    }
+    // the block's entry, or the empty one it would take
+    uint32_t& find(uint64_t block) {
+        size_t mask = index.size() - 1;
+        size_t i = home(block);
+        while (index[i] != 0 && slots[index[i] - 1].owner != block) {
+            i = (i + 1) & mask;
+        }
+        return index[i];
+    }
+    // moves the held slots to the front, in order
+    void compact() {
+        std::fill(index.begin(), index.end(), 0);
+        uint32_t to = 0;
+        for (uint32_t from = capacities.back().tail; from < now; from++) {
+            if (slots[from].state & held) {
+                slots[to] = slots[from];
+                find(slots[to].owner) = to + 1;
+                to++;
+            }
+        }
+        std::fill(slots.begin() + to, slots.begin() + now, Slot());
+        now = to;
+        for (Capacity& capacity : capacities) {
+            capacity.tail = now - capacity.count;
+        }
+    }
+public:
+    // lines: ascending
+    explicit Shadow_Stack(const std::vector<uint32_t>& lines) {
+        for (uint32_t n : lines) {
+            capacities.push_back({n, 0, 0});
+        }
+        size_t n = 64;
+        while (n < 4 * size_t(lines.back())) {
+            n *= 2;
+        }
+        slots.resize(n);
+        index.resize(4 * n);
+    }
+    size_t levels() const {
+        return capacities.size();
+    }
+
+    // Uses the block. Returns the index of the smallest capacity that held
+    // it, levels() if none did; invalidated: whether invalidate() marked it
+    // since its last use.
+    uint32_t access(uint64_t block, bool& invalidated) {
+        if (now > 0 && slots[now - 1].owner == block) {
+            // the last block used stays on top
+            invalidated = (slots[now - 1].state & invalidated_mark) != 0;
+            slots[now - 1].state = held;
+            return 0;
+        }
+        if (now == slots.size()) {
+            compact();
+        }
+        uint32_t& entry = find(block);
+        uint32_t level = uint32_t(capacities.size());
+        invalidated = false;
+        if (entry != 0 && (slots[entry - 1].state & held)) {
+            uint32_t last = entry - 1;
+            invalidated = (slots[last].state & invalidated_mark) != 0;
+            slots[last].state = 0;
+            level = 0;
+            while (last < capacities[level].tail) {
+                level++;
+            }
+        }
+        entry = now + 1;
+        slots[now].owner = block;
+        slots[now].state = held;
+        now++;
+        // the capacities that held the block keep their count; the others
+        // take it and drop their least recently used block
+        for (uint32_t k = 0; k < level; k++) {
+            Capacity& capacity = capacities[k];
+            if (capacity.count < capacity.lines) {
+                capacity.count++;
+                continue;
+            }
+            while (!(slots[capacity.tail].state & held)) {
+                capacity.tail++;
+            }
+            if (k + 1 == capacities.size()) {
+                slots[capacity.tail].state = 0;
+            }
+            capacity.tail++;
+        }
+        return level;
+    }
+    // marks the block, if held, as taken by another core's write
+    void invalidate(uint64_t block) {
+        uint32_t entry = find(block);
+        if (entry != 0 && (slots[entry - 1].state & held)) {
+            slots[entry - 1].state |= invalidated_mark;
+        }
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        size_t levels = capacities.size(), n = slots.size();
+        archive.io(capacities);
+        archive.io(slots);
+        archive.io(now);
+        archive.io(index);
+        if (capacities.size() != levels || slots.size() != n || index.size() != 4 * n || now > n) {
+            archive.fail();
+        }
+    }
+};
+
+// What the shadow and the first-touch set knew of an access, the class of a
+// miss there.
+enum class Shadow_Hint: uint8_t { HELD, INVALIDATED, EVICTED, FIRST };
+
+inline Miss_Class miss_class(Shadow_Hint hint) {
+    switch (hint) {
+        case Shadow_Hint::HELD: return Miss_Class::CONFLICT;
+        case Shadow_Hint::INVALIDATED: return Miss_Class::COHERENCE;
+        case Shadow_Hint::EVICTED: return Miss_Class::CAPACITY;
+        default: return Miss_Class::COMPULSORY;
+    }
+}
+
+// One cache's classifier: a shadow of as many lines and the first-touch set,
+// which is only asked when the shadow did not hold the block.
+class Miss_Classifier {
+private:
+    Shadow_Stack shadow;
+    First_Touch seen;
+    Miss_Counts totals;
+    std::vector<Set_Misses> by_set;
+public:
+    // lines, sets: of the cache being classified; lines is the shadow's capacity
+    Miss_Classifier(uint32_t lines, uint32_t sets): shadow({std::max(1u, lines)}), by_set(sets) {}
+
+    // Takes a load/store to the block, returning what its miss would be
+    // classed by; hint() and count() split access() for callers that learn
+    // of the miss elsewhere.
+    Shadow_Hint hint(uint64_t block) {
+        bool invalidated;
+        if (shadow.access(block, invalidated) == 0) {
+            return invalidated ? Shadow_Hint::INVALIDATED : Shadow_Hint::HELD;
+        }
+        return seen.insert(block) ? Shadow_Hint::FIRST : Shadow_Hint::EVICTED;
+    }
+    void count(uint32_t set, Shadow_Hint hint) {
+        Miss_Class kind = miss_class(hint);
+        totals.count(kind);
+        by_set[set].misses++;
+        by_set[set].conflicts += kind == Miss_Class::CONFLICT;
+    }
+    // Every load/store to the block, in order; miss: whether the cache missed.
+    void access(uint64_t block, uint32_t set, bool miss) {
+        Shadow_Hint kind = hint(block);
+        if (miss) {
+            count(set, kind);
+        }
+    }
+    // another core's write took the block from the cache
+    void invalidated(uint64_t block) {
+        shadow.invalidate(block);
+    }
+    const Miss_Counts& counts() const {
+        return totals;
+    }
+    const std::vector<Set_Misses>& set_misses() const {
+        return by_set;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        size_t sets = by_set.size();
+        shadow.checkpoint(archive);
+        seen.checkpoint(archive);
+        archive.io(totals);
+        archive.io(by_set);
+        if (by_set.size() != sets) {
+            archive.fail();
+        }
+    }
+};
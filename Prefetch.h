@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Hardware prefetchers of the private caches. They watch the demand
+// accesses and name blocks to fetch ahead; the cache drops the ones it holds
+// or is already fetching and issues the rest as ordinary reads over the bus.
+//   NEXT_LINE  on a miss, or the first use of a prefetched block, the
+//              `degree` blocks from `distance` blocks ahead
+//   STRIDE     a table of the last block and block delta per 4 KB region
+//              (no PCs in the traces); once a delta repeats twice, `degree`
+//              blocks along it from `distance` strides ahead
+//   STREAM     stream buffers: a miss outside every stream starts one (the
+//              least recently used of four is replaced) and each use of a
+//              block of the stream keeps it `distance` + `degree` - 1 blocks
+//              ahead. The blocks go into the cache rather than separate
+//              buffers, as coherence only tracks the caches' lines
+enum class Prefetcher { NONE, NEXT_LINE, STRIDE, STREAM };
+
+inline const char* prefetcher_name(Prefetcher kind) {
+    static const char* const names[] = {"none", "next-line", "stride", "stream"};
+    return names[int(kind)];
+}
+
+struct Prefetch_Config {
+    Prefetcher kind = Prefetcher::NONE;
+    int degree = 1;   // blocks named per trigger
+    int distance = 1; // how far ahead the first one is, in blocks or strides
+};
+
+inline bool operator==(const Prefetch_Config& a, const Prefetch_Config& b) {
+    return a.kind == b.kind && a.degree == b.degree && a.distance == b.distance;
+}
+inline bool operator!=(const Prefetch_Config& a, const Prefetch_Config& b) {
+    return !(a == b);
+}
+
+// Prefetches a cache may have in flight, each in an MSHR of its own.
+inline int prefetch_mshrs(const Prefetch_Config& config) {
+    return config.kind == Prefetcher::NONE ? 0 : 2 * config.degree;
+}
+
+// "none|next-line|stride|stream[:<degree>[:<distance>]]"
+inline bool parse_prefetch(const std::string& spec, Prefetch_Config& prefetch) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t colon = spec.find(':', start);
+        fields.push_back(spec.substr(start, colon - start));
+        if (colon == std::string::npos) {
+            break;
+        }
+        start = colon + 1;
+    }
+    if (fields.size() > 3) {
+        return false;
+    }
+    for (char& c : fields[0]) {
+        c = std::tolower(c);
+    }
+    int i = 0;
+    while (i <= int(Prefetcher::STREAM) && fields[0] != prefetcher_name(Prefetcher(i))) {
+        i++;
+    }
+    if (i > int(Prefetcher::STREAM)) {
+        return false;
+    }
+    prefetch.kind = Prefetcher(i);
+    try {
+        if (fields.size() >= 2) {
+            prefetch.degree = std::stoi(fields[1]);
+        }
+        if (fields.size() == 3) {
+            prefetch.distance = std::stoi(fields[2]);
+        }
+    } catch (...) {
+        return false;
+    }
+    return prefetch.degree >= 1 && prefetch.degree <= 16 && prefetch.distance >= 1 && prefetch.distance <= 64;
+}
+
+struct Prefetch_Stats {
+    int64_t issued = 0;    // fills sent over the bus
+    int64_t useful = 0;    // prefetched blocks a demand access used
+    int64_t late = 0;      // ... while their fill was still in flight
+    int64_t unused = 0;    // prefetched blocks replaced before any use
+    int64_t dropped = 0;   // blocks named with no prefetch MSHR free
+    int64_t bus_bytes = 0; // data the fills moved, on top of the demand traffic
+};
+
+class Prefetch_Engine {
+public:
+    Prefetch_Engine(const Prefetch_Config& config, uint32_t block_size): config(config) {
+        region_blocks = std::max<uint32_t>(1, 4096 / block_size);
+        if (config.kind == Prefetcher::STRIDE) {
+            table = std::vector<Stride_Entry>(table_size);
+        } else if (config.kind == Prefetcher::STREAM) {
+            streams = std::vector<Stream>(n_streams);
+        }
+    }
+
+    bool enabled() const {
+        return config.kind != Prefetcher::NONE;
+    }
+
+    // A demand access to `block`; trigger is set when it missed or was the
+    // first use of a prefetched block. Appends the blocks to prefetch to out.
+    void observe(uint64_t block, bool trigger, bool miss, std::vector<uint64_t>& out) {
+        switch (config.kind) {
+            case Prefetcher::NEXT_LINE:
+                if (trigger) {
+                    for (int i = 0; i < config.degree; i++) {
+                        push(block, config.distance + i, out);
+                    }
+                }
+                break;
+            case Prefetcher::STRIDE:
+                observe_stride(block, out);
+                break;
+            case Prefetcher::STREAM:
+                if (trigger) {
+                    observe_stream(block, miss, out);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        size_t entries = table.size();
+        size_t n = streams.size();
+        archive.io(table);
+        archive.io(streams);
+        archive.io(clock);
+        if (table.size() != entries || streams.size() != n) {
+            archive.fail();
+        }
+    }
+
+private:
+    static constexpr size_t table_size = 64;
+    static constexpr size_t n_streams = 4;
+    struct Stride_Entry {
+        uint64_t region = 0;
+        uint64_t last = 0;
+        int64_t stride = 0;
+        uint8_t confidence = 0;
+        bool valid = false;
+    };
+    struct Stream {
+        uint64_t head = 0; // next block the stream expects a use of
+        uint64_t next = 0; // next block to prefetch
+        uint64_t used = 0; // clock of the last use, for replacement
+        bool valid = false;
+    };
+
+    Prefetch_Config config;
+    uint32_t region_blocks;
+    std::vector<Stride_Entry> table;
+    std::vector<Stream> streams;
+    uint64_t clock = 0;
+
+    // names block + delta unless that leaves the address space; the last
+    // block number is never named, being the tag stores' empty marker
+    static void push(uint64_t block, int64_t delta, std::vector<uint64_t>& out) {
+        if (delta < 0 ? block >= uint64_t(0) - uint64_t(delta) : block < UINT64_MAX - uint64_t(delta)) {
+            out.push_back(block + uint64_t(delta));
+        }
+    }
+
+    void observe_stride(uint64_t block, std::vector<uint64_t>& out) {
+        uint64_t region = block / region_blocks;
+        Stride_Entry& entry = table[region % table_size];
+        if (!entry.valid || entry.region != region) {
+            entry = {region, block, 0, 0, true};
+            return;
+        }
+        int64_t delta = int64_t(block - entry.last);
+        if (delta == 0) {
+            return; // same block: nothing learnt
+        }
+        if (delta == entry.stride) {
+            entry.confidence = std::min(entry.confidence + 1, 3);
+        } else {
+            entry.stride = delta;
+            entry.confidence = 0;
+        }
+        entry.last = block;
+        if (entry.confidence >= 2) {
+            for (int i = 0; i < config.degree; i++) {
+                push(block, entry.stride * (config.distance + i), out);
+            }
+        }
+    }
+
+    void observe_stream(uint64_t block, bool miss, std::vector<uint64_t>& out) {
+        clock++;
+        uint64_t ahead = uint64_t(config.distance + config.degree);
+        Stream* stream = nullptr;
+        for (Stream& s : streams) {
+            if (s.valid && block >= s.head && block - s.head < ahead) {
+                stream = &s;
+                break;
+            }
+        }
+        if (!stream) {
+            if (!miss) {
+                return;
+            }
+            stream = &streams[0];
+            for (Stream& s : streams) {
+                if (!s.valid || s.used < stream->used) {
+                    stream = &s;
+                    if (!s.valid) {
+                        break;
+                    }
+                }
+            }
+            *stream = {block, block + uint64_t(config.distance), 0, true};
+        }
+        stream->head = block + 1;
+        stream->used = clock;
+        uint64_t last = block + uint64_t(config.distance + config.degree - 1);
+        while (stream->next <= last && stream->next != UINT64_MAX) {
+            push(stream->next, 0, out);
+            stream->next++;
+        }
+    }
+};
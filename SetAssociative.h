@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Replacement policies. Each one is a template argument of the access path,
+// so the choice costs one predictable branch per access and LRU runs the
+// same code as before policies existed.
+//   LRU        true least recently used
+//   TREE_PLRU  binary tree of ways - 1 direction bits per set (power-of-two
+//              associativity up to 64)
+//   BIT_PLRU   one MRU bit per way, cleared for the others when all are set
+//   FIFO       oldest fill, hits do not reorder
+//   RANDOM     xorshift64 with a fixed seed, so runs repeat exactly
+//   SRRIP      2-bit re-reference prediction, fills predicted far (2)
+//   BRRIP      as SRRIP, fills predicted distant (3) except every 32nd
+//   LFU        fewest hits since the fill, ties to the lowest way
+// Invalid ways are always filled first.
+enum class Replacement { LRU, TREE_PLRU, BIT_PLRU, FIFO, RANDOM, SRRIP, BRRIP, LFU };
+
+inline const char* replacement_name(Replacement policy) {
+    static const char* const names[] = {"lru", "tree-plru", "bit-plru", "fifo", "random", "srrip", "brrip", "lfu"};
+    return names[int(policy)];
+}
+
+inline bool parse_replacement(std::string name, Replacement& policy) {
+    for (char& c : name) {
+        c = std::tolower(c);
+    }
+    for (int i = 0; i <= int(Replacement::LFU); i++) {
+        if (name == replacement_name(Replacement(i))) {
+            policy = Replacement(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool replacement_supports(Replacement policy, uint32_t ways) {
+    return policy != Replacement::TREE_PLRU || (ways <= 64 && (ways & (ways - 1)) == 0);
+}
+
+// Set-associative tag store shared by both simulators. Every set is a
+// contiguous run of `ways` slots in flat arrays of block numbers, replacement
+// metadata, dirty bits and a spare state byte for coherence protocols, so an
+// access never allocates. The metadata is an LRU age (0 = most recently used,
+// ways - 1 = victim) for LRU and FIFO, the MRU bit, RRPV or use count for the
+// others; tree-PLRU keeps its bits per set.
+// Associativities 1, 2, 4, 8 and 16 get their own unrolled instantiation;
+// anything else uses the generic loop.
+class Set_Assoc_Cache {
+public:
+    struct Result {
+        bool hit;
+        bool evicted;       // a valid block was replaced
+        bool evicted_dirty; // ... and it had been written
+        uint64_t victim;    // block number of the replaced block
+        uint32_t slot;      // where the accessed block now lives
+    };
+
+    static constexpr uint64_t invalid = UINT64_MAX;
+
+    // policy must be supported at this associativity, see replacement_supports
+    Set_Assoc_Cache(uint32_t n_sets, uint32_t ways, uint32_t block_size, Replacement policy = Replacement::LRU): n_sets(std::max(1u, n_sets)), ways(std::max(1u, ways)), block_size(block_size), policy(policy) {
+        tags = std::vector<uint64_t>(size_t(this->n_sets) * this->ways, invalid);
+        dirty = std::vector<uint8_t>(tags.size(), 0);
+        states = std::vector<uint8_t>(tags.size(), 0);
+        ages = std::vector<uint16_t>(tags.size(), 0);
+        if (policy == Replacement::LRU || policy == Replacement::FIFO) {
+            // distinct starting ages so untouched slots are always the oldest
+            for (size_t i = 0; i < ages.size(); i++) {
+                ages[i] = i % this->ways;
+            }
+        }
+        if (policy == Replacement::TREE_PLRU) {
+            tree = std::vector<uint64_t>(this->n_sets, 0);
+        }
+        pow2 = is_pow2(block_size) && is_pow2(this->n_sets);
+        if (pow2) {
+            block_shift = log2(block_size);
+            set_mask = this->n_sets - 1;
+            set_shift = log2(this->n_sets);
+        }
+    }
+
+    uint64_t block_of(uint64_t address) const {
+        return pow2 ? address >> block_shift : address / block_size;
+    }
+    uint32_t set_of(uint64_t block) const {
+        return uint32_t(pow2 ? block & set_mask : block % n_sets);
+    }
+    uint64_t tag_of(uint64_t block) const {
+        return pow2 ? block >> set_shift : block / n_sets;
+    }
+    uint32_t sets() const {
+        return n_sets;
+    }
+    uint32_t associativity() const {
+        return ways;
+    }
+    Replacement replacement() const {
+        return policy;
+    }
+
+    // Slot holding the block, or -1. Does not touch the LRU order.
+    int find(uint64_t block) const {
+        const size_t base = size_t(set_of(block)) * ways;
+        for (uint32_t w = 0; w < ways; w++) {
+            if (tags[base + w] == block) return int(base + w);
+        }
+        return -1;
+    }
+
+    // Empties a slot and makes it the next victim of its set.
+    void invalidate(uint32_t slot) {
+        const size_t base = slot - slot % ways;
+        if (policy == Replacement::LRU || policy == Replacement::FIFO) {
+            const uint16_t age = ages[slot];
+            for (uint32_t w = 0; w < ways; w++) {
+                ages[base + w] -= ages[base + w] > age;
+            }
+            ages[slot] = ways - 1;
+        } else {
+            // the other policies fill invalid ways first anyway
+            ages[slot] = 0;
+        }
+        tags[slot] = invalid;
+        dirty[slot] = 0;
+        states[slot] = 0;
+    }
+
+    bool is_dirty(uint32_t slot) const {
+        return dirty[slot];
+    }
+    void set_dirty(uint32_t slot, bool value) {
+        dirty[slot] = value;
+    }
+    // count more hits to the block in slot, leaving the replacement state
+    // and dirty bit as that many access() calls would. Only LFU counts hits;
+    // every other policy's hit update gives the same state when repeated.
+    void repeat_hits(uint32_t slot, uint64_t count, bool write) {
+        if (count == 0) return;
+        const uint32_t set = slot / ways;
+        const uint32_t way = slot % ways;
+        uint16_t* a = &ages[size_t(set) * ways];
+        switch (policy) {
+            case Replacement::LRU: touch<Replacement::LRU>(set, a, ways, way, false); break;
+            case Replacement::TREE_PLRU: touch<Replacement::TREE_PLRU>(set, a, ways, way, false); break;
+            case Replacement::BIT_PLRU: touch<Replacement::BIT_PLRU>(set, a, ways, way, false); break;
+            case Replacement::FIFO: break;
+            case Replacement::RANDOM: break;
+            case Replacement::SRRIP: touch<Replacement::SRRIP>(set, a, ways, way, false); break;
+            case Replacement::BRRIP: touch<Replacement::BRRIP>(set, a, ways, way, false); break;
+            default: a[way] = uint16_t(std::min<uint64_t>(UINT16_MAX, a[way] + count)); break;
+        }
+        if (write) dirty[slot] = 1;
+    }
+
+    // protocol-defined; 0 after a fill
+    uint8_t& state(uint32_t slot) {
+        return states[slot];
+    }
+
+    // Saves or restores the contents; the geometry is the constructor's and a
+    // checkpoint of another geometry is rejected.
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        archive.io(tags);
+        archive.io(ages);
+        archive.io(dirty);
+        archive.io(states);
+        archive.io(tree);
+        archive.io(random_state);
+        archive.io(fills);
+        size_t slots = size_t(n_sets) * ways;
+        if (tags.size() != slots || ages.size() != slots || dirty.size() != slots || states.size() != slots ||
+            tree.size() != (policy == Replacement::TREE_PLRU ? n_sets : 0)) {
+            archive.fail();
+        }
+    }
+
+    // Looks the address up, fills it on a miss (replacing the victim the
+    // policy picks in its set), updates the replacement state and marks the
+    // block dirty on a write.
+    Result access(uint64_t address, bool write) {
+        switch (policy) {
+            case Replacement::LRU: return access_ways<Replacement::LRU>(address, write);
+            case Replacement::TREE_PLRU: return access_ways<Replacement::TREE_PLRU>(address, write);
+            case Replacement::BIT_PLRU: return access_ways<Replacement::BIT_PLRU>(address, write);
+            case Replacement::FIFO: return access_ways<Replacement::FIFO>(address, write);
+            case Replacement::RANDOM: return access_ways<Replacement::RANDOM>(address, write);
+            case Replacement::SRRIP: return access_ways<Replacement::SRRIP>(address, write);
+            case Replacement::BRRIP: return access_ways<Replacement::BRRIP>(address, write);
+            default: return access_ways<Replacement::LFU>(address, write);
+        }
+    }
+
+private:
+    uint32_t n_sets;
+    uint32_t ways;
+    uint32_t block_size;
+    bool pow2;
+    uint32_t block_shift = 0;
+    uint32_t set_shift = 0;
+    uint32_t set_mask = 0;
+    Replacement policy;
+    std::vector<uint64_t> tags; // block numbers, invalid when empty
+    std::vector<uint16_t> ages; // per-slot replacement metadata
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> states;
+    std::vector<uint64_t> tree; // tree-PLRU: bit i - 1 is node i, set = the victim is on the right
+    uint64_t random_state = 0x9E3779B97F4A7C15ull;
+    uint32_t fills = 0;         // BRRIP's bimodal throttle
+
+    static constexpr uint16_t rrpv_max = 3;
+
+    static bool is_pow2(uint32_t x) {
+        return x && !(x & (x - 1));
+    }
+    static uint32_t log2(uint32_t x) {
+        uint32_t r = 0;
+        while (x >>= 1) r++;
+        return r;
+    }
+
+    template <Replacement P>
+    Result access_ways(uint64_t address, bool write) {
+        uint64_t block = block_of(address);
+        uint32_t set = set_of(block);
+        switch (ways) {
+            case 1: return access_set<1, P>(set, block, write);
+            case 2: return access_set<2, P>(set, block, write);
+            case 4: return access_set<4, P>(set, block, write);
+            case 8: return access_set<8, P>(set, block, write);
+            case 16: return access_set<16, P>(set, block, write);
+            default: return access_set<0, P>(set, block, write);
+        }
+    }
+
+    uint64_t next_random() {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+        return random_state;
+    }
+
+    // Way to replace in a set with no invalid way (LRU and FIFO find theirs
+    // through the ages, which already make invalid ways the oldest).
+    template <Replacement P>
+    uint32_t victim(uint32_t set, uint16_t* a, uint32_t n) {
+        uint32_t way = 0;
+        if constexpr (P == Replacement::LRU || P == Replacement::FIFO) {
+            for (uint32_t w = 0; w < n; w++) {
+                if (a[w] == n - 1) way = w;
+            }
+        } else if constexpr (P == Replacement::TREE_PLRU) {
+            const uint64_t bits = tree[set];
+            uint32_t node = 1;
+            while (node < n) {
+                node = 2 * node + ((bits >> (node - 1)) & 1);
+            }
+            way = node - n;
+        } else if constexpr (P == Replacement::BIT_PLRU) {
+            while (way < n - 1 && a[way]) way++;
+        } else if constexpr (P == Replacement::RANDOM) {
+            way = uint32_t(next_random() % n);
+        } else if constexpr (P == Replacement::SRRIP || P == Replacement::BRRIP) {
+            // age every way until one is predicted distant
+            uint16_t oldest = 0;
+            for (uint32_t w = 0; w < n; w++) {
+                oldest = std::max(oldest, a[w]);
+            }
+            for (uint32_t w = 0; w < n; w++) {
+                a[w] += rrpv_max - oldest;
+            }
+            while (a[way] != rrpv_max) way++;
+        } else {
+            for (uint32_t w = 1; w < n; w++) {
+                if (a[w] < a[way]) way = w;
+            }
+        }
+        return way;
+    }
+
+    // Updates the replacement state after a hit or a fill of `way`.
+    template <Replacement P>
+    void touch(uint32_t set, uint16_t* a, uint32_t n, uint32_t way, bool fill) {
+        if constexpr (P == Replacement::LRU || P == Replacement::FIFO) {
+            if (P == Replacement::LRU || fill) {
+                const uint16_t age = a[way];
+                for (uint32_t w = 0; w < n; w++) {
+                    a[w] += a[w] < age;
+                }
+                a[way] = 0;
+            }
+        } else if constexpr (P == Replacement::TREE_PLRU) {
+            // point every node on the path away from the way
+            uint64_t& bits = tree[set];
+            uint32_t node = way + n;
+            while (node > 1) {
+                uint32_t parent = node / 2;
+                if (node & 1) {
+                    bits &= ~(uint64_t(1) << (parent - 1));
+                } else {
+                    bits |= uint64_t(1) << (parent - 1);
+                }
+                node = parent;
+            }
+        } else if constexpr (P == Replacement::BIT_PLRU) {
+            a[way] = 1;
+            bool all = true;
+            for (uint32_t w = 0; w < n; w++) {
+                all = all && a[w];
+            }
+            if (all) {
+                for (uint32_t w = 0; w < n; w++) {
+                    a[w] = w == way;
+                }
+            }
+        } else if constexpr (P == Replacement::SRRIP) {
+            a[way] = fill ? rrpv_max - 1 : 0;
+        } else if constexpr (P == Replacement::BRRIP) {
+            a[way] = !fill ? 0 : ++fills % 32 == 0 ? rrpv_max - 1 : rrpv_max;
+        } else if constexpr (P == Replacement::LFU) {
+            a[way] = fill ? 1 : a[way] + (a[way] != UINT16_MAX);
+        }
+    }
+
+    // WAYS == 0 means the associativity is only known at run time
+    template <int WAYS, Replacement P>
+    Result access_set(uint32_t set, uint64_t block, bool write) {
+        const uint32_t n = WAYS ? WAYS : ways;
+        const size_t base = size_t(set) * n;
+        uint64_t* t = &tags[base];
+        uint16_t* a = &ages[base];
+        uint8_t* d = &dirty[base];
+
+        Result result{false, false, false, invalid, 0};
+        uint32_t way = n;
+        for (uint32_t w = 0; w < n; w++) {
+            if (t[w] == block) way = w;
+        }
+        const bool fill = way == n;
+        if (fill) {
+            if constexpr (P != Replacement::LRU && P != Replacement::FIFO) {
+                for (uint32_t w = n; w-- > 0;) {
+                    if (t[w] == invalid) way = w;
+                }
+            }
+            if (way == n) {
+                way = victim<P>(set, a, n);
+            }
+            result.victim = t[way];
+            result.evicted = t[way] != invalid;
+            result.evicted_dirty = result.evicted && d[way];
+            t[way] = block;
+            d[way] = 0;
+            states[base + way] = 0;
+        } else {
+            result.hit = true;
+        }
+        touch<P>(set, a, n, way, fill);
+        if (write) d[way] = 1;
+        result.slot = uint32_t(base + way);
+        return result;
+    }
+};
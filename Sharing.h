@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "BlockTable.h"
+
+// Private and shared data, reported with --sharing-report. Every core counts
+// its loads and stores to each block it touches over the whole run, with a
+// bitmap of the words it wrote (Sharing_Table); the bus counts the coherence
+// traffic of each block (Line_Traffic): data of transactions that found the
+// block in another cache, and invalidations and updates. At the end the
+// cores' tables are merged by block into bitmaps of the cores that read and
+// wrote it (Sharing_Tracker::summary), so the split depends on the access
+// pattern alone, not on the caches: an access is shared if another core
+// touched its block during the run, and a block is falsely shared if more
+// than one core wrote it but no word was written by two of them. A block of
+// more than 64 words has a bit per group of words. Memory grows with the
+// blocks the trace touches, about 32 bytes per block and core.
+
+struct Sharing_Counts {
+    int64_t loads = 0;
+    int64_t stores = 0;
+    uint64_t words = 0; // written by the core, one bit per word
+};
+
+struct Line_Traffic {
+    int64_t invalidations_updates = 0;
+    int64_t bytes = 0; // of data moved between caches, and of updates
+};
+
+// One core's accesses by block address.
+class Sharing_Table {
+private:
+    uint64_t block_size;
+    uint64_t granule; // bytes per bit of the word bitmap
+    int block_shift = -1, granule_shift = -1; // for powers of two
+    Block_Table<Sharing_Counts> table;
+
+    static int shift_of(uint64_t v) {
+        int shift = 0;
+        while (uint64_t(1) << shift < v) {
+            shift++;
+        }
+        return uint64_t(1) << shift == v ? shift : -1;
+    }
+public:
+    Sharing_Table(uint64_t block_size, uint64_t word_size)
+        : block_size(block_size), granule(std::max(word_size, (block_size + 63) / 64)),
+          block_shift(shift_of(block_size)), granule_shift(shift_of(granule)) {}
+
+    // count accesses to the address, all loads or all stores
+    void touch(uint64_t address, bool write, int64_t count = 1) {
+        uint64_t offset = block_shift >= 0 ? address & (block_size - 1) : address % block_size;
+        Sharing_Counts& counts = table[address - offset];
+        if (write) {
+            counts.stores += count;
+            counts.words |= uint64_t(1) << (granule_shift >= 0 ? offset >> granule_shift : offset / granule);
+        } else {
+            counts.loads += count;
+        }
+    }
+    const Block_Table<Sharing_Counts>& blocks() const {
+        return table;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        table.checkpoint(archive);
+    }
+};
+
+// A falsely shared block and the bus traffic it caused.
+struct False_Sharing_Line {
+    uint64_t address = 0; // of the block
+    uint64_t writers = 0; // bitmap of cores
+    int64_t accesses = 0;
+    Line_Traffic traffic;
+};
+
+struct Sharing_Summary {
+    int64_t private_accesses = 0;
+    int64_t shared_accesses = 0;
+    int64_t read_only_shared = 0; // of the shared, to blocks no core wrote
+    int64_t false_shared_lines = 0;
+    std::vector<False_Sharing_Line> hot_lines; // the most traffic first
+};
+
+// The cores' tables and the traffic of every block. The cores touch only
+// their own tables and the bus only the traffic, so cores on worker threads
+// need no locking.
+class Sharing_Tracker {
+private:
+    // a block's users over the run, merged from the cores' tables
+    struct Block_Users {
+        uint64_t readers = 0, writers = 0; // bitmaps of cores
+        uint64_t words = 0, overlap = 0;   // written by any core, by two or more
+        int64_t accesses = 0;
+    };
+    std::vector<Sharing_Table> cores; // empty unless enabled
+    Block_Table<Line_Traffic> traffic;
+public:
+    void enable(int n_cores, uint64_t block_size, uint64_t word_size) {
+        cores.assign(n_cores, Sharing_Table(block_size, word_size));
+    }
+    bool enabled() const {
+        return !cores.empty();
+    }
+    void touch(int core, uint64_t address, bool write, int64_t count = 1) {
+        if (!cores.empty()) {
+            cores[core].touch(address, write, count);
+        }
+    }
+    // coherence traffic of the block at the address
+    void transfer(uint64_t block_address, int64_t bytes, int64_t invalidations_updates) {
+        if (!cores.empty()) {
+            Line_Traffic& line = traffic[block_address];
+            line.bytes += bytes;
+            line.invalidations_updates += invalidations_updates;
+        }
+    }
+    // Classifies every block by the cores that used it, then keeps the `top`
+    // falsely shared blocks with the most invalidations and updates, then bytes.
+    Sharing_Summary summary(size_t top) const {
+        Block_Table<Block_Users> users;
+        for (size_t core = 0; core < cores.size(); core++) {
+            cores[core].blocks().for_each([&](uint64_t block, const Sharing_Counts& counts) {
+                Block_Users& block_users = users[block];
+                block_users.readers |= counts.loads ? uint64_t(1) << core : 0;
+                block_users.writers |= counts.stores ? uint64_t(1) << core : 0;
+                block_users.overlap |= block_users.words & counts.words;
+                block_users.words |= counts.words;
+                block_users.accesses += counts.loads + counts.stores;
+            });
+        }
+        Sharing_Summary summary;
+        users.for_each([&](uint64_t block, const Block_Users& block_users) {
+            uint64_t all = block_users.readers | block_users.writers;
+            if ((all & (all - 1)) == 0) {
+                summary.private_accesses += block_users.accesses;
+                return;
+            }
+            summary.shared_accesses += block_users.accesses;
+            summary.read_only_shared += block_users.writers ? 0 : block_users.accesses;
+            if ((block_users.writers & (block_users.writers - 1)) != 0 && block_users.overlap == 0) {
+                summary.false_shared_lines++;
+                summary.hot_lines.push_back({block, block_users.writers, block_users.accesses, traffic.get(block)});
+            }
+        });
+        std::sort(summary.hot_lines.begin(), summary.hot_lines.end(), [](const False_Sharing_Line& a, const False_Sharing_Line& b) {
+            if (a.traffic.invalidations_updates != b.traffic.invalidations_updates) {
+                return a.traffic.invalidations_updates > b.traffic.invalidations_updates;
+            }
+            if (a.traffic.bytes != b.traffic.bytes) {
+                return a.traffic.bytes > b.traffic.bytes;
+            }
+            return a.address < b.address;
+        });
+        if (summary.hot_lines.size() > top) {
+            summary.hot_lines.resize(top);
+        }
+        return summary;
+    }
+    template <class Archive>
+    void checkpoint(Archive& archive) {
+        for (Sharing_Table& table : cores) {
+            table.checkpoint(archive);
+        }
+        traffic.checkpoint(archive);
+    }
+};
@@ -0,0 +1,482 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Barrier.h"
+#include "MissClass.h"
+#include "SetAssociative.h"
+#include "Trace.h"
+
+// The functional model of SimpleCacheSimulator: one cache in front of memory
+// with fixed latencies and no timing beyond their sum. Header-only so that
+// other programs can drive it, a batch of records per access() call, or a
+// whole trace split by set over threads (Sharded_L1Cache). With
+// classify_misses every miss is also put in a class (see MissClass.h).
+
+enum Instructions: int { LOAD = 0, STORE = 1, OTH = 2, REPEAT = repeat_record, REDUCED = reduced_record };
+
+const int L1_HIT_LAT = 1;
+const int DRAM_READ_LAT = 100;
+const int DRAM_WRITE_LAT = 100;
+
+struct L1_Config {
+    unsigned int cache_size = 4096;
+    unsigned int associativity = 2;
+    unsigned int block_size = 32;
+    Replacement replacement = Replacement::LRU;
+    bool classify_misses = false;
+
+    unsigned int sets() const {
+        return std::max(1u, cache_size / (block_size * associativity));
+    }
+};
+
+struct L1_Stats {
+    long long total_cycles = 0;
+    long long compute_cycles = 0;
+    long long idle_cycles = 0;
+    long long loads = 0;
+    long long stores = 0;
+    long long hits = 0;
+    long long misses = 0;
+    long long dirty_writebacks = 0;
+    long long bus_bytes = 0;
+
+    void add(const L1_Stats& other) {
+        total_cycles += other.total_cycles;
+        compute_cycles += other.compute_cycles;
+        idle_cycles += other.idle_cycles;
+        loads += other.loads;
+        stores += other.stores;
+        hits += other.hits;
+        misses += other.misses;
+        dirty_writebacks += other.dirty_writebacks;
+        bus_bytes += other.bus_bytes;
+    }
+
+    double miss_rate() const {
+        return loads + stores ? static_cast<double>(misses) / static_cast<double>(loads + stores) : 0.0;
+    }
+};
+
+struct L1Cache {
+    L1_Config config;
+    Set_Assoc_Cache sets;
+    L1_Stats stats;
+    uint32_t last_slot = 0; // of the last load/store, for repeat records
+    int last_type = LOAD;   // of the last load/store, for repeat records
+    std::string error_message;
+    std::unique_ptr<Miss_Classifier> classifier; // with classify_misses
+    std::vector<uint32_t>* miss_log = nullptr;    // if set, gets the index in access()'s records of each miss
+
+    explicit L1Cache(const L1_Config& config)
+        : config(config), sets(config.sets(), config.associativity, config.block_size, config.replacement) {
+        if (config.classify_misses) {
+            classifier.reset(new Miss_Classifier(sets.sets() * sets.associativity(), sets.sets()));
+        }
+    }
+
+    uint64_t get_tag(const uint64_t address) const {
+        return sets.tag_of(sets.block_of(address));
+    }
+
+    unsigned int get_set_id(const uint64_t address) const {
+        return sets.set_of(sets.block_of(address));
+    }
+
+    // {hit, evicted_dirty}
+    std::pair<bool,bool> load_access(const uint64_t address) {
+        auto r = sets.access(address, false);
+        last_slot = r.slot;
+        return {r.hit, r.evicted_dirty};
+    }
+
+    // {hit, evicted_dirty}; the block is left dirty
+    std::pair<bool,bool> store_access(const uint64_t address) {
+        auto r = sets.access(address, true);
+        last_slot = r.slot;
+        return {r.hit, r.evicted_dirty};
+    }
+
+    // count more hits of the last load/store
+    void repeat_access(const uint64_t count, const bool write) {
+        sets.repeat_hits(last_slot, count, write);
+    }
+
+    void charge_hit() {
+        stats.total_cycles += L1_HIT_LAT;
+    }
+
+    void charge_miss(bool evicted_dirty) {
+        stats.total_cycles += L1_HIT_LAT + DRAM_READ_LAT;
+        stats.idle_cycles += DRAM_READ_LAT;
+        stats.bus_bytes += config.block_size;
+        if (evicted_dirty) {
+            stats.total_cycles += DRAM_WRITE_LAT;
+            stats.idle_cycles += DRAM_WRITE_LAT;
+            stats.bus_bytes += config.block_size;
+            ++stats.dirty_writebacks;
+        }
+    }
+
+    // Runs n records, continuing the ones before. Returns false at a
+    // reduced-trace marker whose block size this cache's is not a multiple
+    // of, or a record of unknown type; the records before it have been run.
+    bool access(const Trace_Record* records, size_t n) {
+        for (size_t k = 0; k < n; k++) {
+            const Trace_Record& record = records[k];
+            const int instr_type = static_cast<int>(record.type);
+            if (instr_type == OTH) {
+                stats.total_cycles += static_cast<long long>(record.value);
+                stats.compute_cycles += static_cast<long long>(record.value);
+                continue;
+            }
+            if (instr_type == REPEAT) {
+                const long long count = static_cast<long long>(repeat_count(record.value));
+                stats.total_cycles += static_cast<long long>(repeat_compute(record.value));
+                stats.compute_cycles += static_cast<long long>(repeat_compute(record.value));
+                (last_type == STORE ? stats.stores : stats.loads) += count;
+                stats.hits += count;
+                stats.total_cycles += count * L1_HIT_LAT;
+                repeat_access(count, last_type == STORE);
+                continue;
+            }
+            if (instr_type == REDUCED) {
+                error_message = reduction_error(record.value, config.block_size);
+                if (!error_message.empty()) {
+                    return false;
+                }
+                continue;
+            }
+            if (instr_type != LOAD && instr_type != STORE) {
+                error_message = "unknown record type " + std::to_string(instr_type);
+                return false;
+            }
+            last_type = instr_type;
+
+            auto [hit, evd] = instr_type == LOAD ? load_access(record.value) : store_access(record.value);
+            ++(instr_type == LOAD ? stats.loads : stats.stores);
+            if (classifier) {
+                // a repeat of this load/store leaves the classifier as it is
+                const uint64_t block = sets.block_of(record.value);
+                classifier->access(block, sets.set_of(block), !hit);
+            }
+            if (miss_log && !hit) {
+                miss_log->push_back(uint32_t(k));
+            }
+            if (hit) {
+                ++stats.hits;
+                charge_hit();
+            } else {
+                ++stats.misses;
+                charge_miss(evd);
+            }
+        }
+        return true;
+    }
+
+    const std::string& error() const {
+        return error_message;
+    }
+};
+
+// Whether sets are independent under the policy: RANDOM draws from one
+// generator and BRRIP counts fills across all sets, so splitting those by
+// set would change their choices.
+inline bool shardable(Replacement policy) {
+    return policy != Replacement::RANDOM && policy != Replacement::BRRIP;
+}
+
+// L1Cache split by set over threads, with the results of one L1Cache.
+// Set s belongs to shard s % n, where it is set s / n of an L1Cache holding
+// only that shard's sets; addresses are renumbered on the way in so the
+// tags stay apart. Records go through in chunks, each in two steps between
+// barriers: every thread sorts its slice of the chunk into one bucket per
+// shard, then runs its shard's buckets from every slice in trace order.
+// A repeat record goes with the load/store before it, compute records are
+// counted where they are sorted, and the counters are summed at the end.
+// With classify_misses one more thread runs the shadow of MissClass.h over
+// every load/store of the chunk, in trace order, while the shards sort and
+// run it; a third step then classes each shard's misses by the shadow's
+// hints, found through the chunk position sorting recorded. The shadow's
+// thread is then the slowest, so it wants a core of its own.
+class Sharded_L1Cache {
+private:
+    static constexpr size_t chunk_records = 1 << 16;
+
+    L1_Config config;
+    unsigned n;    // shards, one thread each
+    unsigned sets; // of the whole cache
+    bool pow2;
+    unsigned block_shift = 0, set_shift = 0, shard_shift = 0;
+    std::vector<uint64_t> shard_sets;
+    std::vector<std::unique_ptr<L1Cache>> shards;
+    std::vector<std::vector<Trace_Record>> buckets; // slice j's records of shard k at j * n + k
+    std::vector<L1_Stats> slice_stats;              // compute records sorted by each thread
+    // with classify_misses
+    std::unique_ptr<Miss_Classifier> shadow;        // of the whole cache; counts nothing itself
+    std::vector<Shadow_Hint> hints;                 // by chunk position, of loads/stores
+    std::vector<std::vector<uint32_t>> positions;   // chunk position of each record of each bucket
+    std::vector<std::vector<uint32_t>> bucket_misses; // by shard: its misses in the bucket it last ran
+    std::vector<std::vector<uint32_t>> missed;      // by shard: chunk positions of its misses
+    std::vector<Miss_Counts> shard_classes;
+    std::vector<std::vector<Set_Misses>> shard_set_misses; // by shard and set within it
+
+    static bool is_pow2(uint64_t v) {
+        return v && (v & (v - 1)) == 0;
+    }
+    static unsigned log2(uint64_t v) {
+        unsigned shift = 0;
+        while (v >>= 1) {
+            shift++;
+        }
+        return shift;
+    }
+
+    // shard of an address, and the address within it
+    unsigned route(uint64_t address, uint64_t& local) const {
+        uint64_t block, set, tag;
+        unsigned k;
+        if (pow2) {
+            block = address >> block_shift;
+            set = block & (sets - 1);
+            tag = block >> set_shift;
+            k = unsigned(set & (n - 1));
+            local = (tag * shard_sets[k] + (set >> shard_shift)) << block_shift;
+        } else {
+            block = address / config.block_size;
+            set = block % sets;
+            tag = block / sets;
+            k = unsigned(set % n);
+            local = (tag * shard_sets[k] + set / n) * config.block_size;
+        }
+        return k;
+    }
+
+    uint64_t block_of(uint64_t address) const {
+        return pow2 ? address >> block_shift : address / config.block_size;
+    }
+
+    // Sorts records [from, to) of the chunk; last is the shard of the
+    // load/store before them.
+    void sort(unsigned slice, const Trace_Record* chunk, size_t from, size_t to, unsigned last) {
+        std::vector<Trace_Record>* out = &buckets[size_t(slice) * n];
+        std::vector<uint32_t>* at = shadow ? &positions[size_t(slice) * n] : nullptr;
+        for (unsigned k = 0; k < n; k++) {
+            out[k].clear();
+            if (at) {
+                at[k].clear();
+            }
+        }
+        L1_Stats& compute = slice_stats[slice];
+        for (size_t i = from; i < to; i++) {
+            Trace_Record record = chunk[i];
+            unsigned k;
+            if (record.type == LOAD || record.type == STORE) {
+                k = last = route(record.value, record.value);
+            } else if (record.type == OTH) {
+                compute.total_cycles += static_cast<long long>(record.value);
+                compute.compute_cycles += static_cast<long long>(record.value);
+                continue;
+            } else if (record.type == REPEAT) {
+                k = last;
+            } else {
+                k = 0; // a marker or bad record: checked by shard 0
+            }
+            out[k].push_back(record);
+            if (at) {
+                at[k].push_back(uint32_t(i));
+            }
+        }
+    }
+
+    // the shadow's hints for the loads/stores of the chunk
+    void hint(const Trace_Record* chunk, size_t size) {
+        hints.resize(size);
+        for (size_t i = 0; i < size; i++) {
+            if (chunk[i].type == LOAD || chunk[i].type == STORE) {
+                hints[i] = shadow->hint(block_of(chunk[i].value));
+            }
+        }
+    }
+
+    // classes shard k's misses of the chunk
+    void classify(unsigned k, const Trace_Record* chunk) {
+        for (uint32_t i : missed[k]) {
+            uint64_t set = pow2 ? block_of(chunk[i].value) & (sets - 1) : block_of(chunk[i].value) % sets;
+            Miss_Class kind = miss_class(hints[i]);
+            Set_Misses& local = shard_set_misses[k][pow2 ? set >> shard_shift : set / n];
+            shard_classes[k].count(kind);
+            local.misses++;
+            local.conflicts += kind == Miss_Class::CONFLICT;
+        }
+    }
+
+    // shard of the last load/store in [0, to) of the chunk, else `before`
+    unsigned last_shard(const Trace_Record* chunk, size_t to, unsigned before) const {
+        for (size_t i = to; i-- > 0;) {
+            if (chunk[i].type == LOAD || chunk[i].type == STORE) {
+                uint64_t local;
+                return route(chunk[i].value, local);
+            }
+        }
+        return before;
+    }
+public:
+    // threads are capped at the sets
+    Sharded_L1Cache(const L1_Config& config, unsigned threads): config(config) {
+        sets = config.sets();
+        n = std::max(1u, std::min(threads, sets));
+        pow2 = is_pow2(config.block_size) && is_pow2(sets) && is_pow2(n);
+        if (pow2) {
+            block_shift = log2(config.block_size);
+            set_shift = log2(sets);
+            shard_shift = log2(n);
+        }
+        for (unsigned k = 0; k < n; k++) {
+            L1_Config shard = config;
+            shard.classify_misses = false;
+            shard_sets.push_back((sets - k + n - 1) / n);
+            shard.cache_size = unsigned(shard_sets[k]) * config.block_size * config.associativity;
+            shards.emplace_back(new L1Cache(shard));
+        }
+        buckets.resize(size_t(n) * n);
+        slice_stats.resize(n);
+        if (config.classify_misses) {
+            shadow.reset(new Miss_Classifier(sets * config.associativity, 0));
+            positions.resize(buckets.size());
+            bucket_misses.resize(n);
+            missed.resize(n);
+            shard_classes.resize(n);
+            for (unsigned k = 0; k < n; k++) {
+                shard_set_misses.emplace_back(shard_sets[k]);
+                shards[k]->miss_log = &bucket_misses[k];
+            }
+        }
+    }
+
+    // Runs the trace to its end. Returns false if a shard stopped at a
+    // record it cannot run, see error().
+    bool run(Trace_Reader& trace) {
+        Spin_Barrier barrier(n);
+        Spin_Barrier chunk_barrier(n + (shadow ? 1 : 0)); // with the shadow's thread
+        std::vector<Trace_Record> staging;
+        const Trace_Record* chunk = nullptr;
+        size_t size = 0;
+        unsigned carry = 0; // shard of the last load/store before the chunk
+        // small blocks (text, fed or live traces) are gathered into a chunk
+        auto fetch = [&]() {
+            staging.clear();
+            const Trace_Record* block;
+            size_t m;
+            while (staging.size() < chunk_records && trace.next_block(block, m)) {
+                if (staging.empty() && m >= chunk_records) {
+                    chunk = block;
+                    size = m;
+                    return;
+                }
+                staging.insert(staging.end(), block, block + m);
+            }
+            chunk = staging.data();
+            size = staging.size();
+        };
+        auto work = [&](unsigned t) {
+            while (true) {
+                if (t == 0) {
+                    fetch();
+                }
+                chunk_barrier.wait();
+                if (size == 0) {
+                    return;
+                }
+                size_t from = size * t / n;
+                sort(t, chunk, from, size * (t + 1) / n, last_shard(chunk, from, carry));
+                barrier.wait();
+                if (t == 0) {
+                    carry = last_shard(chunk, size, carry);
+                }
+                L1Cache& shard = *shards[t];
+                if (shadow) {
+                    missed[t].clear();
+                }
+                for (unsigned j = 0; j < n && shard.error().empty(); j++) {
+                    const std::vector<Trace_Record>& bucket = buckets[size_t(j) * n + t];
+                    shard.access(bucket.data(), bucket.size());
+                    if (shadow) {
+                        const std::vector<uint32_t>& at = positions[size_t(j) * n + t];
+                        for (uint32_t r : bucket_misses[t]) {
+                            missed[t].push_back(at[r]);
+                        }
+                        bucket_misses[t].clear();
+                    }
+                }
+                if (shadow) {
+                    chunk_barrier.wait();
+                    classify(t, chunk);
+                }
+                barrier.wait();
+            }
+        };
+        std::vector<std::thread> threads;
+        if (shadow) {
+            threads.emplace_back([&]() {
+                while (true) {
+                    chunk_barrier.wait();
+                    if (size == 0) {
+                        return;
+                    }
+                    hint(chunk, size);
+                    chunk_barrier.wait();
+                }
+            });
+        }
+        for (unsigned t = 1; t < n; t++) {
+            threads.emplace_back(work, t);
+        }
+        work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        return error().empty();
+    }
+
+    L1_Stats stats() const {
+        L1_Stats total;
+        for (const std::unique_ptr<L1Cache>& shard : shards) {
+            total.add(shard->stats);
+        }
+        for (const L1_Stats& compute : slice_stats) {
+            total.add(compute);
+        }
+        return total;
+    }
+
+    // with classify_misses
+    Miss_Counts miss_counts() const {
+        Miss_Counts total;
+        for (const Miss_Counts& counts : shard_classes) {
+            total.add(counts);
+        }
+        return total;
+    }
+    std::vector<Set_Misses> set_misses() const {
+        std::vector<Set_Misses> by_set(shadow ? sets : 0);
+        for (unsigned set = 0; set < by_set.size(); set++) {
+            by_set[set] = shard_set_misses[set % n][set / n];
+        }
+        return by_set;
+    }
+
+    const std::string& error() const {
+        for (const std::unique_ptr<L1Cache>& shard : shards) {
+            if (!shard->error().empty()) {
+                return shard->error();
+            }
+        }
+        return shards[0]->error();
+    }
+};
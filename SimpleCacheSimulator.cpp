@@ -1,244 +1,434 @@
 #include <bits/stdc++.h>
-
-struct Config {
-    std::string protocol;
-    std::string input_file;
-    unsigned int cache_size;
-    unsigned int associativity;
-    unsigned int block_size;
-    Config(): protocol(""), input_file(""), associativity(2), cache_size(4096), block_size(32) {}
-} config;
-
-enum Instructions: int { LOAD = 0, STORE = 1, OTH = 2 };
-
-const int L1_HIT_LAT = 1;
-const int DRAM_READ_LAT = 100;
-const int DRAM_WRITE_LAT = 100;
-
-struct CacheBlock {
-    unsigned int tag{};
-    bool dirty{false};
-    explicit CacheBlock(unsigned int t): tag(t), dirty(false) {}
-    CacheBlock() = default;
-};
-
-inline unsigned long long to_hex_ull(const std::string& s) {
-    return std::stoull(s, nullptr, 16);
+#include "SimpleCache.h"
+
+void print_results(const L1_Stats& stats, const L1_Config& config);
+void print_classes(const Miss_Counts& counts, const std::vector<Set_Misses>& set_misses);
+
+// A reduced trace's leading record: exits unless its reduction holds for
+// every block size of the run.
+void check_reduction(const Trace_Record& record, const std::vector<unsigned int>& block_sizes) {
+    for (unsigned int b : block_sizes) {
+        const std::string error = reduction_error(record.value, b);
+        if (!error.empty()) {
+            std::cerr << error << "\n";
+            std::exit(1);
+        }
+    }
 }
 
-struct CacheSet {
-    using key_type = unsigned int;
-    using pos_type = std::list<CacheBlock>::iterator;
-
-    std::unordered_map<key_type, pos_type> pos_cache;
-    std::list<CacheBlock> cache;
-
-    //  {evicted, was_dirty}
-    std::pair<bool,bool> evict_if_needed() {
-        if (cache.size() > config.associativity) {
-            CacheBlock &blk = cache.front();
-            bool dirty = blk.dirty;
-            pos_cache.erase(blk.tag);
-            cache.pop_front();
-            return {true, dirty};
-        }
-        return {false, false};
-    }
-
-    // {hit, evicted_dirty}
-    std::pair<bool,bool> load_miss_or_hit(const key_type& tag) {
-        auto it = pos_cache.find(tag);
-        if (it == pos_cache.end()) {
-            cache.push_back(CacheBlock(tag));
-            auto ev = evict_if_needed();
-            pos_cache[tag] = std::prev(cache.end());
-            return {false, ev.second};
-        } else {
-            cache.splice(cache.end(), cache, it->second);          // LRU to MRU
-            pos_cache[tag] = std::prev(cache.end());
-            return {true, false};
+// threads > 1 splits the cache by set over that many threads where the
+// replacement policy allows it (see Sharded_L1Cache); the results are the same.
+void execute(const L1_Config& config, Trace_Reader& trace, unsigned threads) {
+    if (threads > 1 && shardable(config.replacement) && config.sets() > 1) {
+        Sharded_L1Cache sharded(config, threads);
+        if (!sharded.run(trace)) {
+            std::cerr << sharded.error() << "\n";
+            std::exit(1);
+        }
+        if (!trace.error().empty()) {
+            std::cerr << trace.error() << "\n";
+            std::exit(1);
         }
+        print_results(sharded.stats(), config);
+        if (config.classify_misses) {
+            print_classes(sharded.miss_counts(), sharded.set_misses());
+        }
+        return;
     }
-
-    // {hit, evicted_dirty}
-    std::pair<bool,bool> store_miss_or_hit(const key_type& tag) {
-        auto it = pos_cache.find(tag);
-        if (it == pos_cache.end()) {
-            cache.push_back(CacheBlock(tag));
-            auto ev = evict_if_needed();
-            pos_cache[tag] = std::prev(cache.end());
-            return {false, ev.second};
-        } else {
-            cache.splice(cache.end(), cache, it->second);
-            pos_cache[tag] = std::prev(cache.end());
-            return {true, false};
+    L1Cache l1_cache(config);
+    const Trace_Record* records;
+    size_t n;
+    while (trace.next_block(records, n)) {
+        if (!l1_cache.access(records, n)) {
+            std::cerr << l1_cache.error() << "\n";
+            std::exit(1);
         }
     }
-
-    void mark_dirty(const key_type& tag) {
-        auto it = pos_cache.find(tag);
-        if (it != pos_cache.end()) it->second->dirty = true;
+    if (!trace.error().empty()) {
+        std::cerr << trace.error() << "\n";
+        std::exit(1);
     }
-};
 
-struct L1Cache {
-    std::vector<CacheSet> sets;
+    print_results(l1_cache.stats, l1_cache.config);
+    if (l1_cache.classifier) {
+        print_classes(l1_cache.classifier->counts(), l1_cache.classifier->set_misses());
+    }
+}
 
-    L1Cache(): sets(static_cast<size_t>(std::max(1u, config.cache_size / (config.block_size * config.associativity)))) {}
+void print_results(const L1_Stats& stats, const L1_Config& config) {
+    std::cout << "TotalCycles: " << stats.total_cycles << "\n";
+    std::cout << "ComputeCycles: " << stats.compute_cycles << "\n";
+    std::cout << "IdleCycles: " << stats.idle_cycles << "\n";
+    std::cout << "Loads: " << stats.loads << "\n";
+    std::cout << "Stores: " << stats.stores << "\n";
+    std::cout << "Hits: " << stats.hits << "\n";
+    std::cout << "Misses: " << stats.misses << "\n";
+    std::cout.setf(std::ios::fixed);
+    std::cout << std::setprecision(6) << "MissRate: " << stats.miss_rate() << "\n";
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << "BusDataBytes: " << stats.bus_bytes << "\n";
+    std::cout << "DirtyWritebacks: " << stats.dirty_writebacks << "\n";
+    std::cout << "BlockSize: " << config.block_size << "\n";
+    std::cout << "Assoc: " << config.associativity << "\n";
+    std::cout << "CacheSize: " << config.cache_size << "\n";
+}
 
-    static unsigned int sets_n() {
-        return std::max(1u, config.cache_size / (config.block_size * config.associativity));
+// with --classify-misses, after print_results
+void print_classes(const Miss_Counts& counts, const std::vector<Set_Misses>& set_misses) {
+    std::cout << "CompulsoryMisses: " << counts.compulsory << "\n";
+    std::cout << "CapacityMisses: " << counts.capacity << "\n";
+    std::cout << "ConflictMisses: " << counts.conflict << "\n";
+    // set:misses/conflicts of the eight sets with the most misses
+    std::cout << "HotSets:";
+    for (uint32_t set : hot_sets(set_misses.data(), uint32_t(set_misses.size()), 8)) {
+        std::cout << " " << set << ":" << set_misses[set].misses << "/" << set_misses[set].conflicts;
     }
-
-    static unsigned int get_tag(const unsigned int address) {
-        const unsigned int sN = sets_n();
-        const unsigned int block_number = address / config.block_size;
-        return block_number / sN;
+    std::cout << "\n";
+    std::cout << "SetMisses:";
+    for (const Set_Misses& set : set_misses) {
+        std::cout << " " << set.misses;
     }
-
-    static unsigned int get_set_id(const unsigned int address) {
-        const unsigned int sN = sets_n();
-        const unsigned int block_number = address / config.block_size;
-        return block_number % sN;
+    std::cout << "\n";
+    std::cout << "SetConflicts:";
+    for (const Set_Misses& set : set_misses) {
+        std::cout << " " << set.conflicts;
     }
+    std::cout << "\n";
+}
 
-    std::pair<bool,bool> load_access(const unsigned int address) {
-        unsigned int set_id = get_set_id(address);
-        unsigned int tag = get_tag(address);
-        return sets[set_id].load_miss_or_hit(tag);
+// All-associativity LRU simulation for one block size and one set count.
+// Each set keeps an LRU stack as deep as the largest associativity sharing
+// this set count; a block found at depth d hits in every cache with more
+// than d ways, so one pass gives the hits of all of them at once.
+// Dirty state differs per associativity, so each entry records dirty_above:
+// the block is dirty in an a-way cache iff a > dirty_above (a store resets it
+// to 0, a load at depth d raises it to d because every cache with at most d
+// ways refetched the block clean). An entry pushed from depth j to j + 1 is
+// evicted from the (j + 1)-way cache, which writes it back iff dirty there.
+struct LRUStackGroup {
+    static constexpr unsigned int NEVER_DIRTY = UINT_MAX;
+
+    unsigned int block_size;
+    unsigned int sets;
+    unsigned int depth;
+    std::vector<uint64_t> blocks;          // sets * depth, most recent first
+    std::vector<unsigned int> dirty_above; // parallel to blocks
+    std::vector<unsigned int> used;        // valid entries per set
+    std::vector<long long> depth_hits;     // accesses found at depth d
+    std::vector<long long> writebacks;     // writebacks[a] for the a-way cache
+
+    LRUStackGroup(unsigned int block_size, unsigned int sets, unsigned int depth)
+        : block_size(block_size), sets(sets), depth(depth),
+          blocks(static_cast<size_t>(sets) * depth), dirty_above(blocks.size()), used(sets, 0),
+          depth_hits(depth, 0), writebacks(depth + 1, 0) {}
+
+    // count more accesses to the block last accessed, which is on top of
+    // its set's stack: hits at depth 0 that leave the stack as it is
+    void repeat(const uint64_t address, const long long count, const bool write) {
+        if (write) dirty_above[static_cast<size_t>((address / block_size) % sets) * depth] = 0;
+        depth_hits[0] += count;
     }
 
-    std::pair<bool,bool> store_access(const unsigned int address) {
-        unsigned int set_id = get_set_id(address);
-        unsigned int tag = get_tag(address);
-        return sets[set_id].store_miss_or_hit(tag);
+    // returns the depth the block was found at, depth if it was not
+    unsigned int access(const uint64_t address, const bool write) {
+        const uint64_t block = address / block_size;
+        const unsigned int set = static_cast<unsigned int>(block % sets);
+        uint64_t* b = &blocks[static_cast<size_t>(set) * depth];
+        unsigned int* m = &dirty_above[static_cast<size_t>(set) * depth];
+        const unsigned int n = used[set];
+
+        unsigned int d = 0;
+        while (d < n && b[d] != block) ++d;
+
+        unsigned int dirty;
+        unsigned int shifted; // entries pushed one place deeper
+        if (d < n) {
+            ++depth_hits[d];
+            dirty = write ? 0 : std::max(m[d], d);
+            shifted = d;
+        } else {
+            dirty = write ? 0 : NEVER_DIRTY;
+            shifted = n; // when full, the deepest entry falls off the stack
+            if (n < depth) used[set] = n + 1;
+        }
+        for (unsigned int j = 0; j < shifted; ++j) {
+            if (m[j] <= j) ++writebacks[j + 1];
+        }
+        const unsigned int keep = std::min(shifted, depth - 1);
+        std::memmove(b + 1, b, keep * sizeof(uint64_t));
+        std::memmove(m + 1, m, keep * sizeof(unsigned int));
+        b[0] = block;
+        m[0] = dirty;
+        return d < n ? d : depth;
     }
 
-    void mark_dirty(const unsigned int address) {
-        unsigned int set_id = get_set_id(address);
-        unsigned int tag = get_tag(address);
-        sets[set_id].mark_dirty(tag);
+    long long hits(const unsigned int ways) const {
+        return std::accumulate(depth_hits.begin(), depth_hits.begin() + ways, 0LL);
     }
 };
 
-long long total_cycles;
-long long compute_cycles;
-long long idle_cycles;
-long long loads_cnt;
-long long stores_cnt;
-long long hits_cnt;
-long long misses_cnt;
-long long dirty_writebacks;
-long long bus_bytes;
-
-void reset_counters() {
-    total_cycles = 0;
-    compute_cycles = 0;
-    idle_cycles = 0;
-    loads_cnt = stores_cnt = 0;
-    hits_cnt = misses_cnt = 0;
-    dirty_writebacks = 0;
-    bus_bytes = 0;
-}
-
-void charge_hit() {
-    total_cycles += L1_HIT_LAT;
-}
-
-void charge_miss(bool evicted_dirty) {
-    total_cycles += L1_HIT_LAT + DRAM_READ_LAT;
-    idle_cycles += DRAM_READ_LAT;
-    bus_bytes += config.block_size;
-    if (evicted_dirty) {
-        total_cycles += DRAM_WRITE_LAT;
-        idle_cycles += DRAM_WRITE_LAT;
-        bus_bytes += config.block_size;
-        ++dirty_writebacks;
+// Runs every (cache size, associativity, block size) combination in one pass
+// over the trace and prints each result in the single-run format.
+// With classify, every block size also has one shadow (MissClass.h) with a
+// capacity per line count of its combinations, and a first-touch set: a
+// point missed where its group found the block no shallower than its ways,
+// and the level the shadow found the block at classes the miss.
+void execute_grid(const std::string& input_file, Trace_Reader& trace, const std::vector<unsigned int>& cache_sizes,
+                  const std::vector<unsigned int>& assocs, const std::vector<unsigned int>& block_sizes, bool classify) {
+    struct GridPoint {
+        unsigned int cache_size, assoc, block_size;
+        size_t group;
+        uint32_t level = 0; // of its lines in its block size's shadow
+        Miss_Counts classes = {};
+        std::vector<Set_Misses> set_misses = {};
+    };
+    struct GridShadow {
+        unsigned int block_size;
+        Shadow_Stack shadow;
+        First_Touch seen;
+        std::vector<size_t> groups;
+    };
+    std::vector<GridPoint> points;
+    std::vector<LRUStackGroup> groups;
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int> max_ways;
+    auto sets_of = [](unsigned int cs, unsigned int a, unsigned int b) {
+        return std::max(1u, cs / (b * a));
+    };
+    for (unsigned int b : block_sizes)
+        for (unsigned int cs : cache_sizes)
+            for (unsigned int a : assocs) {
+                unsigned int& w = max_ways[{b, sets_of(cs, a, b)}];
+                w = std::max(w, a);
+            }
+    std::map<std::pair<unsigned int, unsigned int>, size_t> group_of;
+    for (auto& [key, ways] : max_ways) {
+        group_of[key] = groups.size();
+        groups.emplace_back(key.first, key.second, ways);
+    }
+    for (unsigned int cs : cache_sizes)
+        for (unsigned int a : assocs)
+            for (unsigned int b : block_sizes)
+                points.push_back({cs, a, b, group_of[{b, sets_of(cs, a, b)}]});
+
+    std::vector<GridShadow> shadows;
+    std::vector<std::vector<size_t>> group_points(groups.size());
+    if (classify) {
+        for (unsigned int b : std::set<unsigned int>(block_sizes.begin(), block_sizes.end())) {
+            std::vector<uint32_t> lines;
+            for (const GridPoint& p : points) {
+                if (p.block_size == b) lines.push_back(sets_of(p.cache_size, p.assoc, b) * p.assoc);
+            }
+            std::sort(lines.begin(), lines.end());
+            lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+            for (GridPoint& p : points) {
+                if (p.block_size != b) continue;
+                uint32_t l = sets_of(p.cache_size, p.assoc, b) * p.assoc;
+                p.level = uint32_t(std::lower_bound(lines.begin(), lines.end(), l) - lines.begin());
+                p.set_misses.resize(groups[p.group].sets);
+            }
+            shadows.push_back({b, Shadow_Stack(lines), First_Touch(), {}});
+            for (size_t g = 0; g < groups.size(); g++) {
+                if (groups[g].block_size == b) shadows.back().groups.push_back(g);
+            }
+        }
+        for (size_t i = 0; i < points.size(); i++) group_points[points[i].group].push_back(i);
     }
-}
 
-void execute(L1Cache& l1_cache) {
-    reset_counters();
-
-    int instr_type;
-    std::string token;
-    while (std::cin >> instr_type >> token) {
-        // std::cerr << instr_type << " " << token << std::endl;
-        if (instr_type == OTH) {
-            unsigned long long c = to_hex_ull(token);
-            total_cycles += static_cast<long long>(c);
-            compute_cycles += static_cast<long long>(c);
+    L1_Stats stats;
+    Trace_Record record;
+    Trace_Record last = {LOAD, 0}; // the last load/store, for repeat records
+    while (trace.next(record)) {
+        if (record.type == OTH) {
+            stats.compute_cycles += static_cast<long long>(record.value);
             continue;
         }
-
-        unsigned int addr = static_cast<unsigned int>(to_hex_ull(token));
-
-        if (instr_type == LOAD) {
-            ++loads_cnt;
-            auto [hit, evd] = l1_cache.load_access(addr);
-            if (hit) { 
-                ++hits_cnt;
-				charge_hit();
-            } else { 
-                ++misses_cnt;
-                charge_miss(evd);
-            }
-        } else if (instr_type == STORE) {
-            ++stores_cnt;
-            auto [hit, evd] = l1_cache.store_access(addr);
-            if (hit) {
-                ++hits_cnt;
-                charge_hit();
-            } else {
-                ++misses_cnt;
-                charge_miss(evd);
+        if (record.type == REPEAT) {
+            const long long n = static_cast<long long>(repeat_count(record.value));
+            stats.compute_cycles += static_cast<long long>(repeat_compute(record.value));
+            (last.type == STORE ? stats.stores : stats.loads) += n;
+            for (auto& g : groups) g.repeat(last.value, n, last.type == STORE);
+            continue;
+        }
+        if (record.type == REDUCED) {
+            check_reduction(record, block_sizes);
+            continue;
+        }
+        if (record.type == LOAD) ++stats.loads;
+        else if (record.type == STORE) ++stats.stores;
+        else continue;
+        last = record;
+        if (!classify) {
+            for (auto& g : groups) g.access(record.value, record.type == STORE);
+            continue;
+        }
+        for (GridShadow& s : shadows) {
+            const uint64_t block = record.value / s.block_size;
+            bool invalidated;
+            const uint32_t level = s.shadow.access(block, invalidated);
+            const bool first = level == s.shadow.levels() && s.seen.insert(block);
+            for (size_t g : s.groups) {
+                const unsigned int depth = groups[g].access(record.value, record.type == STORE);
+                const unsigned int set = static_cast<unsigned int>(block % groups[g].sets);
+                for (size_t i : group_points[g]) {
+                    GridPoint& p = points[i];
+                    if (depth < p.assoc) continue;
+                    const Miss_Class kind = first ? Miss_Class::COMPULSORY
+                                          : level <= p.level ? Miss_Class::CONFLICT : Miss_Class::CAPACITY;
+                    p.classes.count(kind);
+                    p.set_misses[set].misses++;
+                    p.set_misses[set].conflicts += kind == Miss_Class::CONFLICT;
+                }
             }
-            l1_cache.mark_dirty(addr);
         }
     }
+    if (!trace.error().empty()) {
+        std::cerr << trace.error() << "\n";
+        std::exit(1);
+    }
 
-    double miss_rate = (loads_cnt + stores_cnt)
-        ? static_cast<double>(misses_cnt) / static_cast<double>(loads_cnt + stores_cnt)
-        : 0.0;
+    const long long accesses = stats.loads + stats.stores;
+    for (const GridPoint& p : points) {
+        const LRUStackGroup& g = groups[p.group];
+        L1_Config config;
+        config.cache_size = p.cache_size;
+        config.associativity = p.assoc;
+        config.block_size = p.block_size;
+        stats.hits = g.hits(p.assoc);
+        stats.misses = accesses - stats.hits;
+        stats.dirty_writebacks = g.writebacks[p.assoc];
+        stats.idle_cycles = (stats.misses * DRAM_READ_LAT) + (stats.dirty_writebacks * DRAM_WRITE_LAT);
+        stats.total_cycles = stats.compute_cycles + accesses * L1_HIT_LAT + stats.idle_cycles;
+        stats.bus_bytes = (stats.misses + stats.dirty_writebacks) * static_cast<long long>(p.block_size);
+        std::cout << "===== RUN: workload=" << input_file << " cs=" << p.cache_size
+                  << " assoc=" << p.assoc << " blk=" << p.block_size << " =====\n";
+        print_results(stats, config);
+        if (classify) print_classes(p.classes, p.set_misses);
+        std::cout << "\n";
+    }
+}
 
-    std::cout << "TotalCycles: " << total_cycles << "\n";
-    std::cout << "ComputeCycles: " << compute_cycles << "\n";
-    std::cout << "IdleCycles: " << idle_cycles << "\n";
-    std::cout << "Loads: " << loads_cnt << "\n";
-    std::cout << "Stores: " << stores_cnt << "\n";
-    std::cout << "Hits: " << hits_cnt << "\n";
-    std::cout << "Misses: " << misses_cnt << "\n";
-    std::cout.setf(std::ios::fixed);
-    std::cout << std::setprecision(6) << "MissRate: " << miss_rate << "\n";
-    std::cout.unsetf(std::ios::fixed);
-    std::cout << "BusDataBytes: " << bus_bytes << "\n";
-    std::cout << "DirtyWritebacks: " << dirty_writebacks << "\n";
-    std::cout << "BlockSize: " << config.block_size << "\n";
-    std::cout << "Assoc: " << config.associativity << "\n";
-    std::cout << "CacheSize: " << config.cache_size << "\n";
+std::vector<unsigned int> parse_list(const std::string& arg) {
+    std::vector<unsigned int> values;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) values.push_back(std::stoi(item));
+    return values;
+}
+
+// Decoded records execute_each keeps in memory; a longer trace is read from
+// its file again for every combination.
+const size_t loaded_trace_limit = (size_t(1) << 30) / sizeof(Trace_Record);
+
+// The LRU stack of execute_grid does not hold for the other policies, so
+// those grids simulate every combination over the trace loaded once.
+void execute_each(const std::string& input_file, const std::string& file_name, Trace_Reader& opened, const L1_Config& base,
+                  const std::vector<unsigned int>& cache_sizes, const std::vector<unsigned int>& assocs,
+                  const std::vector<unsigned int>& block_sizes, unsigned threads) {
+    std::vector<Trace_Record> records;
+    std::string error;
+    bool loaded = load_trace(opened, records, error, loaded_trace_limit);
+    if (!error.empty()) {
+        std::cerr << error << "\n";
+        std::exit(1);
+    }
+    for (unsigned int cs : cache_sizes)
+        for (unsigned int a : assocs)
+            for (unsigned int b : block_sizes) {
+                L1_Config config = base;
+                config.cache_size = cs;
+                config.associativity = a;
+                config.block_size = b;
+                Trace_Reader trace;
+                if (loaded) {
+                    trace.open(records.data(), records.size());
+                } else if (!trace.open(file_name)) {
+                    std::cerr << trace.error() << "\n";
+                    std::exit(1);
+                }
+                std::cout << "===== RUN: workload=" << input_file << " cs=" << cs
+                          << " assoc=" << a << " blk=" << b << " =====\n";
+                execute(config, trace, threads);
+                std::cout << "\n";
+            }
 }
 
 int main(int argc, char* argv[]) {
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
 
+    L1_Config config;
+
+    // --replacement <policy>, --threads <n> and --classify-misses may appear anywhere
+    unsigned threads = 1;
+    std::vector<char*> positional = {argv[0]};
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--classify-misses") {
+            config.classify_misses = true;
+        } else if (i + 1 < argc && std::string(argv[i]) == "--replacement") {
+            if (!parse_replacement(argv[++i], config.replacement)) {
+                std::cerr << "Unknown replacement policy " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (i + 1 < argc && std::string(argv[i]) == "--threads") {
+            int n = std::atoi(argv[++i]);
+            if (n < 1 || n > 256) {
+                std::cerr << "--threads must be between 1 and 256\n";
+                return 1;
+            }
+            threads = n;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    argc = positional.size();
+    positional.push_back(nullptr);
+    argv = positional.data();
+
     if (argc < 3) {
         std::cerr << "Need protocol and file name\n";
         return 1;
     }
-    config.protocol = argv[1];
-    config.input_file = argv[2];
-    std::cerr << argc << " " << argv[3] << std::endl;
+    std::string input_file = argv[2];
+    // comma-separated lists, e.g. "2048,4096 1,2 16,32", select the
+    // single-pass grid mode over every combination
+    bool grid = false;
+    for (int i = 3; i < argc && i < 6; i++) grid = grid || std::strchr(argv[i], ',');
+
+    // a live workload ring:<name> is read from the ring <name>_0
+    std::string file_name = input_file + (is_ring_path(input_file) ? "_0" : "_0.data");
+    Trace_Reader trace;
+    if (!trace.open(file_name)) {
+        std::cerr << trace.error() << "\n";
+        return 1;
+    }
+
+    if (grid) {
+        std::vector<unsigned int> cache_sizes = argc >= 4 ? parse_list(argv[3]) : std::vector<unsigned int>{config.cache_size};
+        std::vector<unsigned int> assocs = argc >= 5 ? parse_list(argv[4]) : std::vector<unsigned int>{config.associativity};
+        std::vector<unsigned int> block_sizes = argc >= 6 ? parse_list(argv[5]) : std::vector<unsigned int>{config.block_size};
+        for (unsigned int a : assocs) {
+            if (!replacement_supports(config.replacement, a)) {
+                std::cerr << replacement_name(config.replacement) << " does not support associativity " << a << "\n";
+                return 1;
+            }
+        }
+        if (config.replacement == Replacement::LRU) {
+            execute_grid(input_file, trace, cache_sizes, assocs, block_sizes, config.classify_misses);
+        } else {
+            execute_each(input_file, file_name, trace, config, cache_sizes, assocs, block_sizes, threads);
+        }
+        return 0;
+    }
+
     if (argc >= 4) config.cache_size = std::stoi(argv[3]);
     if (argc >= 5) config.associativity = std::stoi(argv[4]);
     if (argc >= 6) config.block_size = std::stoi(argv[5]);
+    if (!replacement_supports(config.replacement, config.associativity)) {
+        std::cerr << replacement_name(config.replacement) << " does not support associativity " << config.associativity << "\n";
+        return 1;
+    }
 
-    L1Cache l1_cache;
-
-    std::string file_name = config.input_file + "_0.data";
-    std::freopen(file_name.c_str(), "r", stdin);
-
-    execute(l1_cache);
+    execute(config, trace, threads);
     return 0;
 }
 
@@ -0,0 +1,1489 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Compressed traces need zlib: link with -lz (and -pthread for the read-ahead
+// thread). zstd traces are piped through the zstd command-line tool.
+
+// One trace record: type 0 = load, 1 = store, 2 = compute.
+// value is the address for loads/stores and the cycle count for compute.
+struct Trace_Record {
+    uint32_t type;
+    uint64_t value;
+};
+
+// Reduced traces (TraceConverter --reduce, binary only) add two types:
+//   3  repeat: the previous load/store again, to the same block. The low 32
+//      bits of value are how many times, the high 32 bits the summed cycles
+//      of the compute records among them and after the last, up to the next
+//      load/store. A single cache hits all of them, whatever its geometry
+//   4  reduced: the first record; value is reduced_format << 48 | the block
+//      size in bytes the blocks were taken at. The trace is exact for any
+//      multiple of it
+const uint32_t repeat_record = 3;
+const uint32_t reduced_record = 4;
+const uint64_t reduced_format = 1; // 0: repeats of up to 7, with a byte per gap
+
+inline uint64_t repeat_count(uint64_t value) {
+    return value & 0xffffffff;
+}
+inline uint64_t repeat_compute(uint64_t value) {
+    return value >> 32;
+}
+// Where a run's compute went is not kept. A timing model spreads it evenly
+// over the gaps before each repeat and after the last: gap i (from 0; the
+// last is gap count) gets base cycles, and one more while i < extra.
+struct Repeat_Gaps {
+    uint64_t base = 0, extra = 0;
+
+    Repeat_Gaps() = default;
+    explicit Repeat_Gaps(uint64_t value)
+        : base(repeat_compute(value) / (repeat_count(value) + 1)), extra(repeat_compute(value) % (repeat_count(value) + 1)) {}
+    uint64_t at(uint64_t i) const {
+        return base + (i < extra);
+    }
+    // the cycles of the gaps before gap i
+    uint64_t before(uint64_t i) const {
+        return i * base + std::min(i, extra);
+    }
+};
+
+inline uint64_t reduced_value(uint64_t block_size) {
+    return reduced_format << 48 | block_size;
+}
+// Why a trace with this reduced record cannot be run with blocks of
+// block_size bytes, or "" if it is exact for them.
+inline std::string reduction_error(uint64_t value, uint64_t block_size) {
+    uint64_t reduced_block = value & ((uint64_t(1) << 48) - 1);
+    if (value >> 48 != reduced_format) {
+        return "trace reduced in an older format: reduce the original again";
+    }
+    if (reduced_block == 0 || block_size % reduced_block != 0) {
+        return "trace reduced for " + std::to_string(reduced_block) + "-byte blocks cannot simulate " +
+               std::to_string(block_size) + "-byte blocks";
+    }
+    return "";
+}
+
+// Binary trace layout (little endian):
+//   Trace_Header, then record_count Trace_Records back to back, 16 bytes
+//   each: type, 4 zero bytes, value.
+// Version 1 traces, with 32-bit values in 8-byte records, are still read.
+// Text traces are the original "<type> 0x<hex>" lines. Readers tell the two
+// apart by the magic, so either can be passed wherever a trace path is expected.
+const char trace_magic[8] = {'C', 'S', 'T', 'R', 'A', 'C', 'E', '\0'};
+const uint32_t trace_version = 2;
+
+// Version 1 record, converted on the way in.
+struct Trace_Record_V1 {
+    uint32_t type;
+    uint32_t value;
+};
+
+struct Trace_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+};
+
+// Size of the header's records if this reader knows its version, else 0.
+inline size_t binary_record_size(const Trace_Header& header) {
+    if (header.version == trace_version && header.record_size == sizeof(Trace_Record)) {
+        return sizeof(Trace_Record);
+    }
+    if (header.version == 1 && header.record_size == sizeof(Trace_Record_V1)) {
+        return sizeof(Trace_Record_V1);
+    }
+    return 0;
+}
+
+// Decodes n records of record_size bytes from p into out.
+inline void read_binary_records(const char* p, size_t record_size, Trace_Record* out, size_t n) {
+    if (record_size == sizeof(Trace_Record)) {
+        std::memcpy(out, p, n * sizeof(Trace_Record));
+        return;
+    }
+    for (size_t i = 0; i < n; i++, p += sizeof(Trace_Record_V1)) {
+        Trace_Record_V1 old;
+        std::memcpy(&old, p, sizeof(old));
+        out[i].type = old.type;
+        out[i].value = old.value;
+    }
+}
+
+// Text traces are parsed in two stages over large buffers: a vector scan
+// collects the positions of up to a batch of newlines (AVX2, SSE2 or memchr),
+// then each line is checked and its hex field decoded 16 bytes at a time
+// (SSE4.2 with a scalar fallback). The kernels are picked once at run time, so
+// the default build runs the vector code on any CPU that has it.
+// A line is "<type> [0x]<hex>" with type 0, 1 or 2, optionally surrounded by
+// blanks; empty lines are skipped. Anything else stops the parse with an error
+// naming the line instead of decoding whatever digits it happens to contain.
+
+// Where a parse that spans several calls has got to.
+struct Text_Parse_State {
+    uint64_t line = 1;  // number of the next line to parse
+    std::string error;  // set at the first malformed line; the parse stops there
+};
+
+enum Line_Kind { LINE_RECORD, LINE_BLANK, LINE_MALFORMED };
+
+inline int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Checks and decodes the line [s, e), e being its '\n' or the end of input.
+inline Line_Kind decode_line(const char* s, const char* e, Trace_Record& out) {
+    while (s < e && (e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t')) e--;
+    while (s < e && (*s == ' ' || *s == '\t')) s++;
+    if (s == e) {
+        return LINE_BLANK;
+    }
+    const char* field = s;
+    uint32_t type = 0;
+    while (s < e && *s >= '0' && *s <= '9' && s - field < 3) type = type * 10 + (*s++ - '0');
+    if (s == field || type > 2 || s == e || (*s != ' ' && *s != '\t')) {
+        return LINE_MALFORMED;
+    }
+    while (s < e && (*s == ' ' || *s == '\t')) s++;
+    if (e - s >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+    if (s == e || e - s > 16) {
+        return LINE_MALFORMED;
+    }
+    uint64_t value = 0;
+    for (; s < e; s++) {
+        int digit = hex_digit(*s);
+        if (digit < 0) {
+            return LINE_MALFORMED;
+        }
+        value = value << 4 | digit;
+    }
+    out.type = type;
+    out.value = value;
+    return LINE_RECORD;
+}
+
+// Stage 1 kernels: store the positions of the next newlines in [p, end), at
+// most max of them, and return how many were found.
+inline size_t find_newlines_scalar(const char* p, const char* end, const char** ends, size_t max) {
+    size_t n = 0;
+    while (n < max && p < end) {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!nl) break;
+        ends[n++] = nl;
+        p = nl + 1;
+    }
+    return n;
+}
+
+// Stage 2 kernels: decode up to n_lines lines, the first starting at p and
+// line i ending at ends[i], into at most max records. Stop early at a
+// malformed line. Return the number of lines consumed; n_out gets the records.
+inline size_t decode_lines_scalar(const char* p, const char* const* ends, size_t n_lines, const char*,
+                                  Trace_Record* out, size_t max, size_t& n_out) {
+    size_t i = 0;
+    n_out = 0;
+    for (; i < n_lines && n_out < max; i++) {
+        Line_Kind kind = decode_line(p, ends[i], out[n_out]);
+        if (kind == LINE_MALFORMED) break;
+        n_out += kind == LINE_RECORD;
+        p = ends[i] + 1;
+    }
+    return i;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define TRACE_SIMD 1
+
+__attribute__((target("avx2")))
+inline size_t find_newlines_avx2(const char* p, const char* end, const char** ends, size_t max) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t n = 0;
+    for (; n < max && end - p >= 32; p += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline));
+        for (; mask && n < max; mask &= mask - 1) {
+            ends[n++] = p + __builtin_ctz(mask);
+        }
+        if (n == max) {
+            return n;
+        }
+    }
+    return n + find_newlines_scalar(p, end, ends + n, max - n);
+}
+
+inline size_t find_newlines_sse2(const char* p, const char* end, const char** ends, size_t max) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t n = 0;
+    for (; n < max && end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        for (; mask && n < max; mask &= mask - 1) {
+            ends[n++] = p + __builtin_ctz(mask);
+        }
+        if (n == max) {
+            return n;
+        }
+    }
+    return n + find_newlines_scalar(p, end, ends + n, max - n);
+}
+
+// The usual "d 0x<hex>" line: PCMPISTRI measures the hex run, then the
+// digits are turned into nibbles, right-aligned with PSHUFB and packed in
+// pairs with PMADDUBSW. Other shapes go through decode_line.
+__attribute__((target("sse4.2")))
+inline size_t decode_lines_sse42(const char* p, const char* const* ends, size_t n_lines, const char* limit,
+                                 Trace_Record* out, size_t max, size_t& n_out) {
+    const __m128i hex_ranges = _mm_setr_epi8('0', '9', 'a', 'f', 'A', 'F', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i ascii_zero = _mm_set1_epi8('0');
+    const __m128i ascii_nine = _mm_set1_epi8('9');
+    const __m128i letter_bias = _mm_set1_epi8('a' - 10);
+    const __m128i lower_case = _mm_set1_epi8(0x20);
+    const __m128i positions = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i nibble_weights = _mm_set1_epi16(0x0110); // high nibble * 16 + low nibble
+    size_t i = 0;
+    n_out = 0;
+    for (; i < n_lines && n_out < max; i++) {
+        const char* e = ends[i];
+        if (limit - p >= 20 && e - p >= 5 && p[0] >= '0' && p[0] <= '2' && p[1] == ' ' && p[2] == '0' && (p[3] | 0x20) == 'x') {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4));
+            int length = _mm_cmpistri(hex_ranges, bytes, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+            const char* stop = p + 4 + length;
+            if (length > 0 && (stop == e || (stop + 1 == e && *stop == '\r'))) {
+                __m128i digits = _mm_sub_epi8(bytes, ascii_zero);
+                __m128i letters = _mm_sub_epi8(_mm_or_si128(bytes, lower_case), letter_bias);
+                __m128i nibbles = _mm_blendv_epi8(digits, letters, _mm_cmpgt_epi8(bytes, ascii_nine));
+                // byte j of the result is nibble j + length - 16, zero where that is negative
+                __m128i aligned = _mm_shuffle_epi8(nibbles, _mm_add_epi8(positions, _mm_set1_epi8(char(length - 16))));
+                __m128i pairs = _mm_maddubs_epi16(aligned, nibble_weights);
+                uint64_t value = __builtin_bswap64(uint64_t(_mm_cvtsi128_si64(_mm_packus_epi16(pairs, pairs))));
+                out[n_out].type = uint32_t(p[0] - '0');
+                out[n_out].value = value;
+                n_out++;
+                p = e + 1;
+                continue;
+            }
+        }
+        Line_Kind kind = decode_line(p, e, out[n_out]);
+        if (kind == LINE_MALFORMED) break;
+        n_out += kind == LINE_RECORD;
+        p = e + 1;
+    }
+    return i;
+}
+#endif
+
+typedef size_t (*Newline_Kernel)(const char*, const char*, const char**, size_t);
+typedef size_t (*Line_Kernel)(const char*, const char* const*, size_t, const char*, Trace_Record*, size_t, size_t&);
+
+struct Text_Kernels {
+    Newline_Kernel find_newlines;
+    Line_Kernel decode_lines;
+};
+
+inline const Text_Kernels& text_kernels() {
+    static const Text_Kernels kernels = [] {
+        Text_Kernels k{find_newlines_scalar, decode_lines_scalar};
+#ifdef TRACE_SIMD
+        // CS_TRACE_SCALAR=1 forces the fallback, e.g. to compare the two
+        if (!std::getenv("CS_TRACE_SCALAR")) {
+            __builtin_cpu_init();
+            k.find_newlines = __builtin_cpu_supports("avx2") ? find_newlines_avx2 : find_newlines_sse2;
+            if (__builtin_cpu_supports("sse4.2")) {
+                k.decode_lines = decode_lines_sse42;
+            }
+        }
+#endif
+        return k;
+    }();
+    return kernels;
+}
+
+// Parses lines from [p, end) into out, at most max records. Returns the number
+// of records written and advances p past the consumed lines. A final line
+// without '\n' is parsed too, so callers hand over whole lines only. On a
+// malformed line p is left on it, state.error is set and every later call
+// returns 0.
+inline size_t parse_text_records(const char*& p, const char* end, Trace_Record* out, size_t max, Text_Parse_State& state) {
+    static constexpr size_t batch = 256;
+    const Text_Kernels& kernels = text_kernels();
+    const char* ends[batch];
+    size_t n = 0;
+    while (n < max && p < end && state.error.empty()) {
+        size_t n_lines = kernels.find_newlines(p, end, ends, std::min(batch, max - n));
+        if (n_lines == 0) {
+            ends[n_lines++] = end; // last line, no newline
+        }
+        size_t written;
+        size_t used = kernels.decode_lines(p, ends, n_lines, end, out + n, max - n, written);
+        n += written;
+        state.line += used;
+        if (used > 0) {
+            p = std::min(end, ends[used - 1] + 1);
+        }
+        if (used < n_lines) {
+            if (n < max) {
+                const char* e = ends[used];
+                while (e > p && e[-1] == '\r') e--;
+                state.error = "line " + std::to_string(state.line) + ": malformed trace record \"" + std::string(p, std::min<size_t>(e - p, 40)) + "\"";
+            }
+            break;
+        }
+    }
+    return n;
+}
+
+// Sequential source of decompressed trace bytes. read() returns the number of
+// bytes read, 0 at the end, or -1 with error set.
+class Byte_Source {
+public:
+    std::string error;
+    virtual ~Byte_Source() {}
+    virtual long read(char* out, size_t n) = 0;
+};
+
+class Gzip_Source : public Byte_Source {
+private:
+    gzFile file;
+public:
+    explicit Gzip_Source(gzFile file): file(file) {
+        gzbuffer(file, 1 << 20);
+    }
+    ~Gzip_Source() {
+        gzclose(file);
+    }
+    long read(char* out, size_t n) override {
+        int r = gzread(file, out, unsigned(n));
+        int code;
+        const char* message = gzerror(file, &code);
+        if (r < 0 || (r == 0 && code != Z_OK)) {
+            error = message;
+            return -1;
+        }
+        return r;
+    }
+};
+
+// One member of a zip archive, stored or deflated.
+class Zip_Member_Source : public Byte_Source {
+private:
+    FILE* file = nullptr;
+    int method = 0;
+    uint64_t remaining = 0; // compressed bytes not yet read
+    z_stream inflater;
+    bool inflating = false;
+    std::vector<unsigned char> input;
+
+    static uint32_t le32(const unsigned char* p) {
+        return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+    }
+    static uint16_t le16(const unsigned char* p) {
+        return p[0] | p[1] << 8;
+    }
+public:
+    ~Zip_Member_Source() {
+        if (inflating) inflateEnd(&inflater);
+        if (file) std::fclose(file);
+    }
+    // An empty member name selects the first entry of the archive.
+    bool open(const std::string& archive, const std::string& member) {
+        file = std::fopen(archive.c_str(), "rb");
+        if (!file) {
+            error = "cannot open trace " + archive;
+            return false;
+        }
+        // the end-of-central-directory record sits in the last 64 KiB + 22 bytes
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        long tail = std::min<long>(size, 65536 + 22);
+        std::vector<unsigned char> buf(tail);
+        std::fseek(file, size - tail, SEEK_SET);
+        if (std::fread(buf.data(), 1, tail, file) != size_t(tail)) {
+            error = "cannot read " + archive;
+            return false;
+        }
+        long eocd = -1;
+        for (long i = tail - 22; i >= 0; i--) {
+            if (le32(&buf[i]) == 0x06054b50) {
+                eocd = i;
+                break;
+            }
+        }
+        if (eocd < 0) {
+            error = archive + " is not a zip archive";
+            return false;
+        }
+        uint16_t entries = le16(&buf[eocd + 10]);
+        uint32_t dir_size = le32(&buf[eocd + 12]);
+        uint32_t dir_offset = le32(&buf[eocd + 16]);
+        std::vector<unsigned char> dir(dir_size);
+        std::fseek(file, dir_offset, SEEK_SET);
+        if (std::fread(dir.data(), 1, dir_size, file) != dir_size) {
+            error = "cannot read the directory of " + archive;
+            return false;
+        }
+        size_t pos = 0;
+        for (int e = 0; e < entries && pos + 46 <= dir.size() && le32(&dir[pos]) == 0x02014b50; e++) {
+            uint16_t name_len = le16(&dir[pos + 28]);
+            uint16_t extra_len = le16(&dir[pos + 30]);
+            uint16_t comment_len = le16(&dir[pos + 32]);
+            std::string name(reinterpret_cast<const char*>(&dir[pos + 46]), name_len);
+            if (member.empty() || name == member) {
+                method = le16(&dir[pos + 10]);
+                remaining = le32(&dir[pos + 20]);
+                uint32_t local = le32(&dir[pos + 42]);
+                if (remaining == 0xffffffff || local == 0xffffffff) {
+                    error = "zip64 member " + name + " is not supported";
+                    return false;
+                }
+                if (method != 0 && method != 8) {
+                    error = "member " + name + " uses an unsupported compression method";
+                    return false;
+                }
+                unsigned char header[30];
+                std::fseek(file, local, SEEK_SET);
+                if (std::fread(header, 1, 30, file) != 30 || le32(header) != 0x04034b50) {
+                    error = "corrupt local header for " + name;
+                    return false;
+                }
+                std::fseek(file, local + 30 + le16(header + 26) + le16(header + 28), SEEK_SET);
+                if (method == 8) {
+                    std::memset(&inflater, 0, sizeof(inflater));
+                    if (inflateInit2(&inflater, -MAX_WBITS) != Z_OK) {
+                        error = "cannot initialise inflate";
+                        return false;
+                    }
+                    inflating = true;
+                    input.resize(1 << 20);
+                }
+                return true;
+            }
+            pos += 46 + name_len + extra_len + comment_len;
+        }
+        error = "no member " + member + " in " + archive;
+        return false;
+    }
+    long read(char* out, size_t n) override {
+        if (method == 0) {
+            size_t want = std::min<uint64_t>(n, remaining);
+            size_t got = std::fread(out, 1, want, file);
+            remaining -= got;
+            return long(got);
+        }
+        inflater.next_out = reinterpret_cast<unsigned char*>(out);
+        inflater.avail_out = unsigned(n);
+        while (inflater.avail_out == n) {
+            if (inflater.avail_in == 0 && remaining > 0) {
+                size_t got = std::fread(input.data(), 1, std::min<uint64_t>(input.size(), remaining), file);
+                if (got == 0) {
+                    error = "truncated zip member";
+                    return -1;
+                }
+                remaining -= got;
+                inflater.next_in = input.data();
+                inflater.avail_in = unsigned(got);
+            }
+            int r = inflate(&inflater, Z_NO_FLUSH);
+            if (r == Z_STREAM_END) {
+                break;
+            }
+            if (r != Z_OK && r != Z_BUF_ERROR) {
+                error = inflater.msg ? inflater.msg : "corrupt zip member";
+                return -1;
+            }
+            if (r == Z_BUF_ERROR && inflater.avail_in == 0 && remaining == 0) {
+                error = "truncated zip member";
+                return -1;
+            }
+        }
+        return long(n - inflater.avail_out);
+    }
+};
+
+// Output of an external decompressor, for formats without a linked library.
+class Command_Source : public Byte_Source {
+private:
+    FILE* pipe = nullptr;
+public:
+    ~Command_Source() {
+        if (pipe) pclose(pipe);
+    }
+    bool open(const std::string& command) {
+        pipe = popen(command.c_str(), "r");
+        if (!pipe) {
+            error = "cannot run " + command;
+        }
+        return pipe != nullptr;
+    }
+    long read(char* out, size_t n) override {
+        if (!pipe) {
+            return 0;
+        }
+        size_t got = std::fread(out, 1, n, pipe);
+        if (got == 0) {
+            int status = pclose(pipe);
+            pipe = nullptr;
+            if (status != 0) {
+                error = "decompressor exited with status " + std::to_string(WEXITSTATUS(status));
+                return -1;
+            }
+        }
+        return long(got);
+    }
+};
+
+// Decodes a compressed trace on a background thread. The thread decompresses,
+// parses (text) or copies (binary) records into fixed-size blocks and hands
+// them over through a bounded queue, so decompression overlaps with the
+// simulation and at most queue_depth blocks are buffered.
+class Trace_Stream {
+private:
+    static constexpr size_t block_records = 1 << 16;
+    static constexpr size_t queue_depth = 8;
+    static constexpr size_t chunk_bytes = 1 << 20;
+
+    std::unique_ptr<Byte_Source> source;
+    std::mutex lock;
+    std::condition_variable ready;   // a block was queued or the stream ended
+    std::condition_variable drained; // a block was taken or the reader is closing
+    std::deque<std::vector<Trace_Record>> full;
+    std::vector<std::vector<Trace_Record>> spare;
+    bool done = false;
+    bool stopping = false;
+    std::string error_message;
+    std::thread worker;
+
+    // returns false if the reader is shutting down
+    bool push(std::vector<Trace_Record>& block, size_t n) {
+        block.resize(n);
+        std::unique_lock<std::mutex> guard(lock);
+        drained.wait(guard, [&] { return full.size() < queue_depth || stopping; });
+        if (stopping) {
+            return false;
+        }
+        full.push_back(std::move(block));
+        block.clear();
+        if (!spare.empty()) {
+            block = std::move(spare.back());
+            spare.pop_back();
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    void run() {
+        std::vector<char> chunk(chunk_bytes);
+        std::vector<Trace_Record> block(block_records);
+        size_t filled = 0;
+        size_t carry = 0; // bytes of an incomplete line or record kept for the next read
+        int format = -1; // -1 unknown, 0 text, 1 binary
+        size_t record_size = 0; // binary
+        Text_Parse_State text;
+        std::string error;
+        bool eof = false;
+        while (!eof) {
+            long n = source->read(chunk.data() + carry, chunk.size() - carry);
+            if (n < 0) {
+                error = source->error;
+                break;
+            }
+            eof = n == 0;
+            size_t avail = carry + n;
+            size_t start = 0;
+            if (format < 0) {
+                if (avail < sizeof(Trace_Header) && !eof) {
+                    carry = avail;
+                    continue;
+                }
+                format = avail >= sizeof(Trace_Header) && std::memcmp(chunk.data(), trace_magic, sizeof(trace_magic)) == 0;
+                if (format == 1) {
+                    Trace_Header header;
+                    std::memcpy(&header, chunk.data(), sizeof(header));
+                    record_size = binary_record_size(header);
+                    if (!record_size) {
+                        error = "unsupported binary trace version";
+                        break;
+                    }
+                    start = sizeof(header);
+                }
+            }
+            size_t usable; // bytes that can be decoded now
+            if (format == 1) {
+                usable = start + (avail - start) / record_size * record_size;
+            } else if (eof) {
+                usable = avail;
+            } else {
+                usable = start;
+                for (size_t i = avail; i > start; i--) {
+                    if (chunk[i - 1] == '\n') {
+                        usable = i;
+                        break;
+                    }
+                }
+            }
+            const char* p = chunk.data() + start;
+            const char* stop = chunk.data() + usable;
+            while (p < stop) {
+                size_t got;
+                if (format == 1) {
+                    got = std::min<size_t>((stop - p) / record_size, block.size() - filled);
+                    read_binary_records(p, record_size, &block[filled], got);
+                    p += got * record_size;
+                } else {
+                    got = parse_text_records(p, stop, &block[filled], block.size() - filled, text);
+                    if (!text.error.empty()) {
+                        error = text.error;
+                    }
+                }
+                filled += got;
+                if (filled == block.size()) {
+                    if (!push(block, filled)) {
+                        return;
+                    }
+                    block.resize(block_records);
+                    filled = 0;
+                } else if (got == 0) {
+                    break; // only blank lines left, or a malformed one
+                }
+            }
+            if (!error.empty()) {
+                break;
+            }
+            carry = avail - usable;
+            std::memmove(chunk.data(), chunk.data() + usable, carry);
+            if (carry == chunk.size()) {
+                error = "trace line longer than the decode buffer";
+                break;
+            }
+        }
+        if (filled > 0) {
+            push(block, filled);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        if (carry != 0 && error.empty() && format == 1) {
+            error = "truncated binary trace";
+        }
+        error_message = error;
+        done = true;
+        ready.notify_one();
+    }
+
+public:
+    explicit Trace_Stream(std::unique_ptr<Byte_Source> byte_source): source(std::move(byte_source)) {
+        worker = std::thread(&Trace_Stream::run, this);
+    }
+    ~Trace_Stream() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        drained.notify_all();
+        worker.join();
+    }
+    // Swaps the next decoded block into `block` and recycles the old one.
+    // Returns false once the stream is exhausted.
+    bool next(std::vector<Trace_Record>& block) {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&] { return !full.empty() || done; });
+        if (block.capacity()) {
+            spare.push_back(std::move(block));
+        }
+        if (full.empty()) {
+            block.clear();
+            return false;
+        }
+        block = std::move(full.front());
+        full.pop_front();
+        drained.notify_one();
+        return true;
+    }
+    std::string error() {
+        std::lock_guard<std::mutex> guard(lock);
+        return error_message;
+    }
+};
+
+inline bool file_exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// Live traces: "ring:<name>" in place of a trace path names a ring of
+// records in POSIX shared memory, written by a producer process while the
+// reader consumes it, one producer and one consumer per ring.
+// The producer creates the ring (Trace_Writer on a ring: path, or
+// Trace_Ring::create); the consumer waits for it to appear, maps it and
+// unlinks the name, so nothing is left behind once both are done.
+// Each side waits for the other, spinning briefly and then sleeping: the
+// producer while the ring is full, the consumer while it is empty. The
+// producer's close() ends the trace; a side whose peer exits without it
+// fails instead of waiting forever.
+const char ring_prefix[] = "ring:";
+const uint64_t ring_magic = 0x474e495243455254; // "TRECRING"
+const size_t ring_default_capacity = 1 << 16;   // records
+
+inline bool is_ring_path(const std::string& path) {
+    return path.compare(0, sizeof(ring_prefix) - 1, ring_prefix) == 0;
+}
+
+// Shared part of a ring; capacity records follow it.
+struct Trace_Ring_Header {
+    std::atomic<uint64_t> magic;    // set last by the producer, once the rest is
+    uint64_t capacity;              // a power of two
+    int32_t producer;               // pids, to notice a peer gone
+    std::atomic<int32_t> consumer;  // 0 until a consumer attaches
+    std::atomic<uint32_t> closed;   // the producer has written everything
+    alignas(64) std::atomic<uint64_t> head; // records consumed
+    alignas(64) std::atomic<uint64_t> tail; // records produced
+    alignas(64) char records[1];
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters are shared between processes");
+
+class Trace_Ring {
+private:
+    Trace_Ring_Header* ring = nullptr;
+    size_t bytes = 0;
+    std::string name;
+    std::string error_message;
+
+    Trace_Record* records() const {
+        return reinterpret_cast<Trace_Record*>(ring->records);
+    }
+    static size_t size_of(uint64_t capacity) {
+        return offsetof(Trace_Ring_Header, records) + capacity * sizeof(Trace_Record);
+    }
+    static bool gone(int32_t pid) {
+        return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+    }
+    static void pause(unsigned& waits) {
+        if (++waits < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    bool map(int fd, size_t length) {
+        void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            error_message = "cannot map ring " + name;
+            return false;
+        }
+        ring = static_cast<Trace_Ring_Header*>(mapping);
+        bytes = length;
+        return true;
+    }
+public:
+    Trace_Ring() {}
+    Trace_Ring(const Trace_Ring&) = delete;
+    Trace_Ring& operator=(const Trace_Ring&) = delete;
+    ~Trace_Ring() {
+        if (ring) {
+            munmap(ring, bytes);
+        }
+    }
+
+    // shared-memory name of a ring: path, less any ring: prefix
+    static std::string shm_name(const std::string& path) {
+        std::string n = is_ring_path(path) ? path.substr(sizeof(ring_prefix) - 1) : path;
+        return n.empty() || n[0] != '/' ? "/" + n : n;
+    }
+
+    // Producer: replaces any ring of that name, e.g. one left by a crash.
+    bool create(const std::string& path, size_t capacity = ring_default_capacity) {
+        name = shm_name(path);
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 || ftruncate(fd, size_of(size)) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            error_message = "cannot create ring " + name;
+            return false;
+        }
+        if (!map(fd, size_of(size))) {
+            return false;
+        }
+        ring->capacity = size;
+        ring->producer = getpid();
+        ring->consumer.store(0, std::memory_order_relaxed);
+        ring->closed.store(0, std::memory_order_relaxed);
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        ring->magic.store(ring_magic, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: waits until the producer has created the ring.
+    bool attach(const std::string& path) {
+        name = shm_name(path);
+        unsigned waits = 0;
+        while (true) {
+            int fd = shm_open(name.c_str(), O_RDWR, 0);
+            struct stat st;
+            if (fd >= 0 && fstat(fd, &st) == 0 && size_t(st.st_size) > offsetof(Trace_Ring_Header, records)) {
+                if (!map(fd, st.st_size)) {
+                    return false;
+                }
+                break;
+            }
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            pause(waits);
+        }
+        while (ring->magic.load(std::memory_order_acquire) != ring_magic) {
+            pause(waits);
+        }
+        if (size_of(ring->capacity) != bytes) {
+            error_message = name + " is not a trace ring";
+            return false;
+        }
+        ring->consumer.store(getpid(), std::memory_order_release);
+        shm_unlink(name.c_str());
+        return true;
+    }
+
+    // Producer: appends n records, waiting while the ring is full. Returns
+    // false if the consumer has exited.
+    bool write(const Trace_Record* in, size_t n) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t mask = ring->capacity - 1;
+        while (n > 0) {
+            unsigned waits = 0;
+            uint64_t head;
+            while ((head = ring->head.load(std::memory_order_acquire)) + ring->capacity == tail) {
+                if (gone(ring->consumer.load(std::memory_order_acquire))) {
+                    error_message = "the consumer of ring " + name + " has exited";
+                    return false;
+                }
+                pause(waits);
+            }
+            size_t k = std::min<uint64_t>(n, head + ring->capacity - tail);
+            k = std::min<uint64_t>(k, ring->capacity - (tail & mask)); // up to the wrap
+            std::memcpy(static_cast<void*>(records() + (tail & mask)), in, k * sizeof(Trace_Record));
+            tail += k;
+            in += k;
+            n -= k;
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // Producer: the end of the trace.
+    void close() {
+        ring->closed.store(1, std::memory_order_release);
+    }
+
+    // Consumer: takes up to max records, waiting while the ring is empty.
+    // Returns 0 at the end of the trace, and on error().
+    size_t read(Trace_Record* out, size_t max) {
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t mask = ring->capacity - 1;
+        uint64_t tail;
+        unsigned waits = 0;
+        while ((tail = ring->tail.load(std::memory_order_acquire)) == head) {
+            if (ring->closed.load(std::memory_order_acquire)) {
+                // records written just before closing
+                tail = ring->tail.load(std::memory_order_acquire);
+                if (tail == head) {
+                    return 0;
+                }
+                break;
+            }
+            if (gone(ring->producer)) {
+                error_message = "the producer of ring " + name + " exited before ending the trace";
+                return 0;
+            }
+            pause(waits);
+        }
+        size_t k = std::min<uint64_t>(max, tail - head);
+        size_t first = std::min<uint64_t>(k, ring->capacity - (head & mask));
+        std::memcpy(static_cast<void*>(out), records() + (head & mask), first * sizeof(Trace_Record));
+        std::memcpy(static_cast<void*>(out + first), records(), (k - first) * sizeof(Trace_Record));
+        ring->head.store(head + k, std::memory_order_release);
+        return k;
+    }
+
+    const std::string& error() const {
+        return error_message;
+    }
+};
+
+// Memory-mapped trace reader. Binary traces are handed out straight from the
+// mapping a window at a time (version 1 ones are converted into a buffer);
+// text traces are decoded a block at a time into a small buffer.
+// gzip, zstd and zip traces (either format inside) are decoded by a
+// Trace_Stream. "archive.zip:member" names one member of a zip archive,
+// "ring:<name>" a live trace in a Trace_Ring, and a missing path is retried
+// with .gz and .zst appended.
+// Pages of the mapping behind the read position are dropped as it advances,
+// so a reader holds at most a few MiB of any trace, however long: a whole
+// simulation needs its cache state plus that per core.
+class Trace_Reader {
+private:
+    static constexpr size_t text_block = 4096;
+    static constexpr size_t binary_window = 1 << 16; // records handed out at once
+    static constexpr size_t release_bytes = 4 << 20; // consumed bytes dropped at once
+
+    const char* data = nullptr;
+    size_t length = 0;
+    bool binary = false;
+    size_t record_size = 0;          // binary: bytes per record in the file
+    const char* binary_pos = nullptr; // binary: next record not handed out
+    const char* binary_end = nullptr;
+    const char* released = nullptr;   // mapping before this is dropped
+    const char* text_pos = nullptr;
+    Text_Parse_State text_state;
+    std::string name; // path, for error messages
+    std::vector<Trace_Record> buffer;
+    const Trace_Record* block_start = nullptr;
+    const Trace_Record* cur = nullptr;
+    const Trace_Record* end = nullptr;
+    uint64_t consumed = 0; // records in blocks before block_start
+    std::string error_message;
+    std::unique_ptr<Trace_Stream> stream;
+    std::unique_ptr<Trace_Ring> ring;
+    bool fed = false;      // records come from feed(), into buffer
+    bool fed_done = false; // and end_feed() said no more will
+
+    // Drops the pages of the mapping wholly before p, which the reader has
+    // consumed; they would be read back from the file if touched again.
+    void release(const char* p) {
+        static const size_t page = size_t(sysconf(_SC_PAGESIZE));
+        if (size_t(p - released) < release_bytes) {
+            return;
+        }
+        const char* upto = data + (p - data) / page * page;
+        if (upto > released) {
+            madvise(const_cast<char*>(released), upto - released, MADV_DONTNEED);
+            released = upto;
+        }
+    }
+
+    bool refill() {
+        if (fed || (binary && !data)) {
+            return false; // records in memory come as one block, fed ones when fed
+        }
+        consumed += end - block_start;
+        if (binary) {
+            release(binary_pos);
+            size_t n = std::min<size_t>(binary_window, (binary_end - binary_pos) / record_size);
+            if (record_size == sizeof(Trace_Record)) {
+                block_start = cur = reinterpret_cast<const Trace_Record*>(binary_pos);
+            } else {
+                read_binary_records(binary_pos, record_size, buffer.data(), n);
+                block_start = cur = buffer.data();
+            }
+            end = cur + n;
+            binary_pos += n * record_size;
+            return n > 0;
+        }
+        if (ring) {
+            size_t n = ring->read(buffer.data(), buffer.size());
+            if (n == 0 && !ring->error().empty()) {
+                error_message = ring->error();
+            }
+            block_start = cur = buffer.data();
+            end = cur + n;
+            return n > 0;
+        }
+        if (stream) {
+            bool more = stream->next(buffer);
+            block_start = cur = buffer.data();
+            end = cur + buffer.size();
+            if (!more && !stream->error().empty()) {
+                error_message = name + ": " + stream->error();
+            }
+            return more;
+        }
+        release(text_pos);
+        size_t n = parse_text_records(text_pos, data + length, buffer.data(), buffer.size(), text_state);
+        if (!text_state.error.empty()) {
+            error_message = name + ": " + text_state.error;
+        }
+        block_start = cur = buffer.data();
+        end = cur + n;
+        return n > 0;
+    }
+
+    bool open_zip(const std::string& archive, const std::string& member) {
+        Zip_Member_Source* source = new Zip_Member_Source();
+        std::unique_ptr<Byte_Source> owner(source);
+        if (!source->open(archive, member)) {
+            error_message = source->error;
+            return false;
+        }
+        return open_stream(std::move(owner));
+    }
+
+    bool open_stream(std::unique_ptr<Byte_Source> source) {
+        stream.reset(new Trace_Stream(std::move(source)));
+        buffer.clear();
+        cur = end = block_start = buffer.data();
+        return true;
+    }
+
+public:
+    Trace_Reader() {}
+    Trace_Reader(const Trace_Reader&) = delete;
+    Trace_Reader& operator=(const Trace_Reader&) = delete;
+    ~Trace_Reader() {
+        close();
+    }
+
+    bool open(std::string path) {
+        close();
+        name = path;
+        size_t zip = path.find(".zip:");
+        if (zip != std::string::npos) {
+            return open_zip(path.substr(0, zip + 4), path.substr(zip + 5));
+        }
+        if (is_ring_path(path)) {
+            ring.reset(new Trace_Ring());
+            if (!ring->attach(path)) {
+                error_message = ring->error();
+                ring.reset();
+                return false;
+            }
+            buffer.resize(binary_window);
+            cur = end = block_start = buffer.data();
+            return true;
+        }
+        if (!file_exists(path)) {
+            for (const char* suffix : {".gz", ".zst"}) {
+                if (file_exists(path + suffix)) {
+                    path += suffix;
+                    break;
+                }
+            }
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error_message = "cannot open trace " + path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            error_message = "cannot stat trace " + path;
+            return false;
+        }
+        length = st.st_size;
+        if (length > 0) {
+            void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                error_message = "cannot map trace " + path;
+                return false;
+            }
+            madvise(mapping, length, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapping);
+        }
+        ::close(fd);
+
+        static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+        static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+        static const unsigned char zip_magic[] = {'P', 'K', 3, 4};
+        if (length >= 2 && std::memcmp(data, gzip_magic, 2) == 0) {
+            close();
+            gzFile file = gzopen(path.c_str(), "rb");
+            if (!file) {
+                error_message = "cannot open trace " + path;
+                return false;
+            }
+            return open_stream(std::unique_ptr<Byte_Source>(new Gzip_Source(file)));
+        }
+        if (length >= 4 && std::memcmp(data, zstd_magic, 4) == 0) {
+            close();
+            std::string quoted = "'";
+            for (char c : path) {
+                quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+            }
+            Command_Source* source = new Command_Source();
+            std::unique_ptr<Byte_Source> owner(source);
+            if (!source->open("zstd -dcq -- " + quoted + "'")) {
+                error_message = source->error;
+                return false;
+            }
+            return open_stream(std::move(owner));
+        }
+        if (length >= 4 && std::memcmp(data, zip_magic, 4) == 0) {
+            close();
+            return open_zip(path, "");
+        }
+
+        Trace_Header header;
+        if (length >= sizeof(header) && std::memcmp(data, trace_magic, sizeof(trace_magic)) == 0) {
+            std::memcpy(&header, data, sizeof(header));
+            record_size = binary_record_size(header);
+            if (!record_size) {
+                error_message = "unsupported binary trace version in " + path;
+                close();
+                return false;
+            }
+            if (header.record_count > (length - sizeof(header)) / record_size) {
+                error_message = "truncated binary trace " + path;
+                close();
+                return false;
+            }
+            binary = true;
+            binary_pos = data + sizeof(header);
+            binary_end = binary_pos + header.record_count * record_size;
+            if (record_size != sizeof(Trace_Record)) {
+                buffer.resize(binary_window);
+            }
+        } else {
+            binary = false;
+            text_pos = data;
+            buffer.resize(text_block);
+        }
+        released = data;
+        cur = end = block_start = buffer.data();
+        return true;
+    }
+
+    // Reads records that are already decoded in memory, e.g. a trace shared by
+    // several simulations. The records must outlive the reader.
+    void open(const Trace_Record* records, size_t n) {
+        close();
+        binary = true;
+        block_start = cur = records;
+        end = records + n;
+    }
+
+    // Reads the records the caller hands over with feed() as it produces
+    // them, e.g. a program driving the simulator directly. next() returns
+    // false whenever they run out; starved() tells that from the end of the
+    // trace, which end_feed() marks.
+    void open_feed() {
+        close();
+        fed = true;
+        buffer.clear();
+        cur = end = block_start = buffer.data();
+    }
+
+    // Copies the records in after those not yet consumed. The consumed ones
+    // are dropped once they are at least half the buffer, so it stays within
+    // twice the records outstanding.
+    void feed(const Trace_Record* records, size_t n) {
+        size_t done = cur - block_start;
+        if (done > 0 && 2 * done >= buffer.size()) {
+            buffer.erase(buffer.begin(), buffer.begin() + done);
+            consumed += done;
+            done = 0;
+        }
+        buffer.insert(buffer.end(), records, records + n);
+        block_start = buffer.data();
+        cur = block_start + done;
+        end = block_start + buffer.size();
+    }
+
+    void end_feed() {
+        fed_done = true;
+    }
+
+    // fed records all consumed, but more may come
+    bool starved() const {
+        return fed && !fed_done && cur == end;
+    }
+
+    void close() {
+        stream.reset();
+        ring.reset();
+        fed = fed_done = false;
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+        }
+        data = nullptr;
+        length = 0;
+        binary = false;
+        record_size = 0;
+        binary_pos = binary_end = released = nullptr;
+        cur = end = block_start = nullptr;
+        consumed = 0;
+        text_state = Text_Parse_State();
+    }
+
+    bool next(Trace_Record& record) {
+        if (cur == end && !refill()) {
+            return false;
+        }
+        record = *cur++;
+        return true;
+    }
+
+    // Hands out every record not yet consumed by next() up to the end of the
+    // current block; n is set to the count. Returns false at end of trace.
+    bool next_block(const Trace_Record*& records, size_t& n) {
+        if (cur == end && !refill()) {
+            return false;
+        }
+        records = cur;
+        n = end - cur;
+        cur = end;
+        return true;
+    }
+
+    // Skips n records, e.g. to resume from a checkpoint. Returns false if the
+    // trace ends first.
+    bool skip(uint64_t n) {
+        while (n > 0) {
+            if (cur == end && !refill()) {
+                return false;
+            }
+            uint64_t step = std::min<uint64_t>(n, end - cur);
+            cur += step;
+            n -= step;
+        }
+        return true;
+    }
+
+    bool is_binary() const {
+        return binary;
+    }
+    // read from a Trace_Ring
+    bool is_live() const {
+        return ring != nullptr;
+    }
+    // number of records handed out so far
+    uint64_t position() const {
+        return consumed + (cur - block_start);
+    }
+    const std::string& error() const {
+        return error_message;
+    }
+};
+
+// Decodes the rest of an open trace into records. A trace of more than
+// max_records records is not loaded: false is returned with records and error
+// empty, and the caller streams it through a Trace_Reader instead. A live
+// trace is loaded whole, as it cannot be read again.
+inline bool load_trace(Trace_Reader& reader, std::vector<Trace_Record>& records, std::string& error,
+                       size_t max_records = SIZE_MAX) {
+    error.clear();
+    records.clear();
+    if (reader.is_live()) {
+        max_records = SIZE_MAX;
+    }
+    const Trace_Record* block;
+    size_t n;
+    while (reader.next_block(block, n)) {
+        if (n > max_records - records.size()) {
+            std::vector<Trace_Record>().swap(records);
+            return false;
+        }
+        records.insert(records.end(), block, block + n);
+    }
+    error = reader.error();
+    return error.empty();
+}
+
+inline bool load_trace(const std::string& path, std::vector<Trace_Record>& records, std::string& error,
+                       size_t max_records = SIZE_MAX) {
+    Trace_Reader reader;
+    if (!reader.open(path)) {
+        records.clear();
+        error = reader.error();
+        return false;
+    }
+    return load_trace(reader, records, error, max_records);
+}
+
+// Streams a trace into the reduced form (see repeat_record). Consecutive
+// compute records are summed first, except zero-cycle ones, which still
+// cost the core a cycle each. Then each load/store of the same type and
+// block as the load/store before it, with nothing or a summed compute
+// record between them, goes into a repeat record, which also takes the
+// compute record after its last repeat. The simulators count a repeat
+// record's hits and compute at once, so their hits, misses and cycles are
+// those of the original trace, except that a coherent simulator places
+// the compute within a run evenly (see Repeat_Gaps), which only tells when
+// another core touches the block during the run.
+class Trace_Reducer {
+private:
+    uint64_t block_size;
+    bool started = false;
+    bool has_access = false;
+    Trace_Record access{};  // the last load/store, written already
+    uint64_t run = 0;       // repeats of it not written yet
+    uint64_t run_compute = 0;
+    bool has_compute = false;
+    Trace_Record compute{}; // not written yet: it may go into the run
+
+    // whether the run can take the compute record too
+    bool fits(const Trace_Record& record) const {
+        return record.value > 0 && run_compute + record.value <= UINT32_MAX;
+    }
+    void end_run(std::vector<Trace_Record>& out) {
+        if (!run) {
+            return;
+        }
+        if (has_compute && fits(compute)) {
+            run_compute += compute.value;
+            has_compute = false;
+        }
+        out.push_back({repeat_record, run_compute << 32 | run});
+        run = 0;
+        run_compute = 0;
+    }
+    void flush_compute(std::vector<Trace_Record>& out) {
+        end_run(out);
+        if (has_compute) {
+            out.push_back(compute);
+            has_compute = false;
+        }
+    }
+public:
+    explicit Trace_Reducer(uint64_t block_size): block_size(block_size) {}
+
+    // Appends what n more records reduce to; false if one of them is not a
+    // load, store or compute record (the input is reduced already).
+    bool reduce(const Trace_Record* records, size_t n, std::vector<Trace_Record>& out) {
+        if (!started) {
+            out.push_back({reduced_record, reduced_value(block_size)});
+            started = true;
+        }
+        for (size_t i = 0; i < n; i++) {
+            const Trace_Record& record = records[i];
+            if (record.type > 2) {
+                return false;
+            }
+            if (record.type == 2) {
+                if (has_compute && record.value > 0 && compute.value > 0 && compute.value <= uint64_t(INT64_MAX) - record.value) {
+                    compute.value += record.value;
+                    continue;
+                }
+                if (has_compute) {
+                    flush_compute(out);
+                }
+                compute = record;
+                has_compute = true;
+                continue;
+            }
+            if (has_access && record.type == access.type && record.value / block_size == access.value / block_size &&
+                run < UINT32_MAX && (!has_compute || fits(compute))) {
+                run_compute += has_compute ? compute.value : 0;
+                run++;
+                has_compute = false;
+                continue;
+            }
+            flush_compute(out);
+            out.push_back(record);
+            access = record;
+            has_access = true;
+        }
+        return true;
+    }
+    void finish(std::vector<Trace_Record>& out) {
+        if (!started) {
+            out.push_back({reduced_record, reduced_value(block_size)});
+            started = true;
+        }
+        flush_compute(out);
+    }
+};
+
+// Writes a binary trace; the header's record count is patched on finish().
+// A ring: path writes a live trace into a new Trace_Ring instead, which
+// finish() ends.
+class Trace_Writer {
+private:
+    FILE* out = nullptr;
+    uint64_t count = 0;
+    std::vector<Trace_Record> staging; // copies with the padding zeroed
+    std::unique_ptr<Trace_Ring> ring;
+    bool ring_ok = true;
+    bool written = true; // every record reached the file, so far
+public:
+    ~Trace_Writer() {
+        finish();
+    }
+    bool open(const std::string& path) {
+        if (is_ring_path(path)) {
+            ring.reset(new Trace_Ring());
+            ring_ok = ring->create(path);
+            return ring_ok;
+        }
+        out = std::fopen(path.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+        Trace_Header header;
+        std::memcpy(header.magic, trace_magic, sizeof(trace_magic));
+        header.version = trace_version;
+        header.record_size = sizeof(Trace_Record);
+        header.record_count = 0;
+        count = 0;
+        written = std::fwrite(&header, sizeof(header), 1, out) == 1;
+        return written;
+    }
+    void write(const Trace_Record* records, size_t n) {
+        if (ring) {
+            ring_ok = ring_ok && ring->write(records, n);
+            return;
+        }
+        staging.resize(std::min<size_t>(n, 1 << 16));
+        std::memset(static_cast<void*>(staging.data()), 0, staging.size() * sizeof(Trace_Record));
+        for (size_t done = 0; done < n;) {
+            size_t k = std::min(n - done, staging.size());
+            for (size_t i = 0; i < k; i++) {
+                staging[i].type = records[done + i].type;
+                staging[i].value = records[done + i].value;
+            }
+            written = std::fwrite(staging.data(), sizeof(Trace_Record), k, out) == k && written;
+            done += k;
+        }
+        count += n;
+    }
+    bool finish() {
+        if (ring) {
+            if (ring_ok) {
+                ring->close();
+            }
+            ring.reset();
+            return ring_ok;
+        }
+        if (!out) {
+            return true;
+        }
+        // a short write (a full disk, say) fails here rather than in write()
+        bool ok = written && std::fseek(out, offsetof(Trace_Header, record_count), SEEK_SET) == 0
+               && std::fwrite(&count, sizeof(count), 1, out) == 1;
+        ok = std::fclose(out) == 0 && ok;
+        out = nullptr;
+        return ok;
+    }
+};
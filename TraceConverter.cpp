@@ -0,0 +1,109 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "Trace.h"
+
+// output size over input size
+static double ratio(uint64_t output, uint64_t input) {
+    return input ? double(output) / double(input) : 0.0;
+}
+
+// Converts a text trace ("<type> 0x<hex>" per line) to the binary format in
+// Trace.h. Both simulators detect the format on open, so the output can
+// replace the .data file it was made from.
+// With --reduce <block size> the output is also reduced (see Trace_Reducer):
+// a run of same-type records to one block becomes a count and the compute
+// between them. SimpleCacheSimulator gives the same results from it for that
+// block size and its multiples, as does CacheSimulator with one blocking core;
+// with several cores or MSHRs the compute inside a run is spread evenly, so
+// cycles can move slightly. On the bundled blackscholes traces it keeps 57% of
+// the records at 32-byte blocks and 72% at 16; a binary record takes 16 bytes
+// against about 10 for a text line, so the reduced file is near the size of
+// the text at 32 bytes and larger at 16. The converter prints both ratios.
+// Either path may be a live trace ring:<name> (see Trace_Ring): an output
+// ring replays a trace into a simulator reading that ring, at the pace the
+// simulator takes it.
+int main(int argc, char* argv[]) {
+    uint64_t reduce_block = 0;
+    if (argc == 5 && std::string(argv[1]) == "--reduce") {
+        try {
+            reduce_block = std::stoull(argv[2]);
+        } catch (...) {
+        }
+        if (reduce_block == 0) {
+            std::cerr << "Invalid block size " << argv[2] << std::endl;
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " [--reduce <block size>] <input trace> <output trace>" << std::endl;
+        return 1;
+    }
+    std::string input = argv[1];
+    std::string output = argv[2];
+    if (input == output) {
+        std::cerr << "Input and output must be different files" << std::endl;
+        return 1;
+    }
+
+    Trace_Reader reader;
+    if (!reader.open(input)) {
+        std::cerr << reader.error() << std::endl;
+        return 1;
+    }
+    Trace_Writer writer;
+    if (!writer.open(output)) {
+        std::cerr << "cannot write " << output << std::endl;
+        return 1;
+    }
+    Trace_Reducer reducer(reduce_block);
+    std::vector<Trace_Record> reduced;
+    uint64_t written = 0;
+    const Trace_Record* records;
+    size_t n;
+    while (reader.next_block(records, n)) {
+        if (!reduce_block) {
+            writer.write(records, n);
+            written += n;
+            continue;
+        }
+        reduced.clear();
+        if (!reducer.reduce(records, n, reduced)) {
+            std::cerr << input << " is a reduced trace already" << std::endl;
+            return 1;
+        }
+        writer.write(reduced.data(), reduced.size());
+        written += reduced.size();
+    }
+    if (!reader.error().empty()) {
+        std::cerr << reader.error() << std::endl;
+        return 1;
+    }
+    if (reduce_block) {
+        reduced.clear();
+        reducer.finish(reduced);
+        writer.write(reduced.data(), reduced.size());
+        written += reduced.size();
+    }
+    if (!writer.finish()) {
+        std::cerr << "cannot write " << output << std::endl;
+        return 1;
+    }
+    std::cout << input << " -> " << output << ": " << reader.position() << " records";
+    if (reduce_block) {
+        std::cout << ", " << written << " reduced (" << std::fixed << std::setprecision(2)
+                  << ratio(written, reader.position()) << "x)";
+    }
+    struct stat in_stat, out_stat; // rings have no size
+    if (stat(input.c_str(), &in_stat) == 0 && S_ISREG(in_stat.st_mode) && stat(output.c_str(), &out_stat) == 0 &&
+        S_ISREG(out_stat.st_mode)) {
+        std::cout << ", " << in_stat.st_size << " -> " << out_stat.st_size << " bytes (" << std::fixed
+                  << std::setprecision(2) << ratio(uint64_t(out_stat.st_size), uint64_t(in_stat.st_size)) << "x)";
+    }
+    std::cout << std::endl;
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "Trace.h"
+
+// Writes synthetic workloads in the layout the simulators read,
+// ./<name>_four/<name>_0..3.data, as binary traces. Every load/store is
+// followed by a short compute record, roughly the mix of the bundled traces.
+//   sequential  each core streams through its own region word by word
+//   strided     each core walks its own region `param` bytes at a time
+//   random      uniform words in each core's own region
+//   zipf        words from each core's own region, block ranks drawn from a
+//               Zipf distribution with exponent `param` / 100 (hot set)
+//   prodcons    core 0 writes a shared ring buffer, cores 1-3 read it back
+//               one block behind each other
+// The same arguments always give the same traces.
+
+const int n_files = 4;
+const uint32_t word = 4;
+const uint32_t block = 64; // granule of the zipf ranks and the prodcons lag
+const uint32_t compute_cycles = 2;
+
+struct Pattern {
+    std::string name;
+    uint32_t default_param;
+};
+
+const Pattern patterns[] = {{"sequential", 0}, {"strided", 128}, {"random", 0}, {"zipf", 99}, {"prodcons", 0}};
+
+// Block ranks 0..n-1 with P(rank k) proportional to 1 / (k + 1)^s, sampled
+// from the cumulative distribution.
+class Zipf_Sampler {
+private:
+    std::vector<double> cdf;
+public:
+    Zipf_Sampler(uint32_t n, double s) {
+        cdf.resize(n);
+        double sum = 0;
+        for (uint32_t k = 0; k < n; k++) {
+            sum += 1.0 / std::pow(k + 1.0, s);
+            cdf[k] = sum;
+        }
+        for (double& c : cdf) {
+            c /= sum;
+        }
+    }
+    template <class Random>
+    uint32_t operator()(Random& random) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+// Fills `out` with the memory records of one core; compute records are
+// interleaved by the caller.
+void generate(const std::string& pattern, int core, uint64_t n, uint64_t footprint, uint32_t param, uint64_t seed,
+              std::vector<Trace_Record>& out) {
+    // private regions are disjoint and footprint-aligned; the shared buffer
+    // of prodcons sits above all of them
+    const uint64_t base = uint64_t(core) * footprint;
+    const uint64_t shared = uint64_t(n_files) * footprint;
+    std::mt19937_64 random(seed * n_files + core);
+    std::uniform_int_distribution<uint64_t> words(0, footprint / word - 1);
+    std::uniform_int_distribution<uint32_t> coin(0, 3);
+    Zipf_Sampler zipf(pattern == "zipf" ? uint32_t(footprint / block) : 1, param / 100.0);
+    std::vector<uint32_t> scramble; // rank -> block, so hot blocks are spread over the sets
+    if (pattern == "zipf") {
+        scramble.resize(footprint / block);
+        for (uint32_t i = 0; i < scramble.size(); i++) {
+            scramble[i] = i;
+        }
+        std::shuffle(scramble.begin(), scramble.end(), random);
+    }
+
+    out.clear();
+    out.reserve(n);
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint32_t type = 0;
+        uint64_t address;
+        if (pattern == "sequential") {
+            address = base + offset % footprint;
+            offset += word;
+            type = coin(random) == 0; // one store in four
+        } else if (pattern == "strided") {
+            address = base + offset % footprint;
+            offset += param;
+            if (offset % footprint < param) {
+                offset += word; // next pass touches the next word of every stride
+            }
+            type = coin(random) == 0;
+        } else if (pattern == "random") {
+            address = base + words(random) * word;
+            type = coin(random) == 0;
+        } else if (pattern == "zipf") {
+            uint32_t rank = zipf(random);
+            address = base + uint64_t(scramble[rank]) * block + (words(random) % (block / word)) * word;
+            type = coin(random) == 0;
+        } else {
+            // the consumers trail the producer by `core` blocks of the ring
+            uint64_t lag = uint64_t(core) * block;
+            address = shared + (offset + footprint - lag % footprint) % footprint;
+            offset += word;
+            type = core == 0;
+        }
+        out.push_back({type, address});
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <pattern> <name> [loads/stores per core] [footprint bytes] [param] [seed]" << std::endl;
+        std::cerr << "Patterns: sequential, strided (param: stride in bytes, default 128), random," << std::endl;
+        std::cerr << "zipf (param: exponent x 100, default 99), prodcons." << std::endl;
+        std::cerr << "Writes ./<name>_four/<name>_0..3.data." << std::endl;
+        return 1;
+    }
+    std::string pattern = argv[1];
+    std::string name = argv[2];
+    uint64_t n = argc >= 4 ? std::stoull(argv[3]) : 1000000;
+    uint64_t footprint = argc >= 5 ? std::stoull(argv[4]) : 1 << 20;
+    uint64_t seed = argc >= 7 ? std::stoull(argv[6]) : 1;
+    const Pattern* chosen = nullptr;
+    for (const Pattern& p : patterns) {
+        if (p.name == pattern) {
+            chosen = &p;
+        }
+    }
+    if (!chosen) {
+        std::cerr << "Unknown pattern " << pattern << std::endl;
+        return 1;
+    }
+    uint32_t param = argc >= 6 ? std::stoul(argv[5]) : chosen->default_param;
+    if (footprint < block || footprint % block != 0 || footprint > UINT64_MAX / (n_files + 1)) {
+        std::cerr << "footprint must be a multiple of " << block << " and fit " << n_files + 1 << " times in 64 bits" << std::endl;
+        return 1;
+    }
+    if (pattern == "zipf" && footprint / block > UINT32_MAX) {
+        std::cerr << "zipf footprint must be under " << uint64_t(UINT32_MAX) * block << " bytes" << std::endl;
+        return 1;
+    }
+    if (pattern == "strided" && (param == 0 || param % word != 0)) {
+        std::cerr << "stride must be a positive multiple of " << word << std::endl;
+        return 1;
+    }
+
+    std::string directory = name + "_four";
+    mkdir(directory.c_str(), 0777);
+    std::vector<Trace_Record> accesses;
+    std::vector<Trace_Record> records;
+    for (int core = 0; core < n_files; core++) {
+        generate(pattern, core, n, footprint, param, seed, accesses);
+        records.clear();
+        records.reserve(2 * accesses.size());
+        for (const Trace_Record& access : accesses) {
+            records.push_back(access);
+            records.push_back({2, compute_cycles});
+        }
+        std::string path = directory + "/" + name + "_" + std::to_string(core) + ".data";
+        Trace_Writer writer;
+        if (!writer.open(path)) {
+            std::cerr << "cannot write " << path << std::endl;
+            return 1;
+        }
+        writer.write(records.data(), records.size());
+        if (!writer.finish()) {
+            std::cerr << "cannot write " << path << std::endl;
+            return 1;
+        }
+    }
+    std::cout << directory << ": " << pattern << ", " << n << " loads/stores per core" << std::endl;
+    return 0;
+}
@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+set -euo pipefail
+# Simulator throughput: times CacheSimulator and SimpleCacheSimulator over
+# the bundled and synthetic workloads and a cache geometry matrix, and writes
+# one CSV row per run. Run from the repository root after building
+#   g++ -O2 -std=c++17 -pthread -o CacheSimulator CacheSimulator.cpp -lz
+#   g++ -O2 -std=c++17 -pthread -o SimpleCacheSimulator SimpleCacheSimulator.cpp -lz
+#   g++ -O2 -std=c++17 -o TraceGenerator TraceGenerator.cpp -lz
+# The bounded-memory check is memcheck.sh, the cost of --classify-misses
+# classcheck.sh.
+OUT="${OUT:-bench.csv}"
+CS="${CS:-./CacheSimulator}"
+SIMPLE="${SIMPLE:-./SimpleCacheSimulator}"
+GENERATOR="${GENERATOR:-./TraceGenerator}"
+REPEAT="${REPEAT:-3}"          # best of REPEAT runs is reported
+OPS="${OPS:-1000000}"          # loads/stores per core in synthetic traces
+
+PROTOCOLS=(MESI Dragon)
+CACHE_SIZES=(4096 32768)
+ASSOCS=(1 4)
+BLOCKS=(32 64)
+
+# Bundled workloads without all four traces are skipped
+BUNDLED=(bodytrack blackscholes fluidanimate)
+# name:pattern:footprint, generated into ./<name>_four once. The prodcons ring
+# fits in every cache of the matrix, so its blocks stay shared and the
+# producer's stores invalidate or update the consumers' copies
+SYNTHETIC=(syn_sequential:sequential:1048576 syn_strided:strided:1048576 syn_random:random:1048576
+           syn_zipf:zipf:4194304 syn_prodcons:prodcons:2048)
+
+workloads=()
+for w in "${BUNDLED[@]}"; do
+  complete=1
+  for core in 0 1 2 3; do
+    [[ -f "${w}_four/${w}_${core}.data" ]] || complete=0
+  done
+  if [[ $complete == 1 || -f "${w}_four.zip" ]]; then
+    workloads+=("$w")
+  else
+    echo "skipping ${w}: no traces" >&2
+  fi
+done
+for s in "${SYNTHETIC[@]}"; do
+  IFS=: read -r name pattern footprint <<< "$s"
+  if [[ ! -f "${name}_four/${name}_3.data" ]]; then
+    "${GENERATOR}" "$pattern" "$name" "$OPS" "$footprint" >&2
+  fi
+  workloads+=("$name")
+done
+
+# SimpleCacheSimulator takes the path of the core 0 trace without "_0.data"
+simple_input() {
+  if [[ -d "${1}_four" ]]; then echo "${1}_four/${1}"; else echo "${1}_four.zip:${1}"; fi
+}
+
+# best-of-REPEAT wall time in nanoseconds of "$@"; the last output is kept
+# in $log
+log="$(mktemp)"
+trap 'rm -f "$log"' EXIT
+best_time() {
+  local best="" start end
+  for ((r = 0; r < REPEAT; r++)); do
+    start=$(date +%s%N)
+    "$@" > "$log" 2>/dev/null
+    end=$(date +%s%N)
+    if [[ -z "$best" ]] || (( end - start < best )); then best=$((end - start)); fi
+  done
+  echo "$best"
+}
+
+echo "simulator,protocol,workload,cache_size,associativity,block_size,mem_ops,seconds,mops_per_sec" > "$OUT"
+row() { # simulator protocol workload size assoc block ops nanoseconds
+  awk -v ns="$8" -v ops="$7" -v prefix="$1,$2,$3,$4,$5,$6" \
+    'BEGIN {printf "%s,%d,%.6f,%.3f\n", prefix, ops, ns / 1e9, (ns > 0 ? ops * 1e3 / ns : 0)}' | tee -a "$OUT"
+}
+
+for w in "${workloads[@]}"; do
+  for size in "${CACHE_SIZES[@]}"; do
+    for assoc in "${ASSOCS[@]}"; do
+      for block in "${BLOCKS[@]}"; do
+        for protocol in "${PROTOCOLS[@]}"; do
+          t=$(best_time "$CS" "$protocol" "$w" "$size" "$assoc" "$block")
+          ops=$(awk '/^3\. Load\/Store/ {f = 1; next} f && /Core/ {s += $3} f && /^$/ {f = 0} END {print s + 0}' "$log")
+          row CacheSimulator "$protocol" "$w" "$size" "$assoc" "$block" "$ops" "$t"
+        done
+        t=$(best_time "$SIMPLE" MESI "$(simple_input "$w")" "$size" "$assoc" "$block")
+        ops=$(awk '/^(Loads|Stores):/ {s += $2} END {print s + 0}' "$log")
+        row SimpleCacheSimulator - "$w" "$size" "$assoc" "$block" "$ops" "$t"
+      done
+    done
+  done
+done
@@ -0,0 +1,66 @@
+#!/usr/bin/env bash
+set -euo pipefail
+# Cost of miss classification: times every run with and without
+# --classify-misses and fails if classifying takes more than CLASS_FACTOR
+# times as long. Covers SimpleCacheSimulator's single cache, single-pass
+# grid and set-sharded run, and CacheSimulator, over a random trace whose
+# footprint dwarfs the caches (almost every access misses the shadow) and a
+# Zipf one (mostly hits). The sharded run is skipped on fewer cores than
+# its threads, whose work then adds up rather than overlapping. Run from the repository root after building as
+# for bench.sh; traces are generated into a temporary directory.
+CS="$(realpath "${CS:-./CacheSimulator}")"
+SIMPLE="$(realpath "${SIMPLE:-./SimpleCacheSimulator}")"
+GENERATOR="$(realpath "${GENERATOR:-./TraceGenerator}")"
+CLASS_OPS="${CLASS_OPS:-4000000}" # loads/stores per core
+CLASS_FACTOR="${CLASS_FACTOR:-2}"  # classifying run's time over the plain one's
+REPEAT="${REPEAT:-5}"              # best of REPEAT runs is compared
+
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+# best wall times in seconds of REPEAT runs of "$@" without and with
+# --classify-misses, taken in turn so both see the same load
+best_times() {
+  python3 -c 'import os, sys, time
+null = os.open(os.devnull, os.O_WRONLY)
+actions = [(os.POSIX_SPAWN_DUP2, null, 1), (os.POSIX_SPAWN_DUP2, null, 2)]
+best = [None, None]
+for _ in range(int(sys.argv[1])):
+    for i, extra in enumerate([[], ["--classify-misses"]]):
+        argv = sys.argv[2:] + extra
+        start = time.monotonic()
+        pid = os.posix_spawn(argv[0], argv, os.environ, file_actions=actions)
+        if os.waitpid(pid, 0)[1] != 0:
+            sys.exit("%s failed" % " ".join(argv))
+        elapsed = time.monotonic() - start
+        best[i] = elapsed if best[i] is None else min(best[i], elapsed)
+print("%.3f %.3f" % tuple(best))' "$REPEAT" "$@"
+}
+
+"$GENERATOR" random rand "$CLASS_OPS" 16777216 >&2
+"$GENERATOR" zipf zipf "$CLASS_OPS" 4194304 >&2
+
+status=0
+check() { # label command...
+  local label="$1" plain classified
+  shift
+  read -r plain classified < <(best_times "$@")
+  echo "$label: ${plain}s, ${classified}s with --classify-misses" >&2
+  if awk -v p="$plain" -v c="$classified" -v f="$CLASS_FACTOR" 'BEGIN {exit !(c > p * f)}'; then
+    echo "$label: classifying misses costs over ${CLASS_FACTOR}x" >&2
+    status=1
+  fi
+}
+for trace in rand zipf; do
+  check "SimpleCacheSimulator $trace" "$SIMPLE" MESI "${trace}_four/${trace}" 32768 4 32
+  check "SimpleCacheSimulator $trace grid" "$SIMPLE" MESI "${trace}_four/${trace}" 4096,32768 1,4 32,64
+  # the shadow runs on a thread of its own next to the 4 shards
+  if [ "$(nproc)" -gt 4 ]; then
+    check "SimpleCacheSimulator $trace --threads 4" "$SIMPLE" MESI "${trace}_four/${trace}" 32768 4 32 --threads 4
+  else
+    echo "SimpleCacheSimulator $trace --threads 4: skipped, needs 5 cores" >&2
+  fi
+  check "CacheSimulator $trace" "$CS" MESI "$trace" 32768 4 32
+done
+exit "$status"
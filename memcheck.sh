@@ -0,0 +1,62 @@
+#!/usr/bin/env bash
+set -euo pipefail
+# Bounded memory: runs both simulators over a short and an 8 times longer
+# trace and fails if the long run's peak resident set exceeds the short
+# one's by more than MEM_FACTOR. Two traces per length: a random one over a
+# fixed 1MB per core, and a sequential stream whose footprint grows with
+# the trace, every block touched once. --sharing-report keeps every block
+# the trace touches, so it is checked on the random trace only. Run from the
+# repository root after building as for bench.sh; traces are generated into
+# a temporary directory.
+CS="$(realpath "${CS:-./CacheSimulator}")"
+SIMPLE="$(realpath "${SIMPLE:-./SimpleCacheSimulator}")"
+GENERATOR="$(realpath "${GENERATOR:-./TraceGenerator}")"
+MEM_OPS="${MEM_OPS:-250000}"   # loads/stores per core of the short traces
+MEM_FACTOR="${MEM_FACTOR:-1.5}" # long run's peak RSS over the short one's
+
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+# peak resident set in KB of "$@", as the kernel accounted it at exit
+peak_rss() {
+  python3 -c 'import os, sys
+null = os.open(os.devnull, os.O_WRONLY)
+actions = [(os.POSIX_SPAWN_DUP2, null, 1), (os.POSIX_SPAWN_DUP2, null, 2)]
+pid = os.posix_spawn(sys.argv[1], sys.argv[1:], os.environ, file_actions=actions)
+print(os.wait4(pid, 0)[2].ru_maxrss)' "$@"
+}
+
+long_ops=$((MEM_OPS * 8))
+"$GENERATOR" random rand_short "$MEM_OPS" 1048576 >&2
+"$GENERATOR" random rand_long "$long_ops" 1048576 >&2
+# one word per load/store: the footprint is the whole stream, in 64-byte units
+"$GENERATOR" sequential seq_short "$MEM_OPS" $(((MEM_OPS * 4 + 63) / 64 * 64)) >&2
+"$GENERATOR" sequential seq_long "$long_ops" $(((long_ops * 4 + 63) / 64 * 64)) >&2
+
+status=0
+check() { # label short-args long-args
+  local short long
+  short=$(peak_rss $2)
+  long=$(peak_rss $3)
+  echo "$1 peak RSS: ${short} KB (${MEM_OPS} ops/core), ${long} KB (${long_ops} ops/core)" >&2
+  if awk -v s="$short" -v l="$long" -v f="$MEM_FACTOR" 'BEGIN {exit !(l > s * f)}'; then
+    echo "$1: memory grows with the trace length (over ${MEM_FACTOR}x)" >&2
+    status=1
+  fi
+}
+for trace in rand seq; do
+  check "CacheSimulator $trace" "$CS MESI ${trace}_short 32768 4 32" "$CS MESI ${trace}_long 32768 4 32"
+  if [ "$trace" = rand ]; then
+    check "CacheSimulator $trace --sharing-report" "$CS MESI ${trace}_short 32768 4 32 --sharing-report" \
+      "$CS MESI ${trace}_long 32768 4 32 --sharing-report"
+  fi
+  check "CacheSimulator $trace --classify-misses" "$CS MESI ${trace}_short 32768 4 32 --classify-misses" \
+    "$CS MESI ${trace}_long 32768 4 32 --classify-misses"
+  check "SimpleCacheSimulator $trace" "$SIMPLE MESI ${trace}_short_four/${trace}_short 32768 4 32" \
+    "$SIMPLE MESI ${trace}_long_four/${trace}_long 32768 4 32"
+  check "SimpleCacheSimulator $trace --classify-misses" \
+    "$SIMPLE MESI ${trace}_short_four/${trace}_short 32768 4 32 --classify-misses" \
+    "$SIMPLE MESI ${trace}_long_four/${trace}_long 32768 4 32 --classify-misses"
+done
+exit "$status"
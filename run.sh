@@ -1,26 +1,27 @@
 #!/usr/bin/env bash
 set -euo pipefail
 OUT="output.txt"
-: > "$OUT" 
 EXEC="./CacheSimulator"
 PROTOCOL="MESI"
+FORMAT="${FORMAT:-text}"   # text table, or json / csv for scripts
 
 # Sweep configs (edit as needed)
 CACHE_SIZES=(2048 4096)
 ASSOCS=(1 2)
 BLOCKS=(16 32)
 
-# Exactly these workloads; script does NOT check for file existence
+# Workloads whose traces are missing are reported and skipped
 WORKLOADS=(bodytrack blackscholes fluidanimate)
 
-for workload in "${WORKLOADS[@]}"; do
-  for csz in "${CACHE_SIZES[@]}"; do
-    for assoc in "${ASSOCS[@]}"; do
-      for blk in "${BLOCKS[@]}"; do
-        echo "===== RUN: workload=${workload} cs=${csz} assoc=${assoc} blk=${blk} =====" >> "$OUT" 2>&1
-        "${EXEC}" "${PROTOCOL}" "${workload}" "${csz}" "${assoc}" "${blk}" >> "$OUT" 2>&1
-        echo
-      done
-    done
-  done
-done
\ No newline at end of file
+join() { local IFS=,; echo "$*"; }
+
+# (Re)build when the binary is missing or older than the sources; by hand:
+#   g++ -O2 -std=c++17 -pthread -o CacheSimulator CacheSimulator.cpp -lz
+# -pthread for the worker and read-ahead threads, -lz for compressed traces.
+if [ ! -x "$EXEC" ] || [ -n "$(find . -maxdepth 1 \( -name '*.h' -o -name CacheSimulator.cpp \) -newer "$EXEC")" ]; then
+  g++ -O2 -std=c++17 -pthread -o "$EXEC" CacheSimulator.cpp -lz
+fi
+
+# One process runs the whole grid in parallel and prints a combined table
+"${EXEC}" "${PROTOCOL}" "$(join "${WORKLOADS[@]}")" "$(join "${CACHE_SIZES[@]}")" \
+  "$(join "${ASSOCS[@]}")" "$(join "${BLOCKS[@]}")" --format "$FORMAT" > "$OUT" 2>&1